@@ -8,7 +8,11 @@
 #include <time.h>
 #include <sys/time.h>
 
-#include "utils/queue.h"
+#include "log/log.h"
+#include "utils/frame.h"
+#include "utils/pool.h"
+#include "utils/reactor.h"
+#include "utils/ring.h"
 #include "utils/sockets.h"
 #include "budget-chat/client.h"
 
@@ -42,48 +46,135 @@ void clients_last(struct client** pc)
   *pc = last;
 }
 
-void client_open(struct client** pc, int fd)
+/**
+ * @brief Sends a message to the client without blocking.
+ *
+ * A failure only affects this client, its connection gets closed by the
+ * reactor. Detached clients (no connection) write straight to their fd.
+ *
+ * @return 0 on success, otherwise an errno value.
+ */
+int client_send(struct client* c, char* msg, size_t size)
 {
-  *pc = malloc(sizeof(struct client));
-  (*pc)->name[0] = 0;
-  (*pc)->id = fd;
-  (*pc)->recv_qu = NULL;
-  queue_init(&(*pc)->recv_qu, CLIENT_RECV_QUEUE_SIZE);
-  (*pc)->next = NULL;
-  (*pc)->prev = NULL;
+  assert(c != NULL);
+
+  int l = (int) size;
+  int res = (c->conn != NULL ? reactor_send(c->conn, msg, &l)
+                             : sendall(c->id, msg, &l));
+  if (res != 0)
+    log_warn("client_send: failed to send to client '%d': %s",
+             c->id,
+             strerror(res));
+  return res;
+}
+
+// Clients come and go with connections, keep them off malloc
+static _Thread_local struct pool client_pool =
+    POOL_INIT(sizeof(struct client), POOL_DEFAULT_SLAB_OBJECTS);
+
+// -1 if its ring could not be created, e.g. out of file descriptors
+static int client_init(struct client** pc, int fd, struct reactor_conn* conn)
+{
+  struct client* c = pool_get(&client_pool);
+  assert(c != NULL);
+  c->recv_rg = NULL;
+  if (ring_init(&c->recv_rg, CLIENT_RECV_QUEUE_SIZE) != 0) {
+    pool_put(&client_pool, c);
+    return -1;
+  }
+  c->name[0] = 0;
+  c->id = fd;
+  frame_init(&c->frame, MESSAGE_DELIMETER[0]);
+  c->conn = conn;
+  c->next = NULL;
+  c->prev = NULL;
+  *pc = c;
 
   // Send welcome message
-  int l = CLIENT_WELCOME_PROMPT_SIZE;
-  int res = sendall((*pc)->id, CLIENT_WELCOME_PROMPT, &l);
-  assert(res == 0);
-  assert(l == CLIENT_WELCOME_PROMPT_SIZE);
+  client_send(c, CLIENT_WELCOME_PROMPT, CLIENT_WELCOME_PROMPT_SIZE);
+  return 0;
+}
+
+/**
+ * @brief Creates a client on its own, *pc is left as it was on failure.
+ *
+ * @return 0 on success, -1 if out of file descriptors for its ring.
+ */
+int client_open(struct client** pc, int fd)
+{
+  return client_init(pc, fd, NULL);
+}
+
+/**
+ * @brief Links a new client in front of *pc, which then points to it.
+ *
+ * O(1), the connection keeps a handle to it so nobody has to search for it.
+ *
+ * @return 0 on success, -1 if it could not be created, the list is left
+ * as it was then.
+ */
+int client_add(struct client** pc, struct reactor_conn* conn)
+{
+  assert(conn != NULL);
+
+  struct client* c = NULL;
+  if (client_init(&c, conn->fd, conn) != 0)
+    return -1;
+  conn->udata = c;
+  if (*pc != NULL) {
+    c->next = *pc;
+    c->prev = (*pc)->prev;
+    if (c->prev != NULL)
+      c->prev->next = c;
+    (*pc)->prev = c;
+  }
+  *pc = c;
+  return 0;
 }
 
 void client_broadcast_message_from(struct client* c, char* msg, size_t size)
 {
   assert(c != NULL);
 
-  int r, l;
   struct client* me = c;
   client_first(&c);
   struct client* next = c->next;
   struct client* last = c;
   do {
-    if ((last->id != me->id) && (last->name[0] != 0)) {
-      l = (int) size;
-      r = sendall(c->id, msg, &l);
-      assert(r == 0);
-    }
+    if ((last->id != me->id) && (last->name[0] != 0))
+      client_send(last, msg, size);
 
     next = last->next;
     last = next;
   } while (last != NULL);
 }
 
+// Everything received so far as a single message. It stays readable until
+// the next write to the ring.
+static size_t client_pop(struct client* c, char** msg)
+{
+  *msg = ring_read_ptr(c->recv_rg);
+  size_t size = c->recv_rg->size;
+  ring_consume(c->recv_rg, size);
+  return size;
+}
+
+/**
+ * @brief Releases a client without touching the list it may be in.
+ */
+void client_free(struct client** pc)
+{
+  assert(*pc != NULL);
+
+  ring_free(&((*pc)->recv_rg));
+  pool_put(&client_pool, *pc);
+  *pc = NULL;
+}
+
 void client_close(struct client** pc)
 {
   assert(*pc != NULL);
-  assert((*pc)->recv_qu != NULL);
+  assert((*pc)->recv_rg != NULL);
 
   // Tell everybody that this person left the chat
   char newuser[128];
@@ -101,10 +192,7 @@ void client_close(struct client** pc)
   if (next != NULL)
     next->prev = prev;
 
-  queue_free(&(curr->recv_qu));
-  curr->recv_qu = NULL;
-  free(curr);
-  curr = NULL;
+  client_free(&curr);
 
   // Adjust argument pointer
   if (prev != NULL) {
@@ -170,7 +258,10 @@ bool client_name_exists(struct client* c, struct client_name_request* name_req)
   return false;
 }
 
-bool client_validate_username(struct client* c, struct client_name_request* req)
+bool client_validate_username(struct client* c,
+                              struct client_name_request* req,
+                              char* name,
+                              size_t size)
 {
   assert(c != NULL);
   assert(req != NULL);
@@ -178,10 +269,7 @@ bool client_validate_username(struct client* c, struct client_name_request* req)
   // TODO: change from bool to int
   // Create error codes for all the possible errors
   // To give the user meaningful error messages
-  char* name = NULL;
-  size_t size;
   req->valid = false;
-  size = (size_t) queue_pop_no_copy(c->recv_qu, &name);
   size--;  // Loose the /r
   if (size < 1) {
     strcpy(req->invalid_name_response, "Empty username provided");
@@ -209,72 +297,81 @@ bool client_validate_username(struct client* c, struct client_name_request* req)
   }
 
   memcpy(c->name, name, size);
-  c->name[size + 1] = 0;
+  c->name[size] = 0;
   c->name_size = size;
   return true;
 }
 
-void client_collect_list_of_names_other_names(struct client* c)
+/**
+ * @brief Sends c the names of everybody else in the room.
+ *
+ * Composed on the stack and sent in pieces when it fills up, so the receive
+ * ring keeps whatever partial line it holds.
+ */
+void client_send_list_of_other_names(struct client* c)
 {
   assert(c != NULL);
-  /*assert(queue_empty(c->recv_qu) == true);*/
+
+  char list[CLIENT_MEMBERS_BUFFER_SIZE];
+  size_t size = CLIENT_MEMBERS_SIZE;
+  memcpy(list, CLIENT_MEMBERS, CLIENT_MEMBERS_SIZE);
 
   struct client* me = c;
   client_first(&c);
   struct client* next = c->next;
   struct client* last = c;
-  bool first = false;
-  queue_push(me->recv_qu,  CLIENT_MEMBERS, CLIENT_MEMBERS_SIZE);
+  bool first = true;
   do {
     if ((last->id != me->id) && (last->name[0] != 0)) {
-      if (!first)
-        queue_push(me->recv_qu, ", ", 2);
-      queue_push(me->recv_qu, last->name, last->name_size);
+      if (size + 2 + last->name_size > sizeof(list)) {
+        client_send(me, list, size);
+        size = 0;
+      }
+      if (!first) {
+        memcpy(list + size, ", ", 2);
+        size += 2;
+      }
+      memcpy(list + size, last->name, last->name_size);
+      size += last->name_size;
+      first = false;
     }
 
     next = last->next;
     last = next;
   } while (last != NULL);
+
+  client_send(me, list, size);
 }
 
 void client_broadcast_message_to_all(struct client* c, char* msg, size_t size)
 {
   assert(c != NULL);
 
-  int r, l;
   client_first(&c);
   struct client* next = c->next;
   struct client* last = c;
   do {
-    if (last->name[0] != 0) {
-      l = (int) size;
-      r = sendall(c->id, msg, &l);
-      assert(r == 0);
-    }
+    if (last->name[0] != 0)
+      client_send(last, msg, size);
 
     next = last->next;
     last = next;
   } while (last != NULL);
 }
 
-int client_handle_newclient(struct client* c)
+int client_handle_newclient(struct client* c, char* line, size_t size)
 {
   assert(c != NULL);
 
   struct client_name_request req;
-  if (!client_validate_username(c, &req)) {
-    int l = strlen(req.invalid_name_response);
-    int r = sendall(c->id, req.invalid_name_response, &l);
-    assert(r == 0);
+  if (!client_validate_username(c, &req, line, size)) {
+    client_send(
+        c, req.invalid_name_response, strlen(req.invalid_name_response));
     return -1;
   }
 
   // Send new client list of all names in chat
-  client_collect_list_of_names_other_names(c);
-  char* msg;
-  size_t size = queue_pop_no_copy(c->recv_qu, &msg);
-  int r = sendall(c->id, msg, &size);
-  assert(r == 0);
+  client_send_list_of_other_names(c);
 
   // Send all users name of the new user
   char newuser[128];
@@ -283,17 +380,21 @@ int client_handle_newclient(struct client* c)
   return 1;
 }
 
-int client_handle_request(struct client* c)
+/**
+ * @brief Handles one line, delimiter included: the name of a new client or a
+ * message for everybody else.
+ *
+ * @return -1 if the connection should be closed, 0 if the line was ignored,
+ * 1 otherwise.
+ */
+int client_handle_line(struct client* c, char* msg, size_t size)
 {
-  // tokenize the messages
-  // TODO: what to do with more than one message
-  if (c->name[0] == 0) {
-    return client_handle_newclient(c);
-  }
+  assert(c != NULL);
+  assert(msg != NULL);
+
+  if (c->name[0] == 0)
+    return client_handle_newclient(c, msg, size);
 
-  // TODO: 
-  char* msg;
-  size_t size = queue_pop_no_copy(c->recv_qu, &msg);
   size--;  // Loose the /r
   // Ignoring emtpy and messages that exceed
   if (size == 0)
@@ -302,7 +403,28 @@ int client_handle_request(struct client* c)
     return 0;
 
   char mesg[CLIENT_MAX_COMPOSED_MESSAGE_SIZE];
-  size = snprintf(mesg, CLIENT_MAX_COMPOSED_MESSAGE_SIZE, "[%s] %s", c->name, msg);
-  client_broadcast_message_from(c, mesg, size);
+  // msg is not null terminated, the delimiter is part of it
+  int len = snprintf(mesg,
+                     sizeof(mesg),
+                     "[%s] %.*s",
+                     c->name,
+                     (int) (size + 1),
+                     msg);
+  if (len < 0)
+    return 0;
+  assert((size_t)len < sizeof(mesg));
+  client_broadcast_message_from(c, mesg, (size_t)len);
   return 1;
 }
+
+/// Handles everything received so far as a single line
+int client_handle_request(struct client* c)
+{
+  assert(c != NULL);
+
+  char* msg;
+  size_t size = client_pop(c, &msg);
+  if (size == 0)
+    return 0;
+  return client_handle_line(c, msg, size);
+}
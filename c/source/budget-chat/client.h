@@ -1,6 +1,8 @@
 #ifndef INCLUDE_H_
 #define INCLUDE_H_
 
+#include "utils/frame.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -8,14 +10,19 @@ extern "C" {
 #define MESSAGE_DELIMETER "\n"
 #define CLIENT_MAX_NAME 32
 #define CLIENT_MAX_MESSAGE_SIZE 1024
-#define CLIENT_MAX_COMPOSED_MESSAGE_SIZE CLIENT_MAX_MESSAGE_SIZE + CLIENT_MAX_NAME + 2
+// "[name] message" with its delimiter and the terminating null
+#define CLIENT_MAX_COMPOSED_MESSAGE_SIZE \
+  (CLIENT_MAX_NAME + 3 + CLIENT_MAX_MESSAGE_SIZE + 2)
 #define CLIENT_WELCOME_PROMPT "Welcome to budgetchat! What shall I call you?"
 #define CLIENT_MEMBERS "* The room contains: "
 #define CLIENT_MEMBERS_SIZE 21
+#define CLIENT_MEMBERS_BUFFER_SIZE 1024
 #define CLIENT_WELCOME_PROMPT_SIZE 45
 #define CLIENT_RECV_QUEUE_SIZE 1024
 #define CLIENT_INVALID_NAME_RESPONSE_SIZE 128
 
+struct reactor_conn;
+
 struct client_name_request {
   char *name;
   size_t size;
@@ -27,16 +34,22 @@ struct client {
   int id;   // fd
   char name[CLIENT_MAX_NAME + 1];
   size_t name_size;
-  struct queue* recv_qu;
+  struct ring* recv_rg;
+  struct frame frame;  // Lines found in recv_rg
+  struct reactor_conn* conn;  // Output goes through it, NULL when detached
   struct client *next;
   struct client *prev;
 };
 
 
-void client_open(struct client **pc, int fd);
+int client_open(struct client **pc, int fd);
+int client_add(struct client **pc, struct reactor_conn *conn);
+void client_free(struct client **pc);
 void client_close(struct client **pc);
 bool client_find(struct client **pc, int id);
+int client_send(struct client *c, char *msg, size_t size);
 int client_handle_request(struct client *c);
+int client_handle_line(struct client *c, char *msg, size_t size);
 
 #ifdef __cplusplus
 }
@@ -17,8 +17,10 @@
 #include <stdatomic.h>
 
 #include "log/log.h"
-#include "utils/epoll.h"
-#include "utils/queue.h"
+#include "utils/frame.h"
+#include "utils/reactor.h"
+#include "utils/ring.h"
+#include "utils/server.h"
 #include "utils/sockets.h"
 #include "utils/utils.h"
 
@@ -31,139 +33,126 @@
 #define LOG_LEVEL 0  // TRACE
 
 #define QUEUE_CAPACITY 2048
-#define MAX_NUM_CON 10
-#define MAX_EVENTS 10
+#define MAX_EVENTS 64
 #define PORT "18888"
 
-int main()
+struct chat_server {
+  struct client* c;
+};
+
+int chat_on_open(struct reactor_conn* conn)
 {
-  FILE* log_fd = NULL;
-  int listen_fd;
+  struct chat_server* srv = conn->reactor->udata;
+  // Out of file descriptors for its ring, the reactor drops it
+  return client_add(&srv->c, conn);
+}
 
-  if ((log_fd = fopen(LOG_FILE, LOG_FILE_MODE)) == NULL) {
-    printf("Cannot open log file\n");
-    exit(EXIT_FAILURE);
-  }
+void chat_on_close(struct reactor_conn* conn)
+{
+  struct chat_server* srv = conn->reactor->udata;
+  struct client* c = conn->udata;
+  if (c == NULL)
+    return;
+
+  // Closing moves c to a neighbour, keep srv->c inside the list
+  bool current = (srv->c == c);
+  client_close(&c);
+  if (current)
+    srv->c = c;
+  conn->udata = NULL;
+}
 
-  if (init_logs(log_fd, LOG_LEVEL) != 0)
-    exit(EXIT_FAILURE);
+int chat_on_timeout(struct reactor* r)
+{
+  (void)r;
+  log_error("chat_on_timeout: timeout hit. cleanup time...");
+  return REACTOR_CLOSE;
+}
 
-  if (create_server(PORT, &listen_fd) != 0) {
-    fprintf(stderr, "failed to create server\n");
-    exit(EXIT_FAILURE);
+int chat_on_data(struct reactor_conn* conn)
+{
+  size_t size;
+  int fd = conn->fd;
+
+  // Receive all the data into the ring
+  struct client* c = conn->udata;
+  assert(c != NULL);
+  int res = reactor_recv(conn, c->recv_rg);
+  log_trace("chat_on_data: handling POLLIN event on fd '%d' with res: '%d'",
+            fd,
+            res);
+
+  // Handle error case while recv data
+  if (res < -1) {
+    log_error("chat_on_data: error while receiving data");
+    return REACTOR_CLOSE;
   }
-  log_trace("main: listening...");
 
-  struct epoll_event ev, events[MAX_EVENTS];
-  int nfds, epollfd;
+  // Handle every complete line, the partial one stays in the ring
+  struct ring* rg = c->recv_rg;
+  while ((size = frame_next(&c->frame, ring_read_ptr(rg), rg->size)) > 0) {
+    log_trace("chat_on_data: line: fd: '%d', size: '%zu'", fd, size);
+    int rs = client_handle_line(c, ring_read_ptr(rg), size);
+    ring_consume(rg, size);
+    if (rs < 0) {
+      log_error("chat_on_data: failed during client handle");
+      return REACTOR_CLOSE;
+    }
+  }
+
+  // Handle socket still open, otherwise close requested
+  return (res == -1 ? REACTOR_KEEP : REACTOR_CLOSE);
+}
+
+void* chat_worker_init(int id)
+{
+  (void)id;
+  struct chat_server* srv = malloc(sizeof(struct chat_server));
+  assert(srv != NULL);
+  srv->c = NULL;
+  return srv;
+}
+
+void chat_worker_free(void* udata)
+{
+  free(udata);
+}
+
+int main(int argc, char* argv[])
+{
+  FILE* log_fd = NULL;
+  struct server_options opts = {
+      PORT, 1, REACTOR_BACKEND_EPOLL, SOCKETS_DEFAULT_BACKLOG};
 
-  epollfd = epoll_create1(0);
-  if (epollfd == -1) {
-    perror("epoll_create1 failed\n");
+  if (server_options_parse(argc, argv, &opts) != 0)
     exit(EXIT_FAILURE);
-  }
-  log_trace("main: epoll created...");
 
-  ev.events = EPOLLIN | EPOLLRDHUP;
-  ev.data.fd = listen_fd;
-  if (epoll_ctl(epollfd, EPOLL_CTL_ADD, listen_fd, &ev) == -1) {
-    perror("epoll_ctl: listen_fd\n");
+  if ((log_fd = fopen(LOG_FILE, LOG_FILE_MODE)) == NULL) {
+    printf("Cannot open log file\n");
     exit(EXIT_FAILURE);
   }
 
-  bool complete_req = false, client_found = false;
-  char *data, *sddata;
-  int n, fd, res, size, sdsize, rs;
-  struct epoll_ctl_info epci = {epollfd, 0, 0};
-  struct client* c = NULL;
-
-  for (;;) {
-    log_trace("main epoll loop: epoll listening...");
-    nfds = epoll_wait(epollfd, events, MAX_EVENTS, EPOLL_WAIT_TIMEOUT);
-    if (nfds == -1) {
-      perror("epoll_wait\n");
-      exit(EXIT_FAILURE);
-    }
-
-    if (nfds == 0) {
-      log_error("main epoll loop: timeout hit. cleanup time...");
-      close(epollfd);
-      close(listen_fd);
-      // TODO: client_free_all
-      exit(EXIT_SUCCESS);
-    }
+  if (init_logs(log_fd, LOG_LEVEL) != 0)
+    exit(EXIT_FAILURE);
 
-    log_trace("main epoll loop: epoll got '%d' events", nfds);
-    for (n = 0; n < nfds; ++n) {
-      epci.new_fd = events[n].data.fd;
-      fd = events[n].data.fd;
-      epci.event = &events[n];
-
-      // Handle a new listen connection
-      if (fd == listen_fd) {
-        fd_accept_and_epoll_add(&epci);
-        client_open(&c, fd);
-        continue;
-      }
-
-      // Receive all the data into the queue
-      client_found = client_find(&c, fd);
-      assert(client_found == true);
-      res = recv_request(fd, c->recv_qu);
-      log_trace(
-          "main epoll loop: handling POLLIN event on fd '%d' with res: '%d'",
-          fd,
-          res);
-
-      // Handle error case while recv data
-      if (res < -1) {
-        log_error("main epoll loop: error while receiving data");
-        if (fd_poll_del_and_close(&epci) == -1) {
-          client_close(&c);
-          perror("epoll_ctl: recv 0");
-          exit(EXIT_FAILURE);
-        }
-
-        continue;
-      }
-
-      // Peek at the data to check if we have at least one complete request
-      complete_req = false;
-      size = queue_peek(c->recv_qu, &data);
-      if (size > 0) {
-        complete_req = (char*)memrchr(data, MESSAGE_DELIMETER[0], size);
-        log_trace("main epoll loop: complete_req = '%d'",
-                  (complete_req ? 1 : 0));
-      }
-
-      // If we do, process it
-      if ((size > 0) && (complete_req)) {
-        log_trace(
-            "main epoll loop: raw request: fd: '%d', size: '%d'", fd, size);
-
-        rs = client_handle_request(c);
-        if (rs < 0) {
-          log_error("main epoll loop:: failed during client handle");
-          if (fd_poll_del_and_close(&epci) == -1) {
-            client_close(&c);
-            perror("epoll_ctl: recv 0");
-            exit(EXIT_FAILURE);
-          }
-          continue;
-        }
-      }
-
-      // Handle socket still open
-      if (res == -1)
-        continue;
-
-      // Handle closing request received
-      client_close(&c);
-      log_info("main epoll loop:: closing connection");
-      if (fd_poll_del_and_close(&epci) == -1) {
-        perror("epoll_ctl: recv 0");
-        exit(EXIT_FAILURE);
-      }
-    }
+  // Every client must see every other client's messages
+  if (opts.workers > 1) {
+    log_warn("main: budget-chat shares state among clients. Using 1 worker");
+    opts.workers = 1;
   }
+
+  struct server_config cfg = {
+      .reactor = {.max_events = MAX_EVENTS,
+                  .timeout_ms = EPOLL_WAIT_TIMEOUT,
+                  .handlers = {.on_open = chat_on_open,
+                               .on_data = chat_on_data,
+                               .on_close = chat_on_close,
+                               .on_timeout = chat_on_timeout}},
+      .worker_init = chat_worker_init,
+      .worker_free = chat_worker_free,
+  };
+  log_trace("main: starting '%d' workers...", opts.workers);
+
+  int res = server_run(&opts, &cfg);
+  return (res == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
 }
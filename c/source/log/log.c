@@ -22,15 +22,26 @@
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <time.h>
 #include <sys/time.h>
+#include <sys/types.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "log.h"
 
 #define MAX_CALLBACKS 32
 
+#define ASYNC_RING_SIZE 1024  // Records per thread, power of 2
+#define ASYNC_MAX_ARGS 8
+#define ASYNC_STR_SIZE 128  // Room for the %s arguments of a single record
+#define ASYNC_LINE_SIZE 2048
+
 typedef struct {
   log_LogFn fn;
   void* udata;
@@ -45,6 +56,77 @@ static struct {
   Callback callbacks[MAX_CALLBACKS];
 } L;
 
+// Raw argument of an async record, see async_capture
+typedef union {
+  long long i;
+  unsigned long long u;
+  double d;
+  const void* p;
+} AsyncArg;
+
+// Fixed size binary record, formatted later by the writer thread
+typedef struct {
+  struct timespec ts;
+  const char* fmt;
+  const char* file;
+  int line;
+  int level;
+  int nargs;
+  AsyncArg args[ASYNC_MAX_ARGS];
+  char str[ASYNC_STR_SIZE];
+} AsyncRecord;
+
+// Single producer (its thread), single consumer (the writer) ring
+typedef struct AsyncRing {
+  _Alignas(64) atomic_size_t head;
+  _Alignas(64) atomic_size_t tail;
+  atomic_size_t dropped;
+  size_t reported;  // Drops already reported by the writer
+  struct AsyncRing* next;
+  AsyncRecord records[ASYNC_RING_SIZE];
+} AsyncRing;
+
+// Conversion spec as parsed by async_parse_spec
+typedef struct {
+  const char* flags;
+  size_t flags_size;
+  const char* width;  // NULL when taken from the arguments ('*')
+  size_t width_size;
+  const char* prec;  // NULL when taken from the arguments ('*')
+  size_t prec_size;
+  bool has_prec;
+  int length;  // One of the ASYNC_LEN_*
+  char conv;
+} AsyncSpec;
+
+enum {
+  ASYNC_LEN_NONE,
+  ASYNC_LEN_HH,
+  ASYNC_LEN_H,
+  ASYNC_LEN_L,
+  ASYNC_LEN_LL,
+  ASYNC_LEN_Z,
+  ASYNC_LEN_J,
+  ASYNC_LEN_T,
+  ASYNC_LEN_LD
+};
+
+static struct {
+  atomic_bool running;
+  atomic_bool stopping;
+  int level;  // Lowest level any of the outputs takes
+  _Atomic(AsyncRing*) rings;  // Never freed, threads keep pointing to them
+  pthread_t thread;
+  time_t last_sec;  // Cached timestamp for the writer
+  char last_date[32];
+  atomic_bool idle;  // Writer asleep on wake, every ring was empty
+  pthread_mutex_t idle_lock;
+  pthread_cond_t wake;
+} A = {.idle_lock = PTHREAD_MUTEX_INITIALIZER,
+       .wake = PTHREAD_COND_INITIALIZER};
+
+static _Thread_local AsyncRing* tls_ring;
+
 static const char* level_strings[] = {
     "TRACE", "DEBUG", "INFO", "WARN", "ERROR", "FATAL"};
 
@@ -181,8 +263,551 @@ static void init_event(log_Event* ev, void* udata)
   ev->udata = udata;
 }
 
+static const char* async_parse_spec(const char* p, AsyncSpec* spec)
+{
+  memset(spec, 0, sizeof(*spec));
+
+  spec->flags = p;
+  while ((*p != 0) && (strchr("-+ #0'", *p) != NULL))
+    p++;
+  spec->flags_size = (size_t)(p - spec->flags);
+
+  spec->width = p;
+  if (*p == '*') {
+    spec->width = NULL;
+    p++;
+  } else {
+    while ((*p >= '0') && (*p <= '9'))
+      p++;
+    spec->width_size = (size_t)(p - spec->width);
+  }
+
+  if (*p == '.') {
+    spec->has_prec = true;
+    spec->prec = ++p;
+    if (*p == '*') {
+      spec->prec = NULL;
+      p++;
+    } else {
+      while ((*p >= '0') && (*p <= '9'))
+        p++;
+      spec->prec_size = (size_t)(p - spec->prec);
+    }
+  }
+
+  switch (*p) {
+    case 'h':
+      spec->length = (p[1] == 'h' ? ASYNC_LEN_HH : ASYNC_LEN_H);
+      p += (p[1] == 'h' ? 2 : 1);
+      break;
+    case 'l':
+      spec->length = (p[1] == 'l' ? ASYNC_LEN_LL : ASYNC_LEN_L);
+      p += (p[1] == 'l' ? 2 : 1);
+      break;
+    case 'z':
+      spec->length = ASYNC_LEN_Z;
+      p++;
+      break;
+    case 'j':
+      spec->length = ASYNC_LEN_J;
+      p++;
+      break;
+    case 't':
+      spec->length = ASYNC_LEN_T;
+      p++;
+      break;
+    case 'L':
+      spec->length = ASYNC_LEN_LD;
+      p++;
+      break;
+    default:
+      break;
+  }
+
+  spec->conv = *p;
+  return (*p != 0 ? p + 1 : p);
+}
+
+static long long async_arg_signed(int length, va_list* ap)
+{
+  switch (length) {
+    case ASYNC_LEN_HH:
+      return (signed char)va_arg(*ap, int);
+    case ASYNC_LEN_H:
+      return (short)va_arg(*ap, int);
+    case ASYNC_LEN_L:
+      return va_arg(*ap, long);
+    case ASYNC_LEN_LL:
+      return va_arg(*ap, long long);
+    case ASYNC_LEN_Z:
+      return va_arg(*ap, ssize_t);
+    case ASYNC_LEN_J:
+      return va_arg(*ap, intmax_t);
+    case ASYNC_LEN_T:
+      return va_arg(*ap, ptrdiff_t);
+    default:
+      return va_arg(*ap, int);
+  }
+}
+
+static unsigned long long async_arg_unsigned(int length, va_list* ap)
+{
+  switch (length) {
+    case ASYNC_LEN_HH:
+      return (unsigned char)va_arg(*ap, unsigned);
+    case ASYNC_LEN_H:
+      return (unsigned short)va_arg(*ap, unsigned);
+    case ASYNC_LEN_L:
+      return va_arg(*ap, unsigned long);
+    case ASYNC_LEN_LL:
+      return va_arg(*ap, unsigned long long);
+    case ASYNC_LEN_Z:
+      return va_arg(*ap, size_t);
+    case ASYNC_LEN_J:
+      return va_arg(*ap, uintmax_t);
+    case ASYNC_LEN_T:
+      return (unsigned long long)va_arg(*ap, ptrdiff_t);
+    default:
+      return va_arg(*ap, unsigned);
+  }
+}
+
+// Pull the arguments fmt refers to out of ap, without formatting anything.
+// Strings are copied since they may not outlive the call.
+static void async_capture(AsyncRecord* rec, const char* fmt, va_list* ap)
+{
+  AsyncSpec spec;
+  size_t str_used = 0;
+  int n = 0;
+
+  for (const char* p = fmt; *p != 0;) {
+    if (*p++ != '%')
+      continue;
+    if (*p == '%') {
+      p++;
+      continue;
+    }
+
+    p = async_parse_spec(p, &spec);
+    int needed = 1 + (spec.width == NULL) + (spec.has_prec && !spec.prec);
+    if (n + needed > ASYNC_MAX_ARGS)
+      break;
+
+    if (spec.width == NULL)
+      rec->args[n++].i = va_arg(*ap, int);
+    int prec = -1;
+    if (spec.has_prec) {
+      if (spec.prec == NULL) {
+        prec = va_arg(*ap, int);
+        rec->args[n++].i = prec;
+      } else {
+        prec = atoi(spec.prec);
+      }
+    }
+
+    switch (spec.conv) {
+      case 'd':
+      case 'i':
+        rec->args[n++].i = async_arg_signed(spec.length, ap);
+        break;
+      case 'o':
+      case 'u':
+      case 'x':
+      case 'X':
+        rec->args[n++].u = async_arg_unsigned(spec.length, ap);
+        break;
+      case 'c':
+        rec->args[n++].i = va_arg(*ap, int);
+        break;
+      case 'e':
+      case 'E':
+      case 'f':
+      case 'F':
+      case 'g':
+      case 'G':
+      case 'a':
+      case 'A':
+        rec->args[n++].d = (spec.length == ASYNC_LEN_LD
+                                ? (double)va_arg(*ap, long double)
+                                : va_arg(*ap, double));
+        break;
+      case 'p':
+        rec->args[n++].p = va_arg(*ap, void*);
+        break;
+      case 's': {
+        const char* str = va_arg(*ap, const char*);
+        if (str == NULL)
+          str = "(null)";
+        // Honor the precision, the string might not be null terminated
+        size_t room = ASYNC_STR_SIZE - 1 - str_used;
+        if ((prec >= 0) && ((size_t)prec < room))
+          room = (size_t)prec;
+        size_t len = strnlen(str, room);
+        memcpy(rec->str + str_used, str, len);
+        rec->str[str_used + len] = 0;
+        rec->args[n++].u = str_used;
+        str_used += len + (str_used + len + 1 < ASYNC_STR_SIZE ? 1 : 0);
+        break;
+      }
+      default:
+        // Unsupported conversion, stop here
+        rec->nargs = n;
+        return;
+    }
+  }
+
+  rec->nargs = n;
+}
+
+static AsyncRing* async_ring(void)
+{
+  if (tls_ring != NULL)
+    return tls_ring;
+
+  AsyncRing* ring = calloc(1, sizeof(AsyncRing));
+  if (ring == NULL)
+    return NULL;
+
+  ring->next = atomic_load(&A.rings);
+  while (!atomic_compare_exchange_weak(&A.rings, &ring->next, ring))
+    ;
+  tls_ring = ring;
+  return ring;
+}
+
+// Only called when the writer went idle, see async_idle
+static void async_wake(void)
+{
+  pthread_mutex_lock(&A.idle_lock);
+  atomic_store(&A.idle, false);
+  pthread_cond_signal(&A.wake);
+  pthread_mutex_unlock(&A.idle_lock);
+}
+
+static void async_push(int level,
+                       const char* file,
+                       int line,
+                       const char* fmt,
+                       va_list* ap)
+{
+  AsyncRing* ring = async_ring();
+  if (ring == NULL)
+    return;
+
+  size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+  if (tail - head == ASYNC_RING_SIZE) {
+    atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+    return;
+  }
+
+  AsyncRecord* rec = &ring->records[tail & (ASYNC_RING_SIZE - 1)];
+  clock_gettime(CLOCK_REALTIME, &rec->ts);
+  rec->fmt = fmt;
+  rec->file = file;
+  rec->line = line;
+  rec->level = level;
+  async_capture(rec, fmt, ap);
+  // Sequentially consistent along with A.idle, either the writer sees the
+  // record before going to sleep or this sees it asleep
+  atomic_store(&ring->tail, tail + 1);
+  if (atomic_load(&A.idle))
+    async_wake();
+}
+
+// Append the spec back as text, with the '*' replaced by their values and
+// the integer lengths normalized to ll
+static size_t async_spec_string(char* buf,
+                                const AsyncSpec* spec,
+                                const AsyncArg* width,
+                                const AsyncArg* prec)
+{
+  size_t k = 0;
+  buf[k++] = '%';
+  memcpy(buf + k, spec->flags, spec->flags_size);
+  k += spec->flags_size;
+  if (width != NULL) {
+    k += (size_t)sprintf(buf + k, "%lld", width->i);
+  } else {
+    memcpy(buf + k, spec->width, spec->width_size);
+    k += spec->width_size;
+  }
+  if (spec->has_prec) {
+    buf[k++] = '.';
+    if (prec != NULL) {
+      k += (size_t)sprintf(buf + k, "%lld", prec->i);
+    } else {
+      memcpy(buf + k, spec->prec, spec->prec_size);
+      k += spec->prec_size;
+    }
+  }
+  if (strchr("diouxX", spec->conv) != NULL) {
+    buf[k++] = 'l';
+    buf[k++] = 'l';
+  }
+  buf[k++] = spec->conv;
+  buf[k] = 0;
+  return k;
+}
+
+// Format the message of rec into buf, the way vsnprintf would have
+static size_t async_format(char* buf, size_t size, const AsyncRecord* rec)
+{
+  AsyncSpec spec;
+  char spec_buf[64];
+  size_t k = 0;
+  int n = 0, res;
+
+  const char* p = rec->fmt;
+  while ((*p != 0) && (k < size - 1)) {
+    if (*p != '%') {
+      buf[k++] = *p++;
+      continue;
+    }
+    if (p[1] == '%') {
+      buf[k++] = '%';
+      p += 2;
+      continue;
+    }
+
+    const char* start = p;
+    const char* end = async_parse_spec(p + 1, &spec);
+    int needed = 1 + (spec.width == NULL) + (spec.has_prec && !spec.prec);
+    if (n + needed > rec->nargs) {
+      // Arguments that did not fit in the record, print the rest as is
+      size_t len = strnlen(start, size - 1 - k);
+      memcpy(buf + k, start, len);
+      k += len;
+      break;
+    }
+
+    const AsyncArg* width = (spec.width == NULL ? &rec->args[n++] : NULL);
+    const AsyncArg* prec =
+        (spec.has_prec && (spec.prec == NULL) ? &rec->args[n++] : NULL);
+    const AsyncArg* arg = &rec->args[n++];
+    async_spec_string(spec_buf, &spec, width, prec);
+
+    // spec_buf is one conversion of the caller's format, arg cast to match
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+    switch (spec.conv) {
+      case 'c':
+        res = snprintf(buf + k, size - k, spec_buf, (int)arg->i);
+        break;
+      case 'd':
+      case 'i':
+        res = snprintf(buf + k, size - k, spec_buf, arg->i);
+        break;
+      case 'o':
+      case 'u':
+      case 'x':
+      case 'X':
+        res = snprintf(buf + k, size - k, spec_buf, arg->u);
+        break;
+      case 'p':
+        res = snprintf(buf + k, size - k, spec_buf, arg->p);
+        break;
+      case 's':
+        res = snprintf(buf + k, size - k, spec_buf, rec->str + arg->u);
+        break;
+      default:
+        res = snprintf(buf + k, size - k, spec_buf, arg->d);
+        break;
+    }
+#pragma GCC diagnostic pop
+    if (res > 0)
+      k += ((size_t)res < size - k ? (size_t)res : size - 1 - k);
+    p = end;
+  }
+
+  buf[k] = 0;
+  return k;
+}
+
+static void async_write(const char* line, size_t size, int level)
+{
+  if (!L.quiet && (level >= L.level))
+    fwrite(line, 1, size, stderr);
+
+  for (int i = 0; i < MAX_CALLBACKS && L.callbacks[i].fn; i++) {
+    Callback* cb = &L.callbacks[i];
+    if ((cb->fn == file_callback) && (level >= cb->level))
+      fwrite(line, 1, size, cb->udata);
+  }
+}
+
+static void async_write_record(const AsyncRecord* rec)
+{
+  char line[ASYNC_LINE_SIZE];
+
+  // localtime_r and strftime only once per second
+  if (rec->ts.tv_sec != A.last_sec) {
+    struct tm tm_info;
+    localtime_r(&rec->ts.tv_sec, &tm_info);
+    strftime(A.last_date, sizeof(A.last_date), "%Y-%m-%d %H:%M:%S", &tm_info);
+    A.last_sec = rec->ts.tv_sec;
+  }
+
+  const char* filename = strrchr(rec->file, '/');
+  filename = filename ? filename + 1 : rec->file;
+
+  int k = snprintf(line,
+                   sizeof(line),
+                   "%s.%06ld %-5s %s:%d: ",
+                   A.last_date,
+                   rec->ts.tv_nsec / 1000,
+                   level_strings[rec->level],
+                   filename,
+                   rec->line);
+  if ((k < 0) || ((size_t)k >= sizeof(line) - 1))
+    return;
+  size_t size = (size_t)k;
+  size += async_format(line + size, sizeof(line) - 1 - size, rec);
+  line[size++] = '\n';
+  async_write(line, size, rec->level);
+}
+
+// Format and write out everything currently in the rings
+static size_t async_drain(void)
+{
+  size_t count = 0;
+  char line[128];
+
+  for (AsyncRing* ring = atomic_load(&A.rings); ring != NULL;
+       ring = ring->next)
+  {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    for (; head != tail; head++, count++) {
+      async_write_record(&ring->records[head & (ASYNC_RING_SIZE - 1)]);
+      atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    }
+
+    size_t dropped = atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+    if (dropped != ring->reported) {
+      int size = snprintf(line,
+                          sizeof(line),
+                          "log: dropped '%zu' records, ring was full\n",
+                          dropped - ring->reported);
+      async_write(line, (size_t)size, LOG_WARN);
+      ring->reported = dropped;
+    }
+  }
+
+  return count;
+}
+
+static void async_flush(void)
+{
+  if (!L.quiet)
+    fflush(stderr);
+  for (int i = 0; i < MAX_CALLBACKS && L.callbacks[i].fn; i++)
+    if (L.callbacks[i].fn == file_callback)
+      fflush(L.callbacks[i].udata);
+}
+
+static bool async_pending(void)
+{
+  for (AsyncRing* ring = atomic_load(&A.rings); ring != NULL;
+       ring = ring->next)
+  {
+    if (atomic_load_explicit(&ring->head, memory_order_relaxed)
+        != atomic_load(&ring->tail))
+      return true;
+  }
+  return false;
+}
+
+// Every ring is empty, sleep until a producer pushes a record or the writer
+// is stopped
+static void async_idle(void)
+{
+  pthread_mutex_lock(&A.idle_lock);
+  atomic_store(&A.idle, true);
+  while (atomic_load(&A.idle) && !atomic_load(&A.stopping) && !async_pending())
+    pthread_cond_wait(&A.wake, &A.idle_lock);
+  atomic_store(&A.idle, false);
+  pthread_mutex_unlock(&A.idle_lock);
+}
+
+static void* async_main(void* arg)
+{
+  (void)arg;
+
+  for (;;) {
+    bool stopping = atomic_load(&A.stopping);
+    lock();
+    size_t count = async_drain();
+    if (count == 0)
+      async_flush();
+    unlock();
+
+    if (count == 0) {
+      if (stopping)
+        break;
+      async_idle();
+    }
+  }
+
+  return NULL;
+}
+
+/**
+ * @brief Moves the log_add_fp outputs (and stderr) to a background thread.
+ *
+ * From now on log_log only copies the format, its raw arguments and a
+ * timestamp into a per thread ring. The writer thread formats and flushes
+ * them. Records are dropped, and the drop reported, when a ring is full.
+ * Callbacks added with log_add_callback are not called while async.
+ *
+ * @return 0 on success, -1 if the writer thread could not be started.
+ */
+int log_async_start(void)
+{
+  if (atomic_load(&A.running))
+    return 0;
+
+  // Nothing below it is worth capturing
+  A.level = (L.quiet ? LOG_FATAL + 1 : L.level);
+  for (int i = 0; i < MAX_CALLBACKS && L.callbacks[i].fn; i++) {
+    Callback* cb = &L.callbacks[i];
+    if ((cb->fn == file_callback) && (cb->level < A.level))
+      A.level = cb->level;
+  }
+
+  atomic_store(&A.stopping, false);
+  if (pthread_create(&A.thread, NULL, async_main, NULL) != 0)
+    return -1;
+  atomic_store(&A.running, true);
+  return 0;
+}
+
+/**
+ * @brief Writes out whatever is pending and goes back to synchronous logging.
+ */
+void log_async_stop(void)
+{
+  if (!atomic_load(&A.running))
+    return;
+
+  atomic_store(&A.running, false);
+  atomic_store(&A.stopping, true);
+  async_wake();
+  pthread_join(A.thread, NULL);
+}
+
 void log_log(int level, const char* file, int line, const char* fmt, ...)
 {
+  if (atomic_load_explicit(&A.running, memory_order_relaxed)) {
+    if (level < A.level)
+      return;
+    va_list ap;
+    va_start(ap, fmt);
+    async_push(level, file, line, fmt, &ap);
+    va_end(ap);
+    return;
+  }
+
   log_Event ev = {
       .fmt = fmt,
       .file = file,
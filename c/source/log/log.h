@@ -32,11 +32,39 @@ enum {
   LOG_FATAL
 };
 
+// Calls below this level compile to nothing. The arguments are still type
+// checked, but never evaluated.
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL 0  // LOG_TRACE
+#endif
+
+#define log_disabled(...) ((void)(0 ? log_log(__VA_ARGS__) : (void)0))
+
+#if LOG_COMPILE_LEVEL <= 0
 #define log_trace(...) log_log(LOG_TRACE, __FILE__, __LINE__, __VA_ARGS__)
+#else
+#define log_trace(...) log_disabled(LOG_TRACE, __FILE__, __LINE__, __VA_ARGS__)
+#endif
+#if LOG_COMPILE_LEVEL <= 1
 #define log_debug(...) log_log(LOG_DEBUG, __FILE__, __LINE__, __VA_ARGS__)
+#else
+#define log_debug(...) log_disabled(LOG_DEBUG, __FILE__, __LINE__, __VA_ARGS__)
+#endif
+#if LOG_COMPILE_LEVEL <= 2
 #define log_info(...) log_log(LOG_INFO, __FILE__, __LINE__, __VA_ARGS__)
+#else
+#define log_info(...) log_disabled(LOG_INFO, __FILE__, __LINE__, __VA_ARGS__)
+#endif
+#if LOG_COMPILE_LEVEL <= 3
 #define log_warn(...) log_log(LOG_WARN, __FILE__, __LINE__, __VA_ARGS__)
+#else
+#define log_warn(...) log_disabled(LOG_WARN, __FILE__, __LINE__, __VA_ARGS__)
+#endif
+#if LOG_COMPILE_LEVEL <= 4
 #define log_error(...) log_log(LOG_ERROR, __FILE__, __LINE__, __VA_ARGS__)
+#else
+#define log_error(...) log_disabled(LOG_ERROR, __FILE__, __LINE__, __VA_ARGS__)
+#endif
 #define log_fatal(...) log_log(LOG_FATAL, __FILE__, __LINE__, __VA_ARGS__)
 
 const char* log_level_string(int level);
@@ -45,6 +73,8 @@ void log_set_level(int level);
 void log_set_quiet(bool enable);
 int log_add_callback(log_LogFn fn, void* udata, int level);
 int log_add_fp(FILE* fp, int level);
+int log_async_start(void);
+void log_async_stop(void);
 
 void log_log(int level, const char* file, int line, const char* fmt, ...);
 
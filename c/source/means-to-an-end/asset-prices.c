@@ -3,102 +3,414 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
+#if defined(__x86_64__)
+#  include <immintrin.h>
+#  define ASSET_PRICES_X86 1
+#endif
+
+#include "utils/pool.h"
 #include "means-to-an-end/asset-prices.h"
 
+// Every client gets one, recycled on disconnect instead of going to malloc
+static _Thread_local struct pool asset_prices_pool =
+    POOL_INIT(sizeof(struct asset_prices), POOL_DEFAULT_SLAB_OBJECTS);
+static _Thread_local struct pool asset_prices_columns_pool = POOL_INIT(
+    2 * ASSET_PRICES_POOL_CAPACITY * sizeof(int32_t),
+    POOL_DEFAULT_SLAB_OBJECTS);
+static _Thread_local struct pool asset_prices_sums_pool = POOL_INIT(
+    (ASSET_PRICES_POOL_CAPACITY + 1) * sizeof(int64_t),
+    POOL_DEFAULT_SLAB_OBJECTS);
+static _Thread_local struct pool asset_prices_seen_pool = POOL_INIT(
+    2 * ASSET_PRICES_POOL_CAPACITY * sizeof(int32_t),
+    POOL_DEFAULT_SLAB_OBJECTS);
+
+// Fibonacci hashing, then the high bits folded in, timestamps often only
+// differ in the low ones
+static size_t asset_prices_slot(struct asset_prices* ps, int32_t timestamp)
+{
+  uint32_t h = (uint32_t)timestamp * 0x9E3779B1U;
+  return (size_t)(h ^ (h >> 16)) & ps->mask;
+}
+
+// Adds timestamp to the set unless it's there already, true if it was
+static bool asset_prices_seen_add(struct asset_prices* ps, int32_t timestamp)
+{
+  if (timestamp == ASSET_PRICES_EMPTY) {
+    bool had = ps->has_empty;
+    ps->has_empty = true;
+    return had;
+  }
+
+  // Linear probing, the set is never more than half full
+  size_t k = asset_prices_slot(ps, timestamp);
+  for (; ps->seen[k] != ASSET_PRICES_EMPTY; k = (k + 1) & ps->mask) {
+    if (ps->seen[k] == timestamp)
+      return true;
+  }
+  ps->seen[k] = timestamp;
+  return false;
+}
+
 void asset_prices_init_data(struct asset_prices* ps, size_t capacity)
 {
   assert(ps != NULL);
   assert(capacity > 0);
   assert(capacity > ps->capacity);
 
-  struct asset_price* new_data = NULL;
-  new_data = reallocarray(ps->data, capacity, sizeof(struct asset_price));
-  assert(new_data != NULL);
+  size_t slots = 2 * ASSET_PRICES_POOL_CAPACITY;
+  while (slots < 2 * capacity)
+    slots *= 2;
+  // Each column starts on its own cache line
+  const size_t line = ASSET_PRICES_ALIGN / sizeof(int32_t);
+  size_t stride = (capacity + line - 1) / line * line;
 
-  ps->data = new_data;
+  bool pooled =
+      (ps->times == NULL) && (capacity == ASSET_PRICES_POOL_CAPACITY);
+  int32_t* new_times = NULL;
+  int64_t* new_sums = NULL;
+  int32_t* new_seen = NULL;
+  if (pooled) {
+    new_times = pool_get(&asset_prices_columns_pool);
+    new_sums = pool_get(&asset_prices_sums_pool);
+    new_seen = pool_get(&asset_prices_seen_pool);
+    stride = ASSET_PRICES_POOL_CAPACITY;
+  } else {
+    // Columns can't be realloc'd and stay aligned
+    new_times =
+        aligned_alloc(ASSET_PRICES_ALIGN, 2 * stride * sizeof(int32_t));
+    new_seen = reallocarray(NULL, slots, sizeof(int32_t));
+    if (ps->pooled) {
+      new_sums = reallocarray(NULL, capacity + 1, sizeof(int64_t));
+      assert(new_sums != NULL);
+      memcpy(new_sums, ps->sums, (ps->sorted + 1) * sizeof(int64_t));
+    } else {
+      new_sums = reallocarray(ps->sums, capacity + 1, sizeof(int64_t));
+    }
+  }
+  assert(new_times != NULL);
+  assert(new_sums != NULL);
+  assert(new_seen != NULL);
+
+  int32_t* new_prices = new_times + stride;
+  if (ps->times != NULL) {
+    memcpy(new_times, ps->times, ps->size * sizeof(int32_t));
+    memcpy(new_prices, ps->prices, ps->size * sizeof(int32_t));
+    if (ps->pooled) {
+      // Outgrew the pooled blocks, move to the heap
+      pool_put(&asset_prices_columns_pool, ps->times);
+      pool_put(&asset_prices_sums_pool, ps->sums);
+      pool_put(&asset_prices_seen_pool, ps->seen);
+    } else {
+      free(ps->times);
+      free(ps->seen);
+    }
+  }
+  ps->pooled = pooled;
+  ps->times = new_times;
+  ps->prices = new_prices;
+  ps->sums = new_sums;
   ps->capacity = capacity;
+
+  // Rehashed into the bigger set
+  ps->seen = new_seen;
+  ps->mask = slots - 1;
+  ps->has_empty = false;
+  for (size_t k = 0; k < slots; k++)
+    ps->seen[k] = ASSET_PRICES_EMPTY;
+  for (size_t k = 0; k < ps->size; k++)
+    asset_prices_seen_add(ps, ps->times[k]);
 }
 
 void asset_prices_init(struct asset_prices** pps, size_t capacity)
 {
   assert(capacity > 0);
 
-  *pps = malloc(sizeof(struct asset_prices));
+  *pps = pool_get(&asset_prices_pool);
   assert(*pps != NULL);
 
   (*pps)->capacity = 0;
-  (*pps)->data = NULL;
-  asset_prices_init_data(*pps, capacity);
+  (*pps)->times = NULL;
+  (*pps)->prices = NULL;
+  (*pps)->sums = NULL;
+  (*pps)->seen = NULL;
   (*pps)->size = 0;
+  (*pps)->sorted = 0;
+  (*pps)->pooled = false;
+  asset_prices_init_data(*pps, capacity);
+  (*pps)->sums[0] = 0;
 }
 
 void asset_prices_free(struct asset_prices** pps)
 {
   assert(*pps != NULL);
-  assert((*pps)->data != NULL);
+  assert((*pps)->times != NULL);
 
-  free((*pps)->data);
-  free(*pps);
+  if ((*pps)->pooled) {
+    pool_put(&asset_prices_columns_pool, (*pps)->times);
+    pool_put(&asset_prices_sums_pool, (*pps)->sums);
+    pool_put(&asset_prices_seen_pool, (*pps)->seen);
+  } else {
+    free((*pps)->times);
+    free((*pps)->sums);
+    free((*pps)->seen);
+  }
+  pool_put(&asset_prices_pool, *pps);
   *pps = NULL;
 }
 
-// TODO: On push
-//   - Check prices with the same timestamp
-//     - Don't add new prices on timestamp conflict
-//   - After push, sort, to keep the array sorted
+/**
+ * @brief Appends a price, O(1) amortized.
+ *
+ * Sessions mostly insert in timestamp order, those prices extend the index
+ * right away. Any other is left for asset_prices_query to sort in.
+ */
 void asset_prices_push(struct asset_prices* ps, struct asset_price* data)
 {
   assert(ps != NULL);
-  assert(ps->data != NULL);
+  assert(ps->times != NULL);
   assert(data != NULL);
 
   if ((ps->size + 1) >= ps->capacity) {
     asset_prices_init_data(ps, ps->capacity * 2);
   }
 
-  ps->data[ps->size++] = *data;
+  if ((ps->sorted == ps->size)
+      && ((ps->size == 0) || (ps->times[ps->size - 1] < data->timestamp)))
+  {
+    ps->sums[ps->sorted + 1] = ps->sums[ps->sorted] + data->price;
+    ps->sorted++;
+  }
+  ps->times[ps->size] = data->timestamp;
+  ps->prices[ps->size++] = data->price;
+  asset_prices_seen_add(ps, data->timestamp);
 }
 
+/// O(1), a lookup in the set of timestamps seen
 bool asset_prices_duplicate_timestamp_check(struct asset_prices* ps,
                                             int32_t timestamp)
 {
   assert(ps != NULL);
-  assert(ps->data != NULL);
+  assert(ps->times != NULL);
 
-  size_t k = 0;
-  for (; k < ps->size; k++) {
-    if (ps->data[k].timestamp == timestamp)
+  if (timestamp == ASSET_PRICES_EMPTY)
+    return ps->has_empty;
+
+  size_t k = asset_prices_slot(ps, timestamp);
+  for (; ps->seen[k] != ASSET_PRICES_EMPTY; k = (k + 1) & ps->mask) {
+    if (ps->seen[k] == timestamp)
       return true;
   }
 
   return false;
 }
 
+static int asset_prices_compare(const void* a, const void* b)
+{
+  int32_t ta = ((const struct asset_price*)a)->timestamp;
+  int32_t tb = ((const struct asset_price*)b)->timestamp;
+  return (ta > tb) - (ta < tb);
+}
+
+// First of the sorted prices with a timestamp after the given one
+static size_t asset_prices_after(struct asset_prices* ps, int64_t timestamp)
+{
+  size_t lo = 0;
+  size_t hi = ps->sorted;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (ps->times[mid] <= timestamp)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+// Sorts the prices out of order in and sums them up, along with the sorted
+// ones they land among
+static void asset_prices_index(struct asset_prices* ps)
+{
+  size_t count = ps->size - ps->sorted;
+  struct asset_price* moved =
+      reallocarray(NULL, count, sizeof(struct asset_price));
+  assert(moved != NULL);
+  for (size_t k = 0; k < count; k++) {
+    moved[k].timestamp = ps->times[ps->sorted + k];
+    moved[k].price = ps->prices[ps->sorted + k];
+  }
+  qsort(moved, count, sizeof(struct asset_price), asset_prices_compare);
+
+  // Merged from the back, the ones before the earliest new price stay put
+  size_t from = asset_prices_after(ps, moved[0].timestamp);
+  size_t i = ps->sorted;
+  size_t j = count;
+  size_t w = ps->size;
+  while (j > 0) {
+    w--;
+    if ((i > from) && (ps->times[i - 1] > moved[j - 1].timestamp)) {
+      i--;
+      ps->times[w] = ps->times[i];
+      ps->prices[w] = ps->prices[i];
+    } else {
+      j--;
+      ps->times[w] = moved[j].timestamp;
+      ps->prices[w] = moved[j].price;
+    }
+  }
+  free(moved);
+
+  for (size_t k = from; k < ps->size; k++)
+    ps->sums[k + 1] = ps->sums[k] + ps->prices[k];
+  ps->sorted = ps->size;
+}
+
+// Branch free, the timestamps come in no particular order
+static int64_t asset_prices_range_sum_scalar(const int32_t* times,
+                                             const int32_t* prices,
+                                             size_t size,
+                                             int32_t mintime,
+                                             int32_t maxtime,
+                                             size_t* count)
+{
+  int64_t sum = 0;
+  size_t in_range = 0;
+  for (size_t k = 0; k < size; k++) {
+    int64_t in = (mintime <= times[k]) & (times[k] <= maxtime);
+    sum += prices[k] & -in;
+    in_range += (size_t)in;
+  }
+  *count = in_range;
+  return sum;
+}
+
+#ifdef ASSET_PRICES_X86
+
+// 8 prices a step, the ones out of range masked to 0 and the rest widened
+// to 64 bits before they are added up
+__attribute__((target("avx2"))) static int64_t
+asset_prices_range_sum_avx2(const int32_t* times,
+                            const int32_t* prices,
+                            size_t size,
+                            int32_t mintime,
+                            int32_t maxtime,
+                            size_t* count)
+{
+  const __m256i lo = _mm256_set1_epi32(mintime);
+  const __m256i hi = _mm256_set1_epi32(maxtime);
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i sum_lo = zero;
+  __m256i sum_hi = zero;
+  __m256i in_range = zero;
+  size_t k = 0;
+  for (; k + 8 <= size; k += 8) {
+    __m256i t = _mm256_loadu_si256((const __m256i*)&times[k]);
+    __m256i p = _mm256_loadu_si256((const __m256i*)&prices[k]);
+    __m256i out = _mm256_or_si256(_mm256_cmpgt_epi32(lo, t),
+                                  _mm256_cmpgt_epi32(t, hi));
+    p = _mm256_andnot_si256(out, p);
+    sum_lo = _mm256_add_epi64(
+        sum_lo, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(p)));
+    sum_hi = _mm256_add_epi64(
+        sum_hi, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(p, 1)));
+    // -1 in the lanes in range
+    in_range = _mm256_sub_epi32(in_range, _mm256_cmpeq_epi32(out, zero));
+  }
+
+  int64_t sums[4];
+  uint32_t counts[8];
+  _mm256_storeu_si256((__m256i*)sums, _mm256_add_epi64(sum_lo, sum_hi));
+  _mm256_storeu_si256((__m256i*)counts, in_range);
+  int64_t sum = sums[0] + sums[1] + sums[2] + sums[3];
+  size_t total = 0;
+  for (size_t l = 0; l < 8; l++)
+    total += counts[l];
+
+  size_t rest;
+  sum += asset_prices_range_sum_scalar(
+      &times[k], &prices[k], size - k, mintime, maxtime, &rest);
+  *count = total + rest;
+  return sum;
+}
+
+#endif
+
+/// Best implementation this CPU runs, ASSET_PRICES_ISA_*
+int asset_prices_isa(void)
+{
+#ifdef ASSET_PRICES_X86
+  if (__builtin_cpu_supports("avx2"))
+    return ASSET_PRICES_ISA_AVX2;
+#endif
+  return ASSET_PRICES_ISA_SCALAR;
+}
+
+/**
+ * @brief Adds up the prices whose timestamp is in [mintime, maxtime], in
+ * no particular order, with a given implementation.
+ *
+ * Falls back to the scalar one when the CPU lacks the instructions.
+ *
+ * @param count How many of them there are.
+ * @return Their sum.
+ */
+int64_t asset_prices_range_sum_isa(int isa,
+                                   const int32_t* times,
+                                   const int32_t* prices,
+                                   size_t size,
+                                   int32_t mintime,
+                                   int32_t maxtime,
+                                   size_t* count)
+{
+  assert(times != NULL || size == 0);
+  assert(prices != NULL || size == 0);
+  assert(count != NULL);
+
+  int best = asset_prices_isa();
+  if ((isa == ASSET_PRICES_ISA_AUTO) || (isa > best))
+    isa = best;
+
+#ifdef ASSET_PRICES_X86
+  if (isa == ASSET_PRICES_ISA_AVX2)
+    return asset_prices_range_sum_avx2(
+        times, prices, size, mintime, maxtime, count);
+#endif
+  return asset_prices_range_sum_scalar(
+      times, prices, size, mintime, maxtime, count);
+}
+
 /*If there are no samples within the requested period, or if mintime comes after
  * maxtime, the value returned must be 0.*/
 int32_t asset_prices_query(struct asset_prices* ps,
                            struct asset_price_query* pq)
 {
   assert(ps != NULL);
-  assert(ps->data != NULL);
+  assert(ps->times != NULL);
   assert(pq != NULL);
 
-  if (ps->size == 0)
+  if ((ps->size == 0) || (pq->mintime > pq->maxtime))
     return 0;
+  if (ps->size - ps->sorted > ASSET_PRICES_UNSORTED_MAX)
+    asset_prices_index(ps);
 
-  size_t k = 0;
-  int64_t mean = 0;
-  int32_t num_prices = 0;
-  int32_t curr_ts = 0;
-  for (; k < ps->size; k++) {
-    curr_ts = ps->data[k].timestamp;
-    if ((pq->mintime <= curr_ts) && (curr_ts <= pq->maxtime)) {
-      mean += ps->data[k].price;
-      num_prices++;
-    }
-  }
+  // Two binary searches over the sorted ones
+  size_t first = asset_prices_after(ps, (int64_t)pq->mintime - 1);
+  size_t last = asset_prices_after(ps, pq->maxtime);
+  int64_t mean = ps->sums[last] - ps->sums[first];
+  size_t num_prices = last - first;
+
+  // A scan over the others
+  size_t scanned;
+  mean += asset_prices_range_sum_isa(ASSET_PRICES_ISA_AUTO,
+                                     &ps->times[ps->sorted],
+                                     &ps->prices[ps->sorted],
+                                     ps->size - ps->sorted,
+                                     pq->mintime,
+                                     pq->maxtime,
+                                     &scanned);
+  num_prices += scanned;
 
-  return num_prices == 0 ? 0 : mean / num_prices;
+  return num_prices == 0 ? 0 : (int32_t)(mean / (int64_t)num_prices);
 }
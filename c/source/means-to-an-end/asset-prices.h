@@ -15,20 +15,37 @@ struct asset_price_query {
   int32_t maxtime;
 };
 
-// Array structure
+// Column structure, the first sorted prices are in timestamp order and the
+// rest in the order they came
 struct asset_prices {
-  struct asset_price* data;
+  int32_t* times;  // times[k] is the timestamp of prices[k]
+  int32_t* prices;  // Same block as times, on a cache line of its own
+  int64_t* sums;  // sums[k] adds up the first k prices, for k <= sorted
+  int32_t* seen;  // Open addressing set of the timestamps held
   size_t size;  // Number of struct price we are holding
   size_t capacity;  // Not bytes, but number struct price we can hold
+  size_t sorted;
+  size_t mask;  // Slots in seen minus one, at least twice capacity
+  bool pooled;  // data came from the per-thread pool, not malloc
+  bool has_empty;  // Holds ASSET_PRICES_EMPTY, which can't be in the set
 };
 
+// Initial capacity served from a per-thread pool, bigger ones use malloc
+#define ASSET_PRICES_POOL_CAPACITY 16  // Power of 2
+// Marks a free slot of the seen set
+#define ASSET_PRICES_EMPTY INT32_MIN
+// Where the columns on the heap start, a cache line
+#define ASSET_PRICES_ALIGN 64
+
+#define ASSET_PRICES_ISA_AUTO 0  // Best one the CPU supports
+#define ASSET_PRICES_ISA_SCALAR 1
+#define ASSET_PRICES_ISA_AVX2 2
+// Prices out of order that queries scan before they get sorted in
+#define ASSET_PRICES_UNSORTED_MAX 1024
+
 void asset_prices_init(struct asset_prices** pps, size_t capacity);
 void asset_prices_init_data(struct asset_prices* ps, size_t capacity);
 void asset_prices_free(struct asset_prices** pps);
-// TODO: On push
-//   - Check prices with the same timestamp
-//     - Don't add new prices on timestamp conflict
-//   - After push, sort, to keep the array sorted
 void asset_prices_push(struct asset_prices* ps, struct asset_price* data);
 bool asset_prices_duplicate_timestamp_check(struct asset_prices* ps,
                                             int32_t timestamp);
@@ -36,6 +53,14 @@ bool asset_prices_duplicate_timestamp_check(struct asset_prices* ps,
  * maxtime, the value returned must be 0.*/
 int32_t asset_prices_query(struct asset_prices* ps,
                            struct asset_price_query* pq);
+int asset_prices_isa(void);
+int64_t asset_prices_range_sum_isa(int isa,
+                                   const int32_t* times,
+                                   const int32_t* prices,
+                                   size_t size,
+                                   int32_t mintime,
+                                   int32_t maxtime,
+                                   size_t* count);
 
 #ifdef __cplusplus
 }
@@ -6,28 +6,44 @@
 #include <stdlib.h>
 #include <assert.h>
 
-#include "utils/queue.h"
+#include "utils/pool.h"
+#include "utils/ring.h"
 #include "means-to-an-end/asset-prices.h"
 #include "means-to-an-end/client-session.h"
 
-void clients_session_init(struct clients_session** pca, int client_id)
+// Sessions come and go with connections, keep them off malloc
+static _Thread_local struct pool clients_session_pool =
+    POOL_INIT(sizeof(struct clients_session), POOL_DEFAULT_SLAB_OBJECTS);
+
+/**
+ * @brief Creates a session on its own.
+ *
+ * @return 0 on success, -1 if its ring could not be created, e.g. out of
+ * file descriptors. *pca is left NULL then.
+ */
+int clients_session_init(struct clients_session** pca, int client_id)
 {
   assert(*pca == NULL);
   assert(client_id > 0);
 
-  *pca = malloc(sizeof(struct clients_session));
-  assert(*pca != NULL);
+  struct clients_session* ca = pool_get(&clients_session_pool);
+  assert(ca != NULL);
 
-  asset_prices_init(&(*pca)->asset, 16);
-  assert((*pca)->asset != NULL);
+  ca->recv_rg = NULL;
+  if (ring_init(&ca->recv_rg, 512) != 0) {
+    pool_put(&clients_session_pool, ca);
+    return -1;
+  }
 
-  (*pca)->recv_qu = NULL;
-  queue_init(&(*pca)->recv_qu, 512);
-  assert((*pca)->recv_qu != NULL);
+  ca->asset = NULL;
+  asset_prices_init(&ca->asset, ASSET_PRICES_POOL_CAPACITY);
+  assert(ca->asset != NULL);
 
-  (*pca)->next = NULL;
-  (*pca)->prev = NULL;
-  (*pca)->client_id = client_id;
+  ca->next = NULL;
+  ca->prev = NULL;
+  ca->client_id = client_id;
+  *pca = ca;
+  return 0;
 }
 
 void clients_session_get_beg(struct clients_session** pca)
@@ -63,9 +79,8 @@ void clients_session_free(struct clients_session** pca)
 
   asset_prices_free(&(curr->asset));
   curr->asset = NULL;
-  queue_free(&(curr->recv_qu));
-  curr->recv_qu = NULL;
-  free(curr);
+  ring_free(&(curr->recv_rg));
+  pool_put(&clients_session_pool, curr);
   curr = NULL;
 
   // Adjust argument pointer
@@ -107,20 +122,31 @@ void clients_session_get_end(struct clients_session** pca)
   *pca = last;
 }
 
-void clients_session_add(struct clients_session** pca, int id)
+/**
+ * @brief Links a new session in front of *pca, which then points to it.
+ *
+ * O(1), the list order does not matter to anybody.
+ *
+ * @return 0 on success, -1 if it could not be created, the list is left
+ * as it was then.
+ */
+int clients_session_add(struct clients_session** pca, int id)
 {
   assert(id > 0);
 
-  if (*pca == NULL) {
-    clients_session_init(pca, id);
-    return;
-  }
-
-  clients_session_get_end(pca);
-
-  clients_session_init(&((*pca)->next), id);
-  struct clients_session* next = (*pca)->next;
-  next->prev = *pca;
+  if (*pca == NULL)
+    return clients_session_init(pca, id);
+
+  struct clients_session* ca = NULL;
+  if (clients_session_init(&ca, id) != 0)
+    return -1;
+  ca->next = *pca;
+  ca->prev = (*pca)->prev;
+  if (ca->prev != NULL)
+    ca->prev->next = ca;
+  (*pca)->prev = ca;
+  *pca = ca;
+  return 0;
 }
 
 bool clients_session_remove(struct clients_session** pca, int id)
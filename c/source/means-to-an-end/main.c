@@ -17,8 +17,10 @@
 #include <stdatomic.h>
 
 #include "log/log.h"
-#include "utils/epoll.h"
 #include "utils/queue.h"
+#include "utils/reactor.h"
+#include "utils/ring.h"
+#include "utils/server.h"
 #include "utils/sockets.h"
 #include "utils/utils.h"
 
@@ -32,149 +34,166 @@
 #define LOG_LEVEL 0  // TRACE
 
 #define QUEUE_CAPACITY 65536  //  1024 * 64
-#define MAX_NUM_CON 10
-#define MAX_EVENTS 10
+#define MAX_EVENTS 64
 #define PORT "18888"
-
-int main()
+// Answers are sent as soon as this many bytes of them are ready
+#define MEANS_FLUSH_BYTES 4096
+// Input read before answering it, the rest waits in the socket
+#define MEANS_INPUT_MAX (64 * 1024)
+// Answers the client may leave unread before no more is read from it
+#define MEANS_OUTPUT_MAX (64 * 1024)
+
+struct means_server {
+  struct queue* sdqu;
+  struct clients_session* ca;
+};
+
+// The session rides along in the connection, so events never search for it
+int means_on_open(struct reactor_conn* conn)
 {
-  FILE* log_fd = NULL;
-  int listen_fd;
+  struct means_server* srv = conn->reactor->udata;
+  // Out of file descriptors for its ring, the reactor drops it
+  if (clients_session_add(&srv->ca, conn->fd) != 0)
+    return -1;
+  conn->udata = srv->ca;
+  conn->recv_max = MEANS_INPUT_MAX;
+  return 0;
+}
 
-  if ((log_fd = fopen(LOG_FILE, LOG_FILE_MODE)) == NULL) {
-    printf("Cannot open log file\n");
-    exit(EXIT_FAILURE);
-  }
+void means_on_close(struct reactor_conn* conn)
+{
+  struct means_server* srv = conn->reactor->udata;
+  struct clients_session* ca = conn->udata;
+  if (ca == NULL)
+    return;
+
+  // Freeing moves ca to a neighbour, keep srv->ca inside the list
+  bool current = (srv->ca == ca);
+  clients_session_free(&ca);
+  if (current)
+    srv->ca = ca;
+  conn->udata = NULL;
+}
 
-  if (init_logs(log_fd, LOG_LEVEL) != 0)
-    exit(EXIT_FAILURE);
+int means_on_timeout(struct reactor* r)
+{
+  (void)r;
+  log_error("means_on_timeout: timeout hit. cleanup time...");
+  return REACTOR_CLOSE;
+}
 
-  if (create_server(PORT, &listen_fd) != 0) {
-    fprintf(stderr, "failed to create server\n");
-    exit(EXIT_FAILURE);
-  }
-  log_trace("main: listening...");
+// Reads again once everything read is answered, unless the client is
+// falling behind on the answers
+static int means_throttle(struct reactor_conn* conn)
+{
+  if (reactor_pending(conn) >= MEANS_OUTPUT_MAX)
+    return reactor_pause(conn);
+  return reactor_resume(conn);
+}
 
-  struct epoll_event ev, events[MAX_EVENTS];
-  int nfds, epollfd;
+int means_on_drain(struct reactor_conn* conn)
+{
+  return (means_throttle(conn) == 0 ? REACTOR_KEEP : REACTOR_CLOSE);
+}
 
-  epollfd = epoll_create1(0);
-  if (epollfd == -1) {
-    perror("epoll_create1 failed\n");
-    exit(EXIT_FAILURE);
+int means_on_data(struct reactor_conn* conn)
+{
+  char *data, *sddata;
+  size_t size, parsed;
+  int sdsize, rs;
+  int fd = conn->fd;
+  struct means_server* srv = conn->reactor->udata;
+
+  // Receive all the data into the ring
+  struct clients_session* ca = conn->udata;
+  assert(ca != NULL);
+  int res = reactor_recv(conn, ca->recv_rg);
+  log_trace("means_on_data: handling POLLIN event on fd '%d' with res: '%d'",
+            fd,
+            res);
+
+  // Handle error case while recv data
+  if (res < -1) {
+    log_error("means_on_data: error while receiving data");
+    return REACTOR_CLOSE;
   }
-  log_trace("main: epoll created...");
 
-  ev.events = EPOLLIN | EPOLLRDHUP;
-  ev.data.fd = listen_fd;
-  if (epoll_ctl(epollfd, EPOLL_CTL_ADD, listen_fd, &ev) == -1) {
-    perror("epoll_ctl: listen_fd\n");
-    exit(EXIT_FAILURE);
+  // Process the complete requests and keep the partial one for later. The
+  // answers go out every MEANS_FLUSH_BYTES, not once everything is handled
+  while (ca->recv_rg->size >= MESSAGE_SIZE) {
+    data = ring_read_ptr(ca->recv_rg);
+    size = ca->recv_rg->size - ca->recv_rg->size % MESSAGE_SIZE;
+    log_trace("means_on_data: raw request: fd: '%d', size: '%zu'", fd, size);
+
+    parsed =
+        message_parse(ca->asset, srv->sdqu, data, size, MEANS_FLUSH_BYTES);
+    ring_consume(ca->recv_rg, parsed);
+    sdsize = queue_pop_no_copy(srv->sdqu, &sddata);
+    if (sdsize > 0) {
+      rs = reactor_send(conn, sddata, &sdsize);
+      if (rs != 0) {
+        log_error("means_on_data: failed during reactor_send");
+        return REACTOR_CLOSE;
+      }
+    }
   }
 
-  bool complete_req = false, client_found = false;
-  char *data, *sddata;
-  int n, fd, res, size, sdsize, rs;
-  struct epoll_ctl_info epci = {epollfd, 0, 0};
-  struct queue* sdqu = NULL;
-  struct clients_session* ca = NULL;
-  queue_init(&sdqu, QUEUE_CAPACITY);
-
-  for (;;) {
-    log_trace("main epoll loop: epoll listening...");
-    nfds = epoll_wait(epollfd, events, MAX_EVENTS, EPOLL_WAIT_TIMEOUT);
-    if (nfds == -1) {
-      perror("epoll_wait\n");
-      exit(EXIT_FAILURE);
-    }
+  // Handle socket still open, otherwise close requested
+  if (res != -1)
+    return REACTOR_CLOSE;
+  return (means_throttle(conn) == 0 ? REACTOR_KEEP : REACTOR_CLOSE);
+}
 
-    if (nfds == 0) {
-      log_error("main epoll loop: timeout hit. cleanup time...");
-      close(epollfd);
-      close(listen_fd);
-      queue_free(&sdqu);
-      if (ca != NULL)
-        clients_session_free_all(&ca);
-      exit(EXIT_SUCCESS);
-    }
+void* means_worker_init(int id)
+{
+  (void)id;
+  struct means_server* srv = malloc(sizeof(struct means_server));
+  assert(srv != NULL);
+  srv->sdqu = NULL;
+  srv->ca = NULL;
+  queue_init(&srv->sdqu, QUEUE_CAPACITY);
+  return srv;
+}
 
-    log_trace("main epoll loop: epoll got '%d' events", nfds);
-    for (n = 0; n < nfds; ++n) {
-      epci.new_fd = events[n].data.fd;
-      fd = events[n].data.fd;
-      epci.event = &events[n];
-
-      // Handle a new listen connection
-      if (events[n].data.fd == listen_fd) {
-        int new_fd = fd_accept_and_epoll_add(&epci);
-        clients_session_add(&ca, new_fd);
-        continue;
-      }
+void means_worker_free(void* udata)
+{
+  struct means_server* srv = udata;
+  queue_free(&srv->sdqu);
+  if (srv->ca != NULL)
+    clients_session_free_all(&srv->ca);
+  free(srv);
+}
 
-      // Receive all the data into the queue
-      client_found = clients_session_find(&ca, fd);
-      assert(client_found);
-      res = recv_request(fd, ca->recv_qu);
-      log_trace(
-          "main epoll loop: handling POLLIN event on fd '%d' with res: '%d'",
-          fd,
-          res);
-
-      // Handle error case while recv data
-      if (res < -1) {
-        log_error("main epoll loop: error while receiving data");
-        clients_session_remove(&ca, fd);
-        if (fd_poll_del_and_close(&epci) == -1) {
-          perror("epoll_ctl: recv 0");
-          exit(EXIT_FAILURE);
-        }
-
-        continue;
-      }
+int main(int argc, char* argv[])
+{
+  FILE* log_fd = NULL;
+  struct server_options opts = {
+      PORT, 1, REACTOR_BACKEND_EPOLL, SOCKETS_DEFAULT_BACKLOG};
 
-      // Peek at the data to check if we have at least one complete request
-      complete_req = false;
-      size = queue_peek(ca->recv_qu, &data);
-      if ((size > 0) && (size % MESSAGE_SIZE == 0)) {
-        complete_req = true;
-        log_trace("main epoll loop: complete_req = '%d'",
-                  (complete_req ? 1 : 0));
-      }
+  if (server_options_parse(argc, argv, &opts) != 0)
+    exit(EXIT_FAILURE);
 
-      // If we do, process itl
-      if (complete_req) {
-        size = queue_pop_no_copy(ca->recv_qu, &data);
-        log_trace(
-            "main epoll loop: raw request: fd: '%d', size: '%d'", fd, size);
-
-        message_parse(ca->asset, sdqu, data, (size_t)size);
-        sdsize = queue_pop_no_copy(sdqu, &sddata);
-        if (sdsize > 0) {
-          rs = sendall(fd, sddata, &sdsize);
-          if (rs != 0) {
-            log_error("main epoll loop:: failed during sendall function");
-            clients_session_remove(&ca, fd);
-            if (fd_poll_del_and_close(&epci) == -1) {
-              perror("epoll_ctl: recv 0");
-              exit(EXIT_FAILURE);
-            }
-            continue;
-          }
-        }
-      }
+  if ((log_fd = fopen(LOG_FILE, LOG_FILE_MODE)) == NULL) {
+    printf("Cannot open log file\n");
+    exit(EXIT_FAILURE);
+  }
 
-      // Handle socket still open
-      if (res == -1)
-        continue;
+  if (init_logs(log_fd, LOG_LEVEL) != 0)
+    exit(EXIT_FAILURE);
 
-      // Handle closing request received
-      log_info("main epoll loop:: closing connection");
-      clients_session_remove(&ca, fd);
-      if (fd_poll_del_and_close(&epci) == -1) {
-        perror("epoll_ctl: recv 0");
-        exit(EXIT_FAILURE);
-      }
-    }
-  }
-  printf("Hello world\n");
+  struct server_config cfg = {
+      .reactor = {.max_events = MAX_EVENTS,
+                  .timeout_ms = EPOLL_WAIT_TIMEOUT,
+                  .handlers = {.on_open = means_on_open,
+                               .on_data = means_on_data,
+                               .on_close = means_on_close,
+                               .on_timeout = means_on_timeout,
+                               .on_drain = means_on_drain}},
+      .worker_init = means_worker_init,
+      .worker_free = means_worker_free,
+  };
+  log_trace("main: starting '%d' workers...", opts.workers);
+
+  int res = server_run(&opts, &cfg);
+  return (res == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
 }
@@ -8,10 +8,19 @@
 #include "means-to-an-end/asset-prices.h"
 #include "means-to-an-end/messages.h"
 
-void message_parse(struct asset_prices* ps,
-                   struct queue* sdqu,
-                   char* data,
-                   size_t dsize)
+/**
+ * @brief Handles the messages in data, queueing the answers to queries.
+ *
+ * Stops early once sdqu holds at least flush bytes, so that they can go out
+ * before the rest is handled. 0 handles everything.
+ *
+ * @return Bytes handled, a multiple of MESSAGE_SIZE.
+ */
+size_t message_parse(struct asset_prices* ps,
+                     struct queue* sdqu,
+                     char* data,
+                     size_t dsize,
+                     size_t flush)
 {
   assert(ps != NULL);
   assert(sdqu != NULL);
@@ -27,6 +36,9 @@ void message_parse(struct asset_prices* ps,
   struct message* msg;
 
   for (k = 0; k < num_msgs; k++, pd += MESSAGE_SIZE) {
+    if ((flush > 0) && (sdqu->size >= flush))
+      break;
+
     msg = (struct message*)pd;
 
     switch (msg->type) {
@@ -49,4 +61,6 @@ void message_parse(struct asset_prices* ps,
         break;
     }
   }
+
+  return (size_t)k * MESSAGE_SIZE;
 }
@@ -14,9 +14,10 @@ struct __attribute__((packed)) message {
   uint32_t second_word;
 };
 
-void message_parse(struct asset_prices* ps,
-                   struct queue* sdqu,
-                   char* data,
-                   size_t dsize);
+size_t message_parse(struct asset_prices* ps,
+                     struct queue* sdqu,
+                     char* data,
+                     size_t dsize,
+                     size_t flush);
 
 #endif  // INCLUDE_MESSAGES_H_
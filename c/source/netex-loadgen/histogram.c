@@ -0,0 +1,92 @@
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "netex-loadgen/histogram.h"
+
+static size_t histogram_index(uint64_t value)
+{
+  if (value < HISTOGRAM_SUB_BUCKETS)
+    return (size_t)value;
+
+  int msb = 63 - __builtin_clzll(value);
+  int shift = msb - HISTOGRAM_SUB_BITS;
+  return (size_t)(shift + 1) * HISTOGRAM_SUB_BUCKETS
+      + (size_t)((value >> shift) - HISTOGRAM_SUB_BUCKETS);
+}
+
+// Highest value that lands in the bucket
+static uint64_t histogram_bucket_max(size_t index)
+{
+  if (index < HISTOGRAM_SUB_BUCKETS)
+    return (uint64_t)index;
+
+  int shift = (int)(index / HISTOGRAM_SUB_BUCKETS) - 1;
+  uint64_t base = HISTOGRAM_SUB_BUCKETS + index % HISTOGRAM_SUB_BUCKETS;
+  return ((base + 1) << shift) - 1;
+}
+
+void histogram_reset(struct histogram* h)
+{
+  assert(h != NULL);
+
+  memset(h, 0, sizeof(*h));
+  h->min = UINT64_MAX;
+}
+
+void histogram_record(struct histogram* h, uint64_t value)
+{
+  h->counts[histogram_index(value)]++;
+  h->total++;
+  h->sum += value;
+  if (value < h->min)
+    h->min = value;
+  if (value > h->max)
+    h->max = value;
+}
+
+void histogram_merge(struct histogram* dst, const struct histogram* src)
+{
+  assert(dst != NULL);
+  assert(src != NULL);
+
+  for (size_t k = 0; k < HISTOGRAM_BUCKETS; k++)
+    dst->counts[k] += src->counts[k];
+  dst->total += src->total;
+  dst->sum += src->sum;
+  if (src->min < dst->min)
+    dst->min = src->min;
+  if (src->max > dst->max)
+    dst->max = src->max;
+}
+
+/**
+ * @brief Value below which percentile % of the recorded values fall.
+ *
+ * @param percentile In [0, 100].
+ * @return Upper bound of the bucket holding it, capped by the max recorded.
+ * 0 when nothing was recorded.
+ */
+uint64_t histogram_percentile(const struct histogram* h, double percentile)
+{
+  assert(h != NULL);
+  assert((percentile >= 0.0) && (percentile <= 100.0));
+
+  if (h->total == 0)
+    return 0;
+
+  uint64_t rank = (uint64_t)((percentile / 100.0) * (double)h->total + 0.5);
+  if (rank == 0)
+    rank = 1;
+
+  uint64_t seen = 0;
+  for (size_t k = 0; k < HISTOGRAM_BUCKETS; k++) {
+    seen += h->counts[k];
+    if (seen >= rank) {
+      uint64_t value = histogram_bucket_max(k);
+      return (value < h->max ? value : h->max);
+    }
+  }
+  return h->max;
+}
@@ -0,0 +1,34 @@
+#ifndef INCLUDE_NETEX_LOADGEN_HISTOGRAM_H_
+#define INCLUDE_NETEX_LOADGEN_HISTOGRAM_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Every power of 2 is split in 2^HISTOGRAM_SUB_BITS linear buckets, so a
+// recorded value is off by less than 1 / 2^HISTOGRAM_SUB_BITS (~3%)
+#define HISTOGRAM_SUB_BITS 5
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+// Log-linear histogram of latencies, fixed size so recording never allocates
+struct histogram {
+  uint64_t counts[HISTOGRAM_BUCKETS];
+  uint64_t total;
+  uint64_t sum;
+  uint64_t min;
+  uint64_t max;
+};
+
+void histogram_reset(struct histogram* h);
+void histogram_record(struct histogram* h, uint64_t value);
+void histogram_merge(struct histogram* dst, const struct histogram* src);
+uint64_t histogram_percentile(const struct histogram* h, double percentile);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // INCLUDE_NETEX_LOADGEN_HISTOGRAM_H_
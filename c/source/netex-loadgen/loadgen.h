@@ -0,0 +1,101 @@
+#ifndef INCLUDE_NETEX_LOADGEN_LOADGEN_H_
+#define INCLUDE_NETEX_LOADGEN_LOADGEN_H_
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "netex-loadgen/histogram.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LOADGEN_MAX_DEPTH 1024
+#define LOADGEN_MAX_CONNECTIONS 65536
+#define LOADGEN_BUFFER_CAPACITY 4096
+#define LOADGEN_MAX_PAYLOAD (64 * 1024 + 26)
+#define LOADGEN_UDP_TIMEOUT_NS (1000ULL * 1000 * 1000)  // 1s
+#define LOADGEN_HANDSHAKE_TIMEOUT_NS (10ULL * 1000 * 1000 * 1000)  // 10s
+#define LOADGEN_MAX_EVENTS 256
+#define LOADGEN_TICK_MS 100
+
+#define LOADGEN_ECHO 0
+#define LOADGEN_PRIME 1
+#define LOADGEN_MEANS 2
+#define LOADGEN_CHAT 3
+#define LOADGEN_KV 4
+#define LOADGEN_SPEED 5
+
+struct loadgen_options {
+  const char* host;
+  const char* port;
+  int protocol;  // LOADGEN_*
+  int connections;
+  int depth;  // Requests in flight per connection
+  int threads;
+  int duration_s;
+  size_t payload;  // Echo request size
+};
+
+struct loadgen_thread;
+
+struct loadgen_conn {
+  int fd;
+  int id;  // Index within its thread
+  struct loadgen_thread* t;
+  struct ring* rx;
+  struct ring* tx;  // Not sent yet, flushed when the socket is writable
+  uint64_t* sent_ns;  // Send time of request seq at seq % depth
+  uint64_t next_seq;  // Of the next request
+  uint64_t done_seq;  // Of the next response, for in order protocols
+  int inflight;
+  int state;  // Protocol handshake progress
+  bool ready;  // Handshake done, requests can go
+  bool dead;
+  bool dirty;  // Queued in its thread's flush list
+  struct loadgen_conn* next_dirty;
+};
+
+struct loadgen_thread {
+  int id;
+  pthread_t thread;
+  struct loadgen_options* opts;
+  int efd;
+  struct loadgen_conn* conns;
+  int nconns;
+  struct loadgen_conn* dispatcher;  // speed-daemon only, receives tickets
+  struct loadgen_conn* dirty;  // With output queued since the last flush
+  bool running;  // Issuing requests
+  uint64_t start_ns;
+  uint64_t end_ns;
+  uint64_t completed;
+  uint64_t errors;
+  uint64_t timeouts;
+  struct histogram hist;
+};
+
+struct loadgen_protocol {
+  const char* name;
+  int socktype;
+  // Queues whatever the server expects first. Sets ready when done
+  void (*open)(struct loadgen_conn* c);
+  // Queues request seq
+  void (*request)(struct loadgen_conn* c, uint64_t seq);
+  // Consumes complete responses from c->rx. -1 on unexpected data
+  int (*parse)(struct loadgen_conn* c);
+};
+
+extern const struct loadgen_protocol loadgen_protocols[];
+
+void loadgen_protocols_init(void);
+
+uint64_t loadgen_now(void);
+void loadgen_complete(struct loadgen_conn* c, uint64_t seq);
+void loadgen_send(struct loadgen_conn* c, const void* data, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // INCLUDE_NETEX_LOADGEN_LOADGEN_H_
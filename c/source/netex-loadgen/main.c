@@ -0,0 +1,551 @@
+#define _GNU_SOURCE
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log/log.h"
+#include "utils/ring.h"
+#include "netex-loadgen/histogram.h"
+#include "netex-loadgen/loadgen.h"
+
+#define HOST "127.0.0.1"
+#define PORT "18888"
+
+static const struct loadgen_protocol* proto = NULL;
+
+uint64_t loadgen_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void loadgen_usage(const char* prog)
+{
+  fprintf(stderr,
+          "usage: %s -p PROTOCOL [options]\n"
+          "  -p, --protocol P     echo, prime, means, chat, kv or speed\n"
+          "  -H, --host HOST      server address (default %s)\n"
+          "  -P, --port PORT      server port (default %s)\n"
+          "  -c, --connections N  concurrent connections (default 1)\n"
+          "  -d, --depth N        requests in flight per connection "
+          "(default 1)\n"
+          "  -t, --threads N      client threads (default 1)\n"
+          "  -D, --duration S     seconds to measure for (default 10)\n"
+          "  -s, --payload N      echo request size (default 64)\n"
+          "Results are printed to stdout as JSON.\n",
+          prog,
+          HOST,
+          PORT);
+}
+
+static int loadgen_parse_int(const char* arg, long min, long max, int* out)
+{
+  char* end;
+  errno = 0;
+  long val = strtol(arg, &end, 10);
+  if ((errno != 0) || (*end != 0) || (val < min) || (val > max))
+    return -1;
+  *out = (int)val;
+  return 0;
+}
+
+static int loadgen_options_parse(int argc,
+                                 char* argv[],
+                                 struct loadgen_options* opts)
+{
+  static const struct option long_opts[] = {
+      {"protocol", required_argument, NULL, 'p'},
+      {"host", required_argument, NULL, 'H'},
+      {"port", required_argument, NULL, 'P'},
+      {"connections", required_argument, NULL, 'c'},
+      {"depth", required_argument, NULL, 'd'},
+      {"threads", required_argument, NULL, 't'},
+      {"duration", required_argument, NULL, 'D'},
+      {"payload", required_argument, NULL, 's'},
+      {"help", no_argument, NULL, 'h'},
+      {NULL, 0, NULL, 0},
+  };
+
+  int c, res = 0, payload;
+  while ((c = getopt_long(argc, argv, "p:H:P:c:d:t:D:s:h", long_opts, NULL))
+         != -1)
+  {
+    switch (c) {
+      case 'p':
+        opts->protocol = -1;
+        for (int k = 0; loadgen_protocols[k].name != NULL; k++)
+          if (strcmp(optarg, loadgen_protocols[k].name) == 0)
+            opts->protocol = k;
+        res = (opts->protocol == -1 ? -1 : 0);
+        break;
+      case 'H':
+        opts->host = optarg;
+        break;
+      case 'P':
+        opts->port = optarg;
+        break;
+      case 'c':
+        res = loadgen_parse_int(
+            optarg, 1, LOADGEN_MAX_CONNECTIONS, &opts->connections);
+        break;
+      case 'd':
+        res = loadgen_parse_int(optarg, 1, LOADGEN_MAX_DEPTH, &opts->depth);
+        break;
+      case 't':
+        res = loadgen_parse_int(optarg, 1, 1024, &opts->threads);
+        break;
+      case 'D':
+        res = loadgen_parse_int(optarg, 1, 24 * 3600, &opts->duration_s);
+        break;
+      case 's':
+        res = loadgen_parse_int(optarg, 1, 64 * 1024, &payload);
+        opts->payload = (size_t)payload;
+        break;
+      default:
+        res = -1;
+        break;
+    }
+    if (res != 0) {
+      if (c != 'h')
+        fprintf(stderr, "invalid option '-%c'\n", c);
+      loadgen_usage(argv[0]);
+      return -1;
+    }
+  }
+
+  if (opts->protocol == -1) {
+    loadgen_usage(argv[0]);
+    return -1;
+  }
+  if (opts->connections < opts->threads)
+    opts->threads = opts->connections;
+  // Both pair connections up within a thread
+  if (((opts->protocol == LOADGEN_CHAT) || (opts->protocol == LOADGEN_SPEED))
+      && (opts->connections < 2 * opts->threads))
+  {
+    fprintf(stderr, "%s needs at least 2 connections per thread\n",
+            loadgen_protocols[opts->protocol].name);
+    return -1;
+  }
+  return 0;
+}
+
+static int loadgen_connect(struct loadgen_options* opts)
+{
+  struct addrinfo hints;
+  struct addrinfo* result = NULL;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = proto->socktype;
+
+  int s = getaddrinfo(opts->host, opts->port, &hints, &result);
+  if (s != 0) {
+    fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(s));
+    return -1;
+  }
+
+  int fd = -1;
+  for (struct addrinfo* rp = result; rp != NULL; rp = rp->ai_next) {
+    fd = socket(rp->ai_family, rp->ai_socktype | SOCK_CLOEXEC, rp->ai_protocol);
+    if (fd == -1)
+      continue;
+    // Blocking connect, the requests only start once everybody is in
+    if (connect(fd, rp->ai_addr, rp->ai_addrlen) == 0)
+      break;
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(result);
+  if (fd == -1) {
+    fprintf(stderr, "connect to %s:%s failed: %s\n",
+            opts->host,
+            opts->port,
+            strerror(errno));
+    return -1;
+  }
+
+  int on = 1;
+  if (proto->socktype == SOCK_STREAM)
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  if (fcntl(fd, F_SETFL, O_NONBLOCK) == -1) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static void loadgen_kill(struct loadgen_conn* c)
+{
+  if (c->dead)
+    return;
+  c->dead = true;
+  c->t->errors++;
+  close(c->fd);
+  c->inflight = 0;
+}
+
+static void loadgen_flush(struct loadgen_conn* c)
+{
+  while (!c->dead && (c->tx->size > 0)) {
+    ssize_t n = send(c->fd, ring_read_ptr(c->tx), c->tx->size, MSG_NOSIGNAL);
+    if (n > 0) {
+      ring_consume(c->tx, (size_t)n);
+    } else if ((n == -1) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+      break;  // EPOLLOUT brings us back
+    } else {
+      loadgen_kill(c);
+    }
+  }
+}
+
+/**
+ * @brief Queues data for the server.
+ *
+ * Stream output is sent when the thread flushes its dirty connections, so
+ * requests issued together share a syscall. Datagrams go out right away.
+ */
+void loadgen_send(struct loadgen_conn* c, const void* data, size_t size)
+{
+  if (c->dead)
+    return;
+
+  if (proto->socktype == SOCK_DGRAM) {
+    if ((send(c->fd, data, size, 0) == -1) && (errno != EAGAIN))
+      loadgen_kill(c);
+    return;
+  }
+
+  ring_push(c->tx, data, size);
+  if (!c->dirty) {
+    c->dirty = true;
+    c->next_dirty = c->t->dirty;
+    c->t->dirty = c;
+  }
+}
+
+static void loadgen_fill(struct loadgen_conn* c)
+{
+  struct loadgen_thread* t = c->t;
+  int depth = t->opts->depth;
+  while (t->running && c->ready && !c->dead && (c->inflight < depth)) {
+    c->sent_ns[c->next_seq % (uint64_t)depth] = loadgen_now();
+    proto->request(c, c->next_seq++);
+    c->inflight++;
+  }
+}
+
+/**
+ * @brief Request seq of c got its answer, records the latency and sends the
+ * next one.
+ */
+void loadgen_complete(struct loadgen_conn* c, uint64_t seq)
+{
+  if (c->inflight == 0)
+    return;  // Late, already given up on
+
+  struct loadgen_thread* t = c->t;
+  if (t->running) {
+    uint64_t sent = c->sent_ns[seq % (uint64_t)t->opts->depth];
+    histogram_record(&t->hist, loadgen_now() - sent);
+    t->completed++;
+  }
+  c->inflight--;
+  loadgen_fill(c);
+}
+
+static void loadgen_receive(struct loadgen_conn* c)
+{
+  while (!c->dead) {
+    ring_reserve(c->rx, LOADGEN_BUFFER_CAPACITY);
+    ssize_t n = recv(c->fd, ring_write_ptr(c->rx), ring_space(c->rx), 0);
+    if ((n == -1) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+      break;
+    if ((n <= 0) && (proto->socktype == SOCK_STREAM)) {
+      loadgen_kill(c);
+      break;
+    }
+    if (n <= 0)
+      continue;  // Refused datagram, the request times out
+
+    ring_commit(c->rx, (size_t)n);
+    if (proto->parse(c) != 0)
+      loadgen_kill(c);
+  }
+}
+
+// UDP requests get no retransmission from anybody, give up on the oldest
+static void loadgen_expire(struct loadgen_thread* t, uint64_t now)
+{
+  int depth = t->opts->depth;
+  for (int k = 0; k < t->nconns; k++) {
+    struct loadgen_conn* c = &t->conns[k];
+    while ((c->inflight > 0)
+           && (now - c->sent_ns[c->done_seq % (uint64_t)depth]
+               > LOADGEN_UDP_TIMEOUT_NS))
+    {
+      c->done_seq++;
+      c->inflight--;
+      t->timeouts++;
+    }
+    loadgen_fill(c);
+  }
+}
+
+static int loadgen_conn_open(struct loadgen_thread* t,
+                             struct loadgen_conn* c,
+                             int id)
+{
+  memset(c, 0, sizeof(*c));
+  c->id = id;
+  c->t = t;
+  c->fd = loadgen_connect(t->opts);
+  if (c->fd == -1)
+    return -1;
+
+  c->sent_ns = calloc((size_t)t->opts->depth, sizeof(uint64_t));
+  assert(c->sent_ns != NULL);
+  if ((ring_init(&c->rx, LOADGEN_BUFFER_CAPACITY) != 0)
+      || (ring_init(&c->tx, LOADGEN_BUFFER_CAPACITY) != 0))
+    return -1;
+
+  struct epoll_event ev;
+  ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+  ev.data.ptr = c;
+  if (epoll_ctl(t->efd, EPOLL_CTL_ADD, c->fd, &ev) == -1)
+    return -1;
+
+  proto->open(c);
+  return 0;
+}
+
+static void loadgen_conn_close(struct loadgen_conn* c)
+{
+  if (!c->dead && (c->fd != -1))
+    close(c->fd);
+  if (c->rx != NULL)
+    ring_free(&c->rx);
+  if (c->tx != NULL)
+    ring_free(&c->tx);
+  free(c->sent_ns);
+}
+
+static bool loadgen_ready(struct loadgen_thread* t)
+{
+  if ((t->dispatcher != NULL) && !t->dispatcher->ready)
+    return false;
+  for (int k = 0; k < t->nconns; k++)
+    if (!t->conns[k].ready)
+      return false;
+  return true;
+}
+
+static void loadgen_flush_dirty(struct loadgen_thread* t)
+{
+  while (t->dirty != NULL) {
+    struct loadgen_conn* c = t->dirty;
+    t->dirty = c->next_dirty;
+    c->dirty = false;
+    loadgen_flush(c);
+  }
+}
+
+static void* loadgen_thread_run(void* arg)
+{
+  struct loadgen_thread* t = arg;
+  struct epoll_event events[LOADGEN_MAX_EVENTS];
+  uint64_t duration = (uint64_t)(unsigned)t->opts->duration_s * 1000000000ULL;
+  uint64_t now = loadgen_now(), deadline = now + LOADGEN_HANDSHAKE_TIMEOUT_NS;
+
+  while (true) {
+    loadgen_flush_dirty(t);
+    int n = epoll_wait(t->efd, events, LOADGEN_MAX_EVENTS, LOADGEN_TICK_MS);
+    if ((n == -1) && (errno != EINTR)) {
+      t->errors++;
+      break;
+    }
+
+    for (int k = 0; k < n; k++) {
+      struct loadgen_conn* c = events[k].data.ptr;
+      if (events[k].events & EPOLLOUT)
+        loadgen_flush(c);
+      if (events[k].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+        loadgen_receive(c);
+    }
+
+    now = loadgen_now();
+    if (!t->running) {
+      if (loadgen_ready(t)) {
+        // Everybody is in, start measuring
+        t->running = true;
+        t->start_ns = now;
+        for (int k = 0; k < t->nconns; k++)
+          loadgen_fill(&t->conns[k]);
+      } else if (now > deadline) {
+        fprintf(stderr, "thread %d: handshake timed out\n", t->id);
+        t->errors++;
+        break;
+      }
+    } else if (now - t->start_ns >= duration) {
+      break;
+    } else if (proto->socktype == SOCK_DGRAM) {
+      loadgen_expire(t, now);
+    }
+  }
+
+  t->end_ns = now;
+  t->running = false;
+  return NULL;
+}
+
+static int loadgen_thread_init(struct loadgen_thread* t,
+                               struct loadgen_options* opts,
+                               int id,
+                               int nconns)
+{
+  memset(t, 0, sizeof(*t));
+  t->id = id;
+  t->opts = opts;
+  histogram_reset(&t->hist);
+  t->efd = epoll_create1(EPOLL_CLOEXEC);
+  if (t->efd == -1)
+    return -1;
+
+  t->conns = calloc((size_t)nconns, sizeof(struct loadgen_conn));
+  assert(t->conns != NULL);
+  for (int k = 0; k < nconns; k++) {
+    t->nconns++;
+    if (loadgen_conn_open(t, &t->conns[k], k) != 0)
+      return -1;
+  }
+
+  if (opts->protocol == LOADGEN_SPEED) {
+    t->dispatcher = calloc(1, sizeof(struct loadgen_conn));
+    assert(t->dispatcher != NULL);
+    if (loadgen_conn_open(t, t->dispatcher, nconns) != 0)
+      return -1;
+  }
+  return 0;
+}
+
+static void loadgen_thread_free(struct loadgen_thread* t)
+{
+  for (int k = 0; k < t->nconns; k++)
+    loadgen_conn_close(&t->conns[k]);
+  free(t->conns);
+  if (t->dispatcher != NULL) {
+    loadgen_conn_close(t->dispatcher);
+    free(t->dispatcher);
+  }
+  if (t->efd != -1)
+    close(t->efd);
+}
+
+// Prints the results, -1 when not a single request went through
+static int loadgen_report(struct loadgen_options* opts,
+                          struct loadgen_thread* threads)
+{
+  struct histogram hist;
+  histogram_reset(&hist);
+  uint64_t completed = 0, errors = 0, timeouts = 0, elapsed = 0;
+  double throughput = 0.0;
+  for (int k = 0; k < opts->threads; k++) {
+    struct loadgen_thread* t = &threads[k];
+    histogram_merge(&hist, &t->hist);
+    completed += t->completed;
+    errors += t->errors;
+    timeouts += t->timeouts;
+    if (t->end_ns > t->start_ns) {
+      uint64_t ns = t->end_ns - t->start_ns;
+      throughput += (double)t->completed * 1e9 / (double)ns;
+      if (ns > elapsed)
+        elapsed = ns;
+    }
+  }
+
+  double mean = (hist.total > 0 ? (double)hist.sum / (double)hist.total : 0.0);
+  printf("{\"protocol\":\"%s\",\"host\":\"%s\",\"port\":\"%s\","
+         "\"connections\":%d,\"depth\":%d,\"threads\":%d,"
+         "\"duration_s\":%.3f,\"requests\":%" PRIu64 ",\"errors\":%" PRIu64
+         ",\"timeouts\":%" PRIu64 ",\"throughput_rps\":%.1f,"
+         "\"latency_us\":{\"min\":%.1f,\"mean\":%.1f,\"p50\":%.1f,"
+         "\"p99\":%.1f,\"p999\":%.1f,\"max\":%.1f}}\n",
+         proto->name,
+         opts->host,
+         opts->port,
+         opts->connections,
+         opts->depth,
+         opts->threads,
+         (double)elapsed / 1e9,
+         completed,
+         errors,
+         timeouts,
+         throughput,
+         (hist.total > 0 ? (double)hist.min / 1e3 : 0.0),
+         mean / 1e3,
+         (double)histogram_percentile(&hist, 50.0) / 1e3,
+         (double)histogram_percentile(&hist, 99.0) / 1e3,
+         (double)histogram_percentile(&hist, 99.9) / 1e3,
+         (double)hist.max / 1e3);
+  return (completed > 0 ? 0 : -1);
+}
+
+int main(int argc, char* argv[])
+{
+  struct loadgen_options opts = {HOST, PORT, -1, 1, 1, 1, 10, 64};
+  if (loadgen_options_parse(argc, argv, &opts) != 0)
+    exit(EXIT_FAILURE);
+  proto = &loadgen_protocols[opts.protocol];
+  loadgen_protocols_init();
+  log_set_level(LOG_WARN);
+
+  struct loadgen_thread* threads =
+      calloc((size_t)opts.threads, sizeof(struct loadgen_thread));
+  assert(threads != NULL);
+
+  int k, res = 0, initialized = 0, started = 0;
+  for (k = 0; (k < opts.threads) && (res == 0); k++, initialized++) {
+    int nconns = opts.connections / opts.threads
+        + (k < opts.connections % opts.threads ? 1 : 0);
+    res = loadgen_thread_init(&threads[k], &opts, k, nconns);
+  }
+
+  for (k = 0; (k < opts.threads) && (res == 0); k++) {
+    if (pthread_create(&threads[k].thread, NULL, loadgen_thread_run, &threads[k])
+        != 0)
+    {
+      fprintf(stderr, "failed to start thread %d\n", k);
+      res = -1;
+      break;
+    }
+    started++;
+  }
+  for (k = 0; k < started; k++)
+    pthread_join(threads[k].thread, NULL);
+
+  if (res == 0)
+    res = loadgen_report(&opts, threads);
+
+  for (k = 0; k < initialized; k++)
+    loadgen_thread_free(&threads[k]);
+  free(threads);
+  return (res == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
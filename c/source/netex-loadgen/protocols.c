@@ -0,0 +1,368 @@
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "utils/ring.h"
+#include "netex-loadgen/loadgen.h"
+
+#define MEANS_MESSAGE_SIZE 9
+#define MEANS_QUERY_WINDOW 1000
+#define CHAT_ROOM_PREFIX "* The room contains"
+#define SPEED_LIMIT 10  // mph, one mile per minute gets a ticket
+#define SPEED_ERROR 0x10
+#define SPEED_PLATE 0x20
+#define SPEED_TICKET 0x21
+#define SPEED_HEARTBEAT 0x41
+#define SPEED_I_AM_CAMERA 0x80
+#define SPEED_I_AM_DISPATCHER 0x81
+
+static void put_u16(char* buf, uint16_t v)
+{
+  v = htons(v);
+  memcpy(buf, &v, sizeof(v));
+}
+
+static void put_u32(char* buf, uint32_t v)
+{
+  v = htonl(v);
+  memcpy(buf, &v, sizeof(v));
+}
+
+// Deterministic spread of inputs per connection (splitmix64)
+static uint64_t mix(uint64_t x)
+{
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+// The alphabet over and over, read only once loadgen_protocols_init is done
+static char echo_payload[LOADGEN_MAX_PAYLOAD];
+
+static void open_ready(struct loadgen_conn* c)
+{
+  c->ready = true;
+}
+
+// ---- echo: payload sized requests sent back as is ----
+
+static void echo_request(struct loadgen_conn* c, uint64_t seq)
+{
+  // Shifted per request so that a mixed up echo doesn't go unnoticed
+  size_t offset = seq % 26;
+  loadgen_send(c, echo_payload + offset, c->t->opts->payload);
+}
+
+static int echo_parse(struct loadgen_conn* c)
+{
+  size_t size = c->t->opts->payload;
+  while (c->rx->size >= size) {
+    size_t offset = c->done_seq % 26;
+    if (memcmp(ring_read_ptr(c->rx), echo_payload + offset, size) != 0)
+      return -1;
+    ring_consume(c->rx, size);
+    loadgen_complete(c, c->done_seq++);
+  }
+  return 0;
+}
+
+// ---- prime-time: one JSON line each way ----
+
+static void prime_request(struct loadgen_conn* c, uint64_t seq)
+{
+  char line[64];
+  uint64_t number = mix(((uint64_t)c->t->id << 48) ^ ((uint64_t)c->id << 32)
+                        ^ seq)
+      & 0x7fffffff;
+  int size = snprintf(line,
+                      sizeof(line),
+                      "{\"method\":\"isPrime\",\"number\":%" PRIu64 "}\n",
+                      number);
+  loadgen_send(c, line, (size_t)size);
+}
+
+static int prime_parse(struct loadgen_conn* c)
+{
+  char* data = ring_read_ptr(c->rx);
+  char* nl;
+  while ((nl = memchr(data, '\n', c->rx->size)) != NULL) {
+    size_t size = (size_t)(nl - data) + 1;
+    bool valid = (memmem(data, size, "\"prime\"", 7) != NULL);
+    ring_consume(c->rx, size);
+    data = ring_read_ptr(c->rx);
+    if (!valid)
+      return -1;
+    loadgen_complete(c, c->done_seq++);
+  }
+  return 0;
+}
+
+// ---- means-to-an-end: an insert plus a query answered with 4 bytes ----
+
+static void means_request(struct loadgen_conn* c, uint64_t seq)
+{
+  char msgs[2 * MEANS_MESSAGE_SIZE];
+  int32_t timestamp = (int32_t)seq;
+  int32_t mintime = timestamp - MEANS_QUERY_WINDOW;
+
+  msgs[0] = 'I';
+  put_u32(msgs + 1, (uint32_t)timestamp);
+  put_u32(msgs + 5, (uint32_t)(mix(seq) % 1000));
+  msgs[9] = 'Q';
+  put_u32(msgs + 10, (uint32_t)(mintime > 0 ? mintime : 0));
+  put_u32(msgs + 14, (uint32_t)timestamp);
+  loadgen_send(c, msgs, sizeof(msgs));
+}
+
+static int means_parse(struct loadgen_conn* c)
+{
+  while (c->rx->size >= 4) {
+    ring_consume(c->rx, 4);
+    loadgen_complete(c, c->done_seq++);
+  }
+  return 0;
+}
+
+// ---- budget-chat: a ring of clients per thread ----
+//
+// Every client is named t<thread>c<index>. A message counts as done when the
+// next client of the same thread sees it, which frees its sender to post the
+// next one. Only chat lines start with '[', everything else is skipped, so
+// system messages don't need to be newline terminated.
+
+static void chat_request(struct loadgen_conn* c, uint64_t seq)
+{
+  char line[32];
+  int size = snprintf(line, sizeof(line), "m %" PRIu64 "\n", seq);
+  loadgen_send(c, line, (size_t)size);
+}
+
+// Nothing to send until the server greets us
+static void chat_open(struct loadgen_conn* c)
+{
+  c->state = 0;
+}
+
+static void chat_join(struct loadgen_conn* c)
+{
+  char* data = ring_read_ptr(c->rx);
+  if (c->state == 0) {
+    // Whatever the greeting says, it asks for a name
+    char name[32];
+    int size = snprintf(name, sizeof(name), "t%dc%d\n", c->t->id, c->id);
+    ring_consume(c->rx, c->rx->size);
+    loadgen_send(c, name, (size_t)size);
+    c->state = 1;
+    return;
+  }
+
+  size_t prefix = strlen(CHAT_ROOM_PREFIX);
+  char* room = memmem(data, c->rx->size, CHAT_ROOM_PREFIX, prefix);
+  if (room == NULL)
+    return;
+  ring_consume(c->rx, (size_t)(room - data) + prefix);
+  c->ready = true;
+}
+
+static int chat_parse(struct loadgen_conn* c)
+{
+  if (!c->ready) {
+    chat_join(c);
+    if (!c->ready)
+      return 0;
+  }
+
+  struct loadgen_thread* t = c->t;
+  int from = (c->id + t->nconns - 1) % t->nconns;
+  while (c->rx->size > 0) {
+    char* data = ring_read_ptr(c->rx);
+    char* open = memchr(data, '[', c->rx->size);
+    if (open == NULL) {
+      ring_consume(c->rx, c->rx->size);
+      break;
+    }
+    ring_consume(c->rx, (size_t)(open - data));
+    data = open;
+    char* nl = memchr(data, '\n', c->rx->size);
+    if (nl == NULL)
+      break;
+
+    int tid, cid;
+    uint64_t seq;
+    *nl = 0;
+    if ((sscanf(data, "[t%dc%d] m %" SCNu64, &tid, &cid, &seq) == 3)
+        && (tid == t->id) && (cid == from))
+      loadgen_complete(&t->conns[from], seq);
+    ring_consume(c->rx, (size_t)(nl - data) + 1);
+  }
+  return 0;
+}
+
+// ---- unusual database: UDP key/value retrieves ----
+
+static void kv_key(struct loadgen_conn* c, char* key, size_t size)
+{
+  snprintf(key, size, "lg%dk%d", c->t->id, c->id);
+}
+
+static void kv_open(struct loadgen_conn* c)
+{
+  char key[32], insert[64];
+  kv_key(c, key, sizeof(key));
+  int size = snprintf(insert, sizeof(insert), "%s=v%s", key, key);
+  loadgen_send(c, insert, (size_t)size);
+  c->ready = true;
+}
+
+static void kv_request(struct loadgen_conn* c, uint64_t seq)
+{
+  (void)seq;
+  char key[32];
+  kv_key(c, key, sizeof(key));
+  loadgen_send(c, key, strlen(key));
+}
+
+// Called once per datagram
+static int kv_parse(struct loadgen_conn* c)
+{
+  bool valid = (memchr(ring_read_ptr(c->rx), '=', c->rx->size) != NULL);
+  ring_consume(c->rx, c->rx->size);
+  if (!valid)
+    return -1;
+  // Late answers to requests that timed out are dropped
+  if (c->inflight > 0)
+    loadgen_complete(c, c->done_seq++);
+  return 0;
+}
+
+// ---- speed-daemon: camera pairs and a ticket dispatcher per thread ----
+//
+// Thread t watches road t + 1, camera c sits at mile c. Request seq of camera
+// c is a plate seen there and a minute later by its neighbour, a mile away:
+// 60 mph on a 10 mph road. It is done when the ticket reaches the dispatcher.
+
+static uint16_t speed_road(struct loadgen_conn* c)
+{
+  return (uint16_t)(c->t->id + 1);
+}
+
+static void speed_open(struct loadgen_conn* c)
+{
+  char msg[7];
+  if (c == c->t->dispatcher) {
+    msg[0] = (char)SPEED_I_AM_DISPATCHER;
+    msg[1] = 1;
+    put_u16(msg + 2, speed_road(c));
+    loadgen_send(c, msg, 4);
+  } else {
+    msg[0] = (char)SPEED_I_AM_CAMERA;
+    put_u16(msg + 1, speed_road(c));
+    put_u16(msg + 3, (uint16_t)c->id);
+    put_u16(msg + 5, SPEED_LIMIT);
+    loadgen_send(c, msg, sizeof(msg));
+  }
+  c->ready = true;
+}
+
+static void speed_plate(struct loadgen_conn* c,
+                        const char* plate,
+                        size_t size,
+                        uint32_t timestamp)
+{
+  char msg[2 + 255 + 4];
+  msg[0] = (char)SPEED_PLATE;
+  msg[1] = (char)size;
+  memcpy(msg + 2, plate, size);
+  put_u32(msg + 2 + size, timestamp);
+  loadgen_send(c, msg, 2 + size + 4);
+}
+
+static void speed_request(struct loadgen_conn* c, uint64_t seq)
+{
+  struct loadgen_thread* t = c->t;
+  int other = ((c->id ^ 1) < t->nconns ? (c->id ^ 1) : c->id - 1);
+  char plate[32];
+  int size = snprintf(plate, sizeof(plate), "C%dS%" PRIu64, c->id, seq);
+  uint32_t timestamp = (uint32_t)(seq * 120);
+
+  speed_plate(c, plate, (size_t)size, timestamp);
+  speed_plate(&t->conns[other], plate, (size_t)size, timestamp + 60);
+}
+
+// Size of the message at data, 0 if incomplete
+static size_t speed_message_size(const char* data, size_t size)
+{
+  if (size < 2)
+    return 0;
+
+  size_t need = 0;
+  uint8_t type = (uint8_t)data[0];
+  if (type == SPEED_ERROR)
+    need = 2 + (uint8_t)data[1];
+  else if (type == SPEED_TICKET)
+    need = 2 + (uint8_t)data[1] + 2 + 2 + 4 + 2 + 4 + 2;
+  else if (type == SPEED_HEARTBEAT)
+    need = 1;
+  else
+    return SIZE_MAX;
+  return (size >= need ? need : 0);
+}
+
+static int speed_parse(struct loadgen_conn* c)
+{
+  struct loadgen_thread* t = c->t;
+  while (c->rx->size > 0) {
+    char* data = ring_read_ptr(c->rx);
+    size_t size = speed_message_size(data, c->rx->size);
+    if (size == 0)
+      break;
+    if ((size == SIZE_MAX) || ((uint8_t)data[0] == SPEED_ERROR))
+      return -1;
+
+    if ((uint8_t)data[0] == SPEED_TICKET) {
+      char plate[256];
+      size_t len = (uint8_t)data[1];
+      memcpy(plate, data + 2, len);
+      plate[len] = 0;
+      int cid;
+      uint64_t seq;
+      if ((sscanf(plate, "C%dS%" SCNu64, &cid, &seq) == 2) && (cid >= 0)
+          && (cid < t->nconns))
+        loadgen_complete(&t->conns[cid], seq);
+    }
+    ring_consume(c->rx, size);
+  }
+  return 0;
+}
+
+const struct loadgen_protocol loadgen_protocols[] = {
+    [LOADGEN_ECHO] = {"echo", SOCK_STREAM, open_ready, echo_request, echo_parse},
+    [LOADGEN_PRIME] =
+        {"prime", SOCK_STREAM, open_ready, prime_request, prime_parse},
+    [LOADGEN_MEANS] =
+        {"means", SOCK_STREAM, open_ready, means_request, means_parse},
+    [LOADGEN_CHAT] =
+        {"chat", SOCK_STREAM, chat_open, chat_request, chat_parse},
+    [LOADGEN_KV] = {"kv", SOCK_DGRAM, kv_open, kv_request, kv_parse},
+    [LOADGEN_SPEED] =
+        {"speed", SOCK_STREAM, speed_open, speed_request, speed_parse},
+    {NULL, 0, NULL, NULL, NULL},
+};
+
+/**
+ * @brief Builds what the protocols share across threads, before any starts.
+ */
+void loadgen_protocols_init(void)
+{
+  for (size_t k = 0; k < sizeof(echo_payload); k++)
+    echo_payload[k] = (char)('a' + k % 26);
+}
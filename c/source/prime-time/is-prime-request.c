@@ -17,13 +17,45 @@
 #include <unistd.h>
 #include <stdatomic.h>
 
-#include <json-c/json.h>
-#include <json-c/json_tokener.h>
-
 #include "log/log.h"
+#include "utils/frame.h"
 #include "utils/queue.h"
 
 #include "prime-time/is-prime-request.h"
+#include "prime-time/is-prime-scan.h"
+#include "prime-time/prime-cache.h"
+#include "prime-time/primality.h"
+#include "prime-time/sieve.h"
+
+// Answers numbers below its limit before any arithmetic, when set
+static const struct sieve* is_prime_sieve = NULL;
+// Remembers the numbers past the sieve, when set
+static struct prime_cache* is_prime_cache = NULL;
+
+/**
+ * @brief Answers a single request line, without its delimiter.
+ *
+ * @return true if it was malformed, the connection should be closed after
+ * sending the response.
+ */
+bool is_prime_request_handle(struct queue* sdq, const char* line, size_t size)
+{
+  assert(sdq != NULL);
+  assert(line != NULL);
+
+  int rsize;
+  struct is_prime_request curr;
+  bool malformed = is_prime_request_malformed(&curr, line, size);
+  // A malformed request may have left number unset
+  curr.is_prime = false;
+  if (!malformed)
+    curr.is_prime = (curr.digits != NULL
+                         ? is_prime_digits(curr.digits, curr.digits_size)
+                         : is_prime_f(curr.number));
+  is_prime_beget_response(&curr, sdq->head, &rsize);
+  queue_push_ex(sdq, (size_t)rsize);
+  return malformed;
+}
 
 /// Return the number of requests processed
 int is_prime_request_builder(struct queue* sdq,
@@ -36,34 +68,35 @@ int is_prime_request_builder(struct queue* sdq,
   assert(raw_request != NULL);
   assert(req_size > 0);
 
-  int j = 1, size;
-  char *str1 = raw_request, *token, *saveptr1 = NULL;
-  struct is_prime_request curr;
-
-  // tokenizer on the split delimiters
-  for (;; j++, str1 = NULL) {
-    token = strtok_r(str1, PRIME_REQUEST_DELIMITERS, &saveptr1);
-    if (token == NULL)
-      break;
-    // We have exceeded the request size
-    if ((token - raw_request) >= (long)req_size)
-      break;
+  int j = 0;
+  size_t size;
+  char* line = raw_request;
+  char* end = raw_request + req_size;
+  struct frame frame;
+  frame_init(&frame, PRIME_REQUEST_DELIMITERS[0]);
 
-    *malformed = is_prime_request_malformed(&curr, token);
-    curr.is_prime = is_prime_f(curr.number);
-    is_prime_beget_response(&curr, sdq->head, &size);
-    queue_push_ex(sdq, (size_t)size);
+  *malformed = false;
+  while (line < end) {
+    // Whatever follows the last delimiter counts as a request too
+    size = frame_next(&frame, line, (size_t)(end - line));
+    if (size == 0)
+      size = (size_t)(end - line);
+    size_t request = (line[size - 1] == PRIME_REQUEST_DELIMITERS[0] ? size - 1
+                                                                    : size);
+    // Empty lines are skipped
+    if (request > 0) {
+      j++;
+      *malformed = is_prime_request_handle(sdq, line, request);
+    }
+    line += size;
 
     // Stop handling requests for this socket as soon as we
     // find a malformed request
-    if (*malformed) {
-      // Regardless this is a handled request
-      j++;
+    if (*malformed)
       break;
-    }
   }
 
-  return j - 1;
+  return j;
 }
 
 void is_prime_init(struct is_prime_request** request)
@@ -71,115 +104,199 @@ void is_prime_init(struct is_prime_request** request)
   *request = malloc(sizeof(struct is_prime_request));
   (*request)->is_prime = false;
   (*request)->number = 0;
+  (*request)->digits = NULL;
+  (*request)->digits_size = 0;
 }
 
-bool is_prime_request_malformed(struct is_prime_request* request, char* req)
+bool is_prime_request_malformed(struct is_prime_request* request,
+                                const char* req,
+                                size_t size)
 {
   assert(request != NULL);
   assert(req != NULL);
 
-  log_trace("is_prime_request_malformed: parsing request: '%s'", req);
+  log_trace("is_prime_request_malformed: parsing request: '%.*s'",
+            (int)size,
+            req);
+  request->digits = NULL;
+  request->is_malformed = true;
 
   // Is json?
-  json_object* root = json_tokener_parse(req);
-  if (!root) {
-    log_warn("is_prime_request_malformed: json_tokener_parse failed");
-    request->is_malformed = true;
+  struct is_prime_scan scan;
+  if (is_prime_scan_line(req, size, &scan) != 0) {
+    log_warn("is_prime_request_malformed: is_prime_scan_line failed");
     return true;
   }
 
-  json_object* method = json_object_object_get(root, PRIME_RESPONSE_METHOD_KEY);
-  if (!method) {
-    json_object_put(root);
-    log_warn(
-        "is_prime_request_malformed: json_object_object_get failed for "
-        "'method'");
-    request->is_malformed = true;
-    return true;
-  }
-
-  if (json_object_get_type(method) != json_type_string) {
-    json_object_put(root);
+  if (scan.method.type != IS_PRIME_SCAN_STRING) {
     log_warn("is_prime_request_malformed: method is not of type string");
-    request->is_malformed = true;
-    return true;
-  }
-
-  const char* method_value = json_object_get_string(method);
-  if (!method_value) {
-    json_object_put(root);
-    log_warn(
-        "is_prime_request_malformed: json_object_get_string failed for "
-        "'method'");
-    request->is_malformed = true;
     return true;
   }
 
-  if (strncmp(PRIME_RESPONSE_METHOD_VALUE,
-              method_value,
-              PRIME_RESPONSE_METHOD_VALUE_LEN)
-      != 0)
+  if (!is_prime_scan_equals(
+          scan.method.data, scan.method.size, PRIME_REQUEST_METHOD_VALUE))
   {
-    json_object_put(root);
     log_warn("is_prime_request_malformed: method value unexpected");
-    request->is_malformed = true;
-    return true;
-  }
-
-  json_object* number = json_object_object_get(root, PRIME_REQUEST_NUMBER_KEY);
-  if (!number) {
-    json_object_put(root);
-    log_warn(
-        "is_prime_request_malformed: json_object_object_get failed for "
-        "'number'");
-    request->is_malformed = true;
     return true;
   }
 
   // If we receive a double, the request is technically not malformed
   // but it's not a prime either.
-  json_type num_type = json_object_get_type(number);
-  if (num_type == json_type_double) {
-    json_object_put(root);
+  if (scan.number.type == IS_PRIME_SCAN_DOUBLE) {
     request->is_malformed = false;
     request->number = -1;
     return false;
   }
 
-  if (num_type != json_type_int) {
-    json_object_put(root);
+  if (scan.number.type != IS_PRIME_SCAN_INT) {
     log_warn("is_prime_request_malformed: number is not of type int");
-    request->is_malformed = true;
     return true;
   }
 
-  errno = 0;
-  int64_t number_value = json_object_get_int64(number);
-  if (errno != 0) {
-    json_object_put(root);
-    log_warn("is_prime_request_malformed: json_object_get_int failed for '%s'",
-             number);
-    request->is_malformed = true;
-    return true;
+  // Negative numbers are not prime either
+  const char* digits = scan.number.data;
+  size = scan.number.size;
+  if (*digits == '-') {
+    request->is_malformed = false;
+    request->number = -1;
+    return false;
+  }
+
+  if (size > PRIME_REQUEST_INT64_DIGITS) {
+    if (size > PRIMALITY_MAX_DIGITS) {
+      log_warn("is_prime_request_malformed: number has %zu digits", size);
+      return true;
+    }
+    request->digits = digits;
+    request->digits_size = size;
+    request->number = -1;
+  } else {
+    int64_t number_value = 0;
+    for (size_t k = 0; k < size; k++)
+      number_value = number_value * 10 + (digits[k] - '0');
+    request->number = number_value;
   }
 
-  json_object_put(root);
   request->is_malformed = false;
-  request->number = number_value;
   return false;
 }
 
+/**
+ * @brief Makes is_prime_f look numbers up in s, NULL to stop.
+ *
+ * Set before the workers start, s must outlive them.
+ */
+void is_prime_use_sieve(const struct sieve* s)
+{
+  is_prime_sieve = s;
+}
+
+/**
+ * @brief Makes is_prime_f and is_prime_digits remember what they check past
+ * the sieve in c, NULL to stop.
+ *
+ * Set before the workers start, c must outlive them.
+ */
+void is_prime_use_cache(struct prime_cache* c)
+{
+  is_prime_cache = c;
+}
+
 bool is_prime_f(int64_t number)
 {
   if (number <= 1) {
     return false;  // less than 2 are not prime numbers
   }
-  for (int64_t i = 2; i * i <= number; i++) {
-    if (number % i == 0) {
-      return false;
+  if ((is_prime_sieve != NULL) && ((uint64_t)number < is_prime_sieve->limit))
+    return sieve_test(is_prime_sieve, (uint64_t)number);
+
+  bool prime;
+  if ((is_prime_cache != NULL)
+      && prime_cache_get(is_prime_cache, (uint64_t)number, &prime))
+    return prime;
+  prime = primality_u64((uint64_t)number);
+  if (is_prime_cache != NULL)
+    prime_cache_put(is_prime_cache, (uint64_t)number, prime);
+  return prime;
+}
+
+/**
+ * @brief is_prime_f of count numbers, the answers land in primes in the same
+ * order.
+ *
+ * What the sieve and the cache don't answer goes through
+ * primality_u64_batch together.
+ */
+void is_prime_f_batch(const int64_t* numbers, bool* primes, size_t count)
+{
+  assert(numbers != NULL || count == 0);
+  assert(primes != NULL || count == 0);
+
+  uint64_t wide[PRIMALITY_BATCH];
+  bool wide_primes[PRIMALITY_BATCH];
+  size_t index[PRIMALITY_BATCH];
+  size_t n = 0;
+  for (size_t k = 0; k < count; k++) {
+    uint64_t number = (uint64_t)numbers[k];
+    if (numbers[k] <= 1) {
+      primes[k] = false;
+    } else if ((is_prime_sieve != NULL) && (number < is_prime_sieve->limit)) {
+      primes[k] = sieve_test(is_prime_sieve, number);
+    } else if ((is_prime_cache == NULL)
+               || !prime_cache_get(is_prime_cache, number, &primes[k]))
+    {
+      index[n] = k;
+      wide[n++] = number;
+    }
+
+    if ((n == PRIMALITY_BATCH) || ((k + 1 == count) && (n > 0))) {
+      primality_u64_batch(wide, wide_primes, n);
+      for (size_t j = 0; j < n; j++) {
+        primes[index[j]] = wide_primes[j];
+        if (is_prime_cache != NULL)
+          prime_cache_put(is_prime_cache, wide[j], wide_primes[j]);
+      }
+      n = 0;
     }
   }
-  return true;
+}
+
+/// Primality of a decimal literal checked by is_prime_request_malformed
+bool is_prime_digits(const char* digits, size_t size)
+{
+  bool prime = false;
+  if ((is_prime_cache != NULL)
+      && (prime_cache_join(is_prime_cache, digits, size, NULL, &prime)
+          == PRIME_CACHE_HIT))
+    return prime;
+
+  int r = primality_decimal(digits, size, &prime);
+  assert(r == 0);
+  (void)r;
+  if (is_prime_cache != NULL)
+    prime_cache_done(is_prime_cache, digits, size, prime);
+  return prime;
+}
+
+/**
+ * @brief The response to request, a static string of *size bytes.
+ */
+const char* is_prime_response(const struct is_prime_request* request,
+                              size_t* size)
+{
+  assert(request != NULL);
+  assert(size != NULL);
+
+  if (request->is_malformed) {
+    *size = PRIME_RESPONSE_ILL_RESPONSE_SIZE;
+    return PRIME_RESPONSE_ILL_RESPONSE;
+  }
+  if (request->is_prime) {
+    *size = PRIME_RESPONSE_TRUE_SIZE;
+    return PRIME_RESPONSE_TRUE;
+  }
+  *size = PRIME_RESPONSE_FALSE_SIZE;
+  return PRIME_RESPONSE_FALSE;
 }
 
 void is_prime_beget_response(struct is_prime_request* request,
@@ -190,13 +307,10 @@ void is_prime_beget_response(struct is_prime_request* request,
   assert(response != NULL);
   assert(size != NULL);
 
-  if (request->is_malformed) {
-    *size = PRIME_RESPONSE_ILL_RESPONSE_SIZE;
-    memcpy(response, PRIME_RESPONSE_ILL_RESPONSE, (size_t)*size);
-    return;
-  }
-  *size = sprintf(
-      response, PRIME_RESPONSE_FORMAT, (request->is_prime ? "true" : "false"));
+  size_t len;
+  const char* data = is_prime_response(request, &len);
+  memcpy(response, data, len);
+  *size = (int)len;
 }
 
 void is_prime_free(struct is_prime_request** request)
@@ -5,11 +5,17 @@
 #define PRIME_REQUEST_METHOD_KEY "method"
 #define PRIME_REQUEST_METHOD_VALUE "isPrime"
 #define PRIME_REQUEST_NUMBER_KEY "number"
+// Longer integer literals, sign included, may not fit in an int64_t
+#define PRIME_REQUEST_INT64_DIGITS 18
 #define PRIME_RESPONSE_METHOD_KEY "method"
 #define PRIME_RESPONSE_METHOD_VALUE "isPrime"
 #define PRIME_RESPONSE_METHOD_VALUE_LEN 7
 #define PRIME_RESPONSE_NUMBER_KEY "prime"
-#define PRIME_RESPONSE_FORMAT "{\"method\":\"isPrime\",\"prime\":%s}\n"
+// Only three responses are possible, they are never formatted
+#define PRIME_RESPONSE_TRUE "{\"method\":\"isPrime\",\"prime\":true}\n"
+#define PRIME_RESPONSE_TRUE_SIZE 34
+#define PRIME_RESPONSE_FALSE "{\"method\":\"isPrime\",\"prime\":false}\n"
+#define PRIME_RESPONSE_FALSE_SIZE 35
 #define PRIME_RESPONSE_ILL_RESPONSE "{\"response to malformed request\"}\n"
 #define PRIME_RESPONSE_ILL_RESPONSE_SIZE 34
 
@@ -17,18 +23,34 @@
 extern "C" {
 #endif
 
+struct prime_cache;
+struct queue;
+struct sieve;
+
 struct is_prime_request {
   bool is_prime;
   bool is_malformed;
   int64_t number;
+  // Integer literal too wide for number, points into the request
+  const char* digits;
+  size_t digits_size;
 };
 
 int is_prime_request_builder(struct queue* sdq,
                              char* raw_request,
                              size_t req_size,
                              bool* malformed);
-bool is_prime_request_malformed(struct is_prime_request* request, char* req);
+bool is_prime_request_handle(struct queue* sdq, const char* line, size_t size);
+bool is_prime_request_malformed(struct is_prime_request* request,
+                                const char* req,
+                                size_t size);
+void is_prime_use_sieve(const struct sieve* s);
+void is_prime_use_cache(struct prime_cache* c);
 bool is_prime_f(int64_t number);
+void is_prime_f_batch(const int64_t* numbers, bool* primes, size_t count);
+bool is_prime_digits(const char* digits, size_t size);
+const char* is_prime_response(const struct is_prime_request* request,
+                              size_t* size);
 void is_prime_beget_response(struct is_prime_request* request,
                              char* response,
                              int* size);
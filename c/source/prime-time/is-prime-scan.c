@@ -0,0 +1,300 @@
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "prime-time/is-prime-request.h"
+#include "prime-time/is-prime-scan.h"
+
+// What the scanner expects next
+#define SCAN_VALUE 0
+#define SCAN_KEY 1
+#define SCAN_NEXT 2  // A comma or the end of the container
+
+struct scanner {
+  const char* p;
+  const char* end;
+};
+
+static void scan_whitespace(struct scanner* s)
+{
+  while ((s->p < s->end)
+         && ((*s->p == ' ') || (*s->p == '\t') || (*s->p == '\n')
+             || (*s->p == '\r')))
+    s->p++;
+}
+
+static int hex_digit(char c)
+{
+  if ((c >= '0') && (c <= '9'))
+    return c - '0';
+  if ((c >= 'a') && (c <= 'f'))
+    return c - 'a' + 10;
+  if ((c >= 'A') && (c <= 'F'))
+    return c - 'A' + 10;
+  return -1;
+}
+
+// One character of a string body at p, escapes decoded. Returns where the next
+// one starts, NULL if the escape is invalid.
+static const char* scan_char(const char* p, const char* end, uint32_t* c)
+{
+  if (*p != '\\') {
+    *c = (unsigned char)*p;
+    return p + 1;
+  }
+  if (++p == end)
+    return NULL;
+
+  switch (*p) {
+    case '"':
+    case '\\':
+    case '/':
+      *c = (unsigned char)*p;
+      return p + 1;
+    case 'b':
+      *c = '\b';
+      return p + 1;
+    case 'f':
+      *c = '\f';
+      return p + 1;
+    case 'n':
+      *c = '\n';
+      return p + 1;
+    case 'r':
+      *c = '\r';
+      return p + 1;
+    case 't':
+      *c = '\t';
+      return p + 1;
+    case 'u':
+      if (end - p < 5)
+        return NULL;
+      *c = 0;
+      for (int k = 1; k <= 4; k++) {
+        int h = hex_digit(p[k]);
+        if (h < 0)
+          return NULL;
+        *c = (*c << 4) | (uint32_t)h;
+      }
+      return p + 5;
+    default:
+      return NULL;
+  }
+}
+
+// Leaves the body of the string at s->p in v
+static int scan_string(struct scanner* s, struct is_prime_scan_value* v)
+{
+  assert(*s->p == '"');
+  const char* p = s->p + 1;
+  v->data = p;
+  while (p < s->end) {
+    if (*p == '"') {
+      v->type = IS_PRIME_SCAN_STRING;
+      v->size = (size_t)(p - v->data);
+      s->p = p + 1;
+      return 0;
+    }
+    // Raw control characters must be escaped
+    if ((unsigned char)*p < 0x20)
+      return -1;
+    uint32_t c;
+    p = scan_char(p, s->end, &c);
+    if (p == NULL)
+      return -1;
+  }
+  return -1;
+}
+
+static const char* scan_digits(const char* p, const char* end)
+{
+  while ((p < end) && (*p >= '0') && (*p <= '9'))
+    p++;
+  return p;
+}
+
+// -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?
+static int scan_number(struct scanner* s, struct is_prime_scan_value* v)
+{
+  const char* p = s->p;
+  const char* end = s->end;
+  const char* digits;
+
+  v->type = IS_PRIME_SCAN_INT;
+  v->data = p;
+  if (*p == '-')
+    p++;
+  if ((p == end) || (*p < '0') || (*p > '9'))
+    return -1;
+  p = (*p == '0' ? p + 1 : scan_digits(p, end));
+
+  if ((p < end) && (*p == '.')) {
+    digits = p + 1;
+    p = scan_digits(digits, end);
+    if (p == digits)
+      return -1;
+    v->type = IS_PRIME_SCAN_DOUBLE;
+  }
+  if ((p < end) && ((*p == 'e') || (*p == 'E'))) {
+    p++;
+    if ((p < end) && ((*p == '+') || (*p == '-')))
+      p++;
+    digits = p;
+    p = scan_digits(digits, end);
+    if (p == digits)
+      return -1;
+    v->type = IS_PRIME_SCAN_DOUBLE;
+  }
+
+  v->size = (size_t)(p - v->data);
+  s->p = p;
+  return 0;
+}
+
+static int scan_word(struct scanner* s,
+                     const char* word,
+                     int type,
+                     struct is_prime_scan_value* v)
+{
+  size_t size = strlen(word);
+  if (((size_t)(s->end - s->p) < size) || (memcmp(s->p, word, size) != 0))
+    return -1;
+  v->type = type;
+  v->data = s->p;
+  v->size = size;
+  s->p += size;
+  return 0;
+}
+
+/**
+ * @brief Compares the raw body of a JSON string to a plain literal, decoding
+ * escapes on the fly.
+ */
+bool is_prime_scan_equals(const char* data, size_t size, const char* literal)
+{
+  const char* end = data + size;
+  while (data < end) {
+    uint32_t c;
+    data = scan_char(data, end, &c);
+    if ((data == NULL) || (*literal == 0) || (c != (unsigned char)*literal))
+      return false;
+    literal++;
+  }
+  return (*literal == 0);
+}
+
+/**
+ * @brief Validates that json holds exactly one JSON object, and picks its top
+ * level method and number members on the way.
+ *
+ * A single pass with no allocation, nesting is tracked in a bit per level.
+ * Values point into json.
+ *
+ * @return 0 if json is a valid object, -1 otherwise.
+ */
+int is_prime_scan_line(const char* json,
+                       size_t size,
+                       struct is_prime_scan* scan)
+{
+  assert(json != NULL);
+  assert(scan != NULL);
+
+  struct scanner s = {json, json + size};
+  struct is_prime_scan_value value;
+  struct is_prime_scan_value* member = NULL;  // Of the value coming next
+  uint32_t objects = 0;  // Bit k is set when level k is an object
+  int depth = 0;
+  int state = SCAN_VALUE;
+
+  memset(scan, 0, sizeof(*scan));
+  scan_whitespace(&s);
+  if ((s.p == s.end) || (*s.p != '{'))
+    return -1;
+
+  for (;;) {
+    scan_whitespace(&s);
+    if (s.p == s.end)
+      return -1;
+
+    if (state == SCAN_KEY) {
+      if ((*s.p != '"') || (scan_string(&s, &value) != 0))
+        return -1;
+      member = NULL;
+      if (depth == 1) {
+        if (is_prime_scan_equals(
+                value.data, value.size, PRIME_REQUEST_METHOD_KEY))
+          member = &scan->method;
+        else if (is_prime_scan_equals(
+                     value.data, value.size, PRIME_REQUEST_NUMBER_KEY))
+          member = &scan->number;
+      }
+      scan_whitespace(&s);
+      if ((s.p == s.end) || (*s.p != ':'))
+        return -1;
+      s.p++;
+      state = SCAN_VALUE;
+      continue;
+    }
+
+    if (state == SCAN_NEXT) {
+      bool object = (objects >> (depth - 1)) & 1;
+      char c = *s.p++;
+      if (c == ',') {
+        state = (object ? SCAN_KEY : SCAN_VALUE);
+        continue;
+      }
+      if (c != (object ? '}' : ']'))
+        return -1;
+      if (--depth == 0)
+        break;
+      continue;
+    }
+
+    // SCAN_VALUE
+    int r = 0;
+    char c = *s.p;
+    value.data = s.p;
+    value.size = 0;
+    state = SCAN_NEXT;
+    if ((c == '{') || (c == '[')) {
+      if (depth == IS_PRIME_SCAN_MAX_DEPTH)
+        return -1;
+      value.type = (c == '{' ? IS_PRIME_SCAN_OBJECT : IS_PRIME_SCAN_ARRAY);
+      if (c == '{')
+        objects |= 1U << depth;
+      else
+        objects &= ~(1U << depth);
+      depth++;
+      s.p++;
+      scan_whitespace(&s);
+      if ((s.p < s.end) && (*s.p == (c == '{' ? '}' : ']'))) {
+        // Empty, SCAN_NEXT closes it
+      } else {
+        state = (c == '{' ? SCAN_KEY : SCAN_VALUE);
+      }
+    } else if (c == '"') {
+      r = scan_string(&s, &value);
+    } else if ((c == '-') || ((c >= '0') && (c <= '9'))) {
+      r = scan_number(&s, &value);
+    } else if (c == 't') {
+      r = scan_word(&s, "true", IS_PRIME_SCAN_BOOL, &value);
+    } else if (c == 'f') {
+      r = scan_word(&s, "false", IS_PRIME_SCAN_BOOL, &value);
+    } else if (c == 'n') {
+      r = scan_word(&s, "null", IS_PRIME_SCAN_NULL, &value);
+    } else {
+      r = -1;
+    }
+    if (r != 0)
+      return -1;
+    if (member != NULL) {
+      *member = value;
+      member = NULL;
+    }
+  }
+
+  // Nothing but whitespace may follow
+  scan_whitespace(&s);
+  return (s.p == s.end ? 0 : -1);
+}
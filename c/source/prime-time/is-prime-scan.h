@@ -0,0 +1,44 @@
+#ifndef INCLUDE_PRIME_TIME_IS_PRIME_SCAN_H_
+#define INCLUDE_PRIME_TIME_IS_PRIME_SCAN_H_
+
+#include <stddef.h>
+
+// Kind of value a member holds
+#define IS_PRIME_SCAN_ABSENT 0
+#define IS_PRIME_SCAN_NULL 1
+#define IS_PRIME_SCAN_BOOL 2
+#define IS_PRIME_SCAN_STRING 3
+#define IS_PRIME_SCAN_INT 4  // Number with no fraction nor exponent
+#define IS_PRIME_SCAN_DOUBLE 5
+#define IS_PRIME_SCAN_ARRAY 6
+#define IS_PRIME_SCAN_OBJECT 7
+
+// Same nesting limit as json-c
+#define IS_PRIME_SCAN_MAX_DEPTH 32
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct is_prime_scan_value {
+  int type;  // IS_PRIME_SCAN_*
+  const char* data;  // Raw text, without the quotes for strings
+  size_t size;  // 0 for arrays and objects
+};
+
+// Top level members of an isPrime request, the last one wins on duplicates
+struct is_prime_scan {
+  struct is_prime_scan_value method;
+  struct is_prime_scan_value number;
+};
+
+int is_prime_scan_line(const char* json,
+                       size_t size,
+                       struct is_prime_scan* scan);
+bool is_prime_scan_equals(const char* data, size_t size, const char* literal);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // INCLUDE_PRIME_TIME_IS_PRIME_SCAN_H_
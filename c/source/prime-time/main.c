@@ -4,9 +4,11 @@
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <netdb.h>
 #include <stdarg.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -14,176 +16,578 @@
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <stdatomic.h>
 
 #include "log/log.h"
-#include "utils/epoll.h"
-#include "utils/queue.h"
+#include "utils/frame.h"
+#include "utils/pool.h"
+#include "utils/reactor.h"
+#include "utils/ring.h"
+#include "utils/server.h"
 #include "utils/sockets.h"
+#include "utils/tasks.h"
 #include "prime-time/is-prime-request.h"
+#include "prime-time/prime-cache.h"
+#include "prime-time/primality.h"
+#include "prime-time/sieve.h"
 #include "utils/utils.h"
 
 #define LOG_FILE "/tmp/network-exercises-prime-time.log"
 #define LOG_FILE_MODE "w"
 #define LOG_LEVEL 0  // TRACE
 
-#define QUEUE_CAPACITY 2048
-#define MAX_NUM_CON 10
-#define MAX_EVENTS 10
+#define RING_CAPACITY 4096
+#define MAX_EVENTS 64
 #define PORT "18888"
+#define PRIME_REORDER_SLOTS 64  // Requests a connection may have pending
+// Wider numbers are checked on the pool, off the reactor threads
+#define PRIME_OFFLOAD_DIGITS 32
+// Input a connection buffers, a line that doesn't fit is malformed
+#define PRIME_INPUT_MAX (64 * 1024)
+// Output a connection may leave unread before it stops reading
+#define PRIME_OUTPUT_MAX (64 * 1024)
+// Input and output buffered by every connection together. Past it the ones
+// holding more than PRIME_BUDGET_ALLOWANCE stop reading until it goes back
+// down, those whose clients keep up are left going.
+#define PRIME_MEMORY_BUDGET ((size_t)64 * 1024 * 1024)
+#define PRIME_BUDGET_ALLOWANCE (16 * 1024)
+// How often the connections waiting for the budget look again while idle
+#define PRIME_BUDGET_RETRY_MS 100
 
-int handle_request(struct queue* sdq, char* raw_req, size_t size)
+struct prime_conn;
+
+struct prime_server {
+  struct tasks_inbox inbox;  // Checks back from the pool
+  bool offload;  // inbox is watched by the reactor
+  struct prime_conn* waiting;  // Paused for the budget, see prime_retry
+};
+
+// A response waiting for the ones before it
+struct prime_slot {
+  bool ready;
+  bool last;  // Answers a malformed request, the connection closes after it
+  const char* data;  // Static, see is_prime_response
+  size_t size;
+};
+
+// Each connection keeps its own partial requests, and the responses that
+// can't go out before the ones offloaded ahead of them
+struct prime_conn {
+  struct ring* rg;
+  struct frame frame;
+  struct reactor_conn* conn;  // NULL once closed
+  uint64_t next_seq;  // Of the next request
+  uint64_t sent_seq;  // Of the next response to go out
+  int offloaded;  // Checks running on the pool, they hold on to it
+  bool stopped;  // Got a malformed request, reads no more
+  bool eof;  // The client is done sending
+  size_t charged;  // Its share of prime_buffered
+  bool waiting;  // Linked in prime_server.waiting
+  struct prime_conn* wait_next;
+  struct prime_conn* wait_prev;
+  struct prime_slot slots[PRIME_REORDER_SLOTS];
+};
+
+// A number too wide to check on the reactor thread. When it is already being
+// checked it waits for that check instead of going to the pool.
+struct prime_check {
+  struct task task;
+  struct prime_cache_waiter waiter;
+  struct prime_conn* pc;
+  uint64_t seq;
+  bool prime;
+  size_t size;
+  char digits[PRIMALITY_MAX_DIGITS];
+};
+
+// The numbers of one read that fit in 64 bits, checked together once it is
+// all parsed
+struct prime_batch {
+  size_t count;
+  uint64_t seq[PRIME_REORDER_SLOTS];
+  int64_t numbers[PRIME_REORDER_SLOTS];
+  bool primes[PRIME_REORDER_SLOTS];
+};
+
+// Shared by every worker, NULL to check everything inline
+static struct tasks* prime_tasks = NULL;
+// Shared by every worker, NULL to check every number every time
+static struct prime_cache* prime_results = NULL;
+// Bytes buffered by every connection of every worker
+static atomic_size_t prime_buffered = 0;
+
+static _Thread_local struct pool prime_conn_pool =
+    POOL_INIT(sizeof(struct prime_conn), POOL_DEFAULT_SLAB_OBJECTS);
+static _Thread_local struct pool prime_check_pool =
+    POOL_INIT(sizeof(struct prime_check), POOL_DEFAULT_SLAB_OBJECTS);
+
+static struct prime_slot* prime_slot(struct prime_conn* pc, uint64_t seq)
+{
+  return &pc->slots[seq % PRIME_REORDER_SLOTS];
+}
+
+static void prime_conn_free(struct prime_conn* pc)
+{
+  ring_free(&pc->rg);
+  pool_put(&prime_conn_pool, pc);
+}
+
+static void prime_check_run(struct task* task)
 {
-  assert(sdq != NULL);
-  assert(raw_req != NULL);
-  if (size == 0) {
-    log_error("handle_request: raw request size is zero");
-    return 1;
+  struct prime_check* check = (struct prime_check*)task;
+  check->prime = is_prime_digits(check->digits, check->size);
+}
+
+// The same number was checked for someone else, back to the inbox as if run
+static void prime_check_wake(struct prime_cache_waiter* w, bool prime)
+{
+  struct prime_check* check =
+      (struct prime_check*)((char*)w - offsetof(struct prime_check, waiter));
+  check->prime = prime;
+  tasks_inbox_put(check->task.inbox, &check->task);
+}
+
+// Checks the number on the pool, or waits for the check of it already
+// running. false when it's known already, the answer is in req then.
+static bool prime_offload(struct prime_server* srv,
+                          struct prime_conn* pc,
+                          uint64_t seq,
+                          struct is_prime_request* req)
+{
+  struct prime_check* check = pool_get(&prime_check_pool);
+  assert(check != NULL);
+  check->task.run = prime_check_run;
+  check->task.inbox = &srv->inbox;
+  check->waiter.wake = prime_check_wake;
+  check->pc = pc;
+  check->seq = seq;
+  check->size = req->digits_size;
+  memcpy(check->digits, req->digits, req->digits_size);
+
+  int found = PRIME_CACHE_MISS;
+  if (prime_results != NULL)
+    found = prime_cache_join(prime_results,
+                             check->digits,
+                             check->size,
+                             &check->waiter,
+                             &req->is_prime);
+  if (found == PRIME_CACHE_HIT) {
+    pool_put(&prime_check_pool, check);
+    return false;
   }
 
-  // Split and handle requests here
-  bool mal = false;
-  int r = is_prime_request_builder(sdq, raw_req, size, &mal);
-  if (r <= 0) {
-    log_warn("recv_and_handle: is_prime_request_builder returned '%d'", r);
-    return -1;
+  pc->offloaded++;
+  if (found == PRIME_CACHE_MISS)
+    tasks_submit(prime_tasks, &check->task);
+  else
+    // Only this thread drains the inbox, so it can't miss the check even
+    // if it is back already
+    tasks_inbox_hold(&srv->inbox);
+  return true;
+}
+
+// Answers a request, in its slot until the ones before it are out
+static void prime_request(struct prime_server* srv,
+                          struct prime_conn* pc,
+                          struct prime_batch* batch,
+                          const char* line,
+                          size_t size)
+{
+  struct is_prime_request req;
+  uint64_t seq = pc->next_seq++;
+  struct prime_slot* slot = prime_slot(pc, seq);
+  slot->last = is_prime_request_malformed(&req, line, size);
+  pc->stopped = slot->last;
+  if (!slot->last && (req.digits == NULL)) {
+    batch->seq[batch->count] = seq;
+    batch->numbers[batch->count++] = req.number;
+    return;
   }
+  if (!slot->last && (req.digits_size > PRIME_OFFLOAD_DIGITS) && srv->offload)
+  {
+    if (prime_offload(srv, pc, seq, &req))
+      return;
+  } else {
+    req.is_prime =
+        (!slot->last && is_prime_digits(req.digits, req.digits_size));
+  }
+  slot->data = is_prime_response(&req, &slot->size);
+  slot->ready = true;
+}
 
-  return (mal ? 0 : 1);
+// Answers a line that can't fit in PRIME_INPUT_MAX as malformed
+static void prime_reject(struct prime_conn* pc)
+{
+  struct is_prime_request req = {.is_malformed = true};
+  struct prime_slot* slot = prime_slot(pc, pc->next_seq++);
+  slot->last = true;
+  slot->data = is_prime_response(&req, &slot->size);
+  slot->ready = true;
+  pc->stopped = true;
+  ring_reset(pc->rg);
 }
 
-int main()
+// Handles every complete request, the partial one stays in the ring. Stops
+// early on a malformed one or while PRIME_REORDER_SLOTS are waiting.
+// Empty lines are skipped
+static void prime_read(struct prime_server* srv, struct prime_conn* pc)
 {
-  FILE* log_fd = NULL;
-  int listen_fd;
+  size_t size;
+  struct ring* rg = pc->rg;
+  struct prime_batch batch;
+  batch.count = 0;
+  while (!pc->stopped && (pc->next_seq - pc->sent_seq < PRIME_REORDER_SLOTS))
+  {
+    size = frame_next(&pc->frame, ring_read_ptr(rg), rg->size);
+    if (size == 0) {
+      if (rg->size >= PRIME_INPUT_MAX)
+        prime_reject(pc);
+      break;
+    }
+    if (size > 1)
+      prime_request(srv, pc, &batch, ring_read_ptr(rg), size - 1);
+    ring_consume(rg, size);
+  }
 
-  if ((log_fd = fopen(LOG_FILE, LOG_FILE_MODE)) == NULL) {
-    printf("Cannot open log file\n");
-    exit(EXIT_FAILURE);
+  is_prime_f_batch(batch.numbers, batch.primes, batch.count);
+  for (size_t k = 0; k < batch.count; k++) {
+    struct is_prime_request req = {.is_prime = batch.primes[k]};
+    struct prime_slot* slot = prime_slot(pc, batch.seq[k]);
+    slot->data = is_prime_response(&req, &slot->size);
+    slot->ready = true;
   }
+}
 
-  if (init_logs(log_fd, LOG_LEVEL) != 0)
-    exit(EXIT_FAILURE);
+// Sends the responses whose turn has come, all at once
+static int prime_send(struct prime_conn* pc)
+{
+  struct iovec iov[PRIME_REORDER_SLOTS];
+  int n = 0;
+  bool last = false;
+  while ((pc->sent_seq < pc->next_seq) && !last) {
+    struct prime_slot* slot = prime_slot(pc, pc->sent_seq);
+    if (!slot->ready)
+      break;
+    // Only read by sendmsg, iovec just has no const version
+    iov[n].iov_base = (void*)(uintptr_t)slot->data;
+    iov[n].iov_len = slot->size;
+    n++;
+    slot->ready = false;
+    last = slot->last;
+    pc->sent_seq++;
+  }
 
-  if (create_server(PORT, &listen_fd) != 0) {
-    fprintf(stderr, "failed to create server\n");
-    exit(EXIT_FAILURE);
+  if ((n > 0) && (reactor_sendv(pc->conn, iov, n) != 0)) {
+    log_error("prime_send: failed during reactor_send");
+    return REACTOR_CLOSE;
+  }
+  if (last) {
+    log_info("prime_send: there was a malformed request. need to close socket");
+    return REACTOR_CLOSE;
   }
-  log_trace("main: listening...");
+  return REACTOR_KEEP;
+}
 
-  struct epoll_event ev, events[MAX_EVENTS];
-  int nfds, epollfd;
+// Answers as much as possible, sending frees slots for the requests that
+// were waiting for them
+static int prime_serve(struct prime_server* srv, struct prime_conn* pc)
+{
+  uint64_t sent;
+  do {
+    sent = pc->sent_seq;
+    prime_read(srv, pc);
+    if (prime_send(pc) == REACTOR_CLOSE)
+      return REACTOR_CLOSE;
+  } while (pc->sent_seq != sent);
 
-  epollfd = epoll_create1(0);
-  if (epollfd == -1) {
-    perror("epoll_create1 failed\n");
-    exit(EXIT_FAILURE);
+  // Past the end of file there is only what is left to answer
+  if (pc->eof && (pc->sent_seq == pc->next_seq))
+    return REACTOR_CLOSE;
+  return REACTOR_KEEP;
+}
+
+// Links pc in or out of the connections waiting for the budget
+static void prime_wait(struct prime_server* srv,
+                       struct prime_conn* pc,
+                       bool wait)
+{
+  if (wait == pc->waiting)
+    return;
+  pc->waiting = wait;
+  if (wait) {
+    pc->wait_prev = NULL;
+    pc->wait_next = srv->waiting;
+    if (srv->waiting != NULL)
+      srv->waiting->wait_prev = pc;
+    srv->waiting = pc;
+    return;
   }
-  log_trace("main: epoll created...");
+  if (pc->wait_prev != NULL)
+    pc->wait_prev->wait_next = pc->wait_next;
+  else
+    srv->waiting = pc->wait_next;
+  if (pc->wait_next != NULL)
+    pc->wait_next->wait_prev = pc->wait_prev;
+}
 
-  ev.events = EPOLLIN | EPOLLRDHUP;
-  ev.data.fd = listen_fd;
-  if (epoll_ctl(epollfd, EPOLL_CTL_ADD, listen_fd, &ev) == -1) {
-    perror("epoll_ctl: listen_fd\n");
-    exit(EXIT_FAILURE);
+// Pauses the connection while it holds too much, or while every connection
+// together does, and resumes it otherwise
+static int prime_throttle(struct prime_server* srv, struct prime_conn* pc)
+{
+  size_t output = reactor_pending(pc->conn);
+  size_t held = pc->rg->size + output;
+  size_t total;
+  if (held >= pc->charged)
+    total = atomic_fetch_add(&prime_buffered, held - pc->charged)
+        + (held - pc->charged);
+  else
+    total = atomic_fetch_sub(&prime_buffered, pc->charged - held)
+        - (pc->charged - held);
+  pc->charged = held;
+
+  // Its own limits clear up with its own events, the budget may not
+  bool over = (held > PRIME_BUDGET_ALLOWANCE) && (total > PRIME_MEMORY_BUDGET);
+  bool full = (pc->rg->size >= PRIME_INPUT_MAX) || (output >= PRIME_OUTPUT_MAX);
+  prime_wait(srv, pc, over);
+  if (over || full)
+    return reactor_pause(pc->conn);
+  return reactor_resume(pc->conn);
+}
+
+// Gives the connections waiting for the budget another go once there is
+// some left
+static void prime_retry(struct prime_server* srv)
+{
+  if ((srv->waiting == NULL)
+      || (atomic_load(&prime_buffered) > PRIME_MEMORY_BUDGET))
+    return;
+
+  struct prime_conn* next;
+  for (struct prime_conn* pc = srv->waiting; pc != NULL; pc = next) {
+    next = pc->wait_next;
+    if (prime_throttle(srv, pc) != 0)
+      reactor_close(pc->conn);
   }
+}
+
+int prime_on_open(struct reactor_conn* conn)
+{
+  struct prime_server* srv = conn->reactor->udata;
+  struct prime_conn* pc = pool_get(&prime_conn_pool);
+  if (pc == NULL)
+    return -1;
+  pc->rg = NULL;
+  if (ring_init(&pc->rg, RING_CAPACITY) != 0) {
+    pool_put(&prime_conn_pool, pc);
+    return -1;
+  }
+  frame_init(&pc->frame, PRIME_REQUEST_DELIMITERS[0]);
+  pc->conn = conn;
+  pc->next_seq = 0;
+  pc->sent_seq = 0;
+  pc->offloaded = 0;
+  pc->stopped = false;
+  pc->eof = false;
+  pc->charged = 0;
+  pc->waiting = false;
+  for (size_t k = 0; k < PRIME_REORDER_SLOTS; k++)
+    pc->slots[k].ready = false;
+  conn->udata = pc;
+  conn->recv_max = PRIME_INPUT_MAX;
+
+  // The reactor doesn't exist yet in prime_worker_init
+  if ((prime_tasks != NULL) && !srv->offload && (srv->inbox.notify_fd != -1))
+    srv->offload =
+        (reactor_add_notifier(conn->reactor, srv->inbox.notify_fd) == 0);
+  return 0;
+}
+
+void prime_on_close(struct reactor_conn* conn)
+{
+  struct prime_conn* pc = conn->udata;
+  conn->udata = NULL;
+  if (pc == NULL)
+    return;
+
+  struct prime_server* srv = conn->reactor->udata;
+  prime_wait(srv, pc, false);
+  atomic_fetch_sub(&prime_buffered, pc->charged);
+  pc->charged = 0;
+
+  pc->conn = NULL;
+  if (pc->offloaded == 0)
+    prime_conn_free(pc);
+}
+
+int prime_on_data(struct reactor_conn* conn)
+{
+  int fd = conn->fd;
+  struct prime_server* srv = conn->reactor->udata;
+  struct prime_conn* pc = conn->udata;
+
+  // Receive all the data into the ring
+  int res = reactor_recv(conn, pc->rg);
+  log_trace("prime_on_data: handling POLLIN event on fd '%d' with res: '%d'",
+            fd,
+            res);
+
+  // Handle error case while recv data
+  if (res < -1) {
+    log_error("prime_on_data: error while receiving data");
+    return REACTOR_CLOSE;
+  }
+
+  // Keep the socket open past the end of file until every check is back
+  if (res == 0)
+    pc->eof = true;
+  res = prime_serve(srv, pc);
+  if ((res == REACTOR_KEEP) && (prime_throttle(srv, pc) != 0))
+    res = REACTOR_CLOSE;
+  prime_retry(srv);
+  return res;
+}
+
+// What the client had left unread is out, it may read again
+int prime_on_drain(struct reactor_conn* conn)
+{
+  struct prime_server* srv = conn->reactor->udata;
+  int res = (prime_throttle(srv, conn->udata) == 0 ? REACTOR_KEEP
+                                                    : REACTOR_CLOSE);
+  prime_retry(srv);
+  return res;
+}
+
+// Idle, nothing else gives the connections waiting for the budget a go
+int prime_on_timeout(struct reactor* r)
+{
+  prime_retry(r->udata);
+  return REACTOR_KEEP;
+}
+
+// Checks are back from the pool, their responses may go out now
+void prime_on_notify(struct reactor* r)
+{
+  struct prime_server* srv = r->udata;
+  struct task* next;
+  for (struct task* task = tasks_inbox_take(&srv->inbox); task != NULL;
+       task = next)
+  {
+    next = task->next;
+    struct prime_check* check = (struct prime_check*)task;
+    struct prime_conn* pc = check->pc;
+    struct is_prime_request req = {.is_prime = check->prime};
+    struct prime_slot* slot = prime_slot(pc, check->seq);
+    pool_put(&prime_check_pool, check);
 
-  char *data, *sddata, *complete_req;
-  int n, fd, res, size, sdsize, rs, result;
-  struct epoll_ctl_info epci = {epollfd, 0, 0};
-  struct queue *rcqu = NULL, *sdqu = NULL;
-  queue_init(&rcqu, QUEUE_CAPACITY);
-  queue_init(&sdqu, QUEUE_CAPACITY);
-
-  for (;;) {
-    log_trace("main epoll loop: epoll listening...");
-    nfds = epoll_wait(epollfd, events, MAX_EVENTS, -1);
-    if (nfds == -1) {
-      perror("epoll_wait\n");
-      exit(EXIT_FAILURE);
+    pc->offloaded--;
+    if (pc->conn == NULL) {
+      if (pc->offloaded == 0)
+        prime_conn_free(pc);
+      continue;
     }
 
-    log_trace("main epoll loop: epoll got '%d' events", nfds);
-    for (n = 0; n < nfds; ++n) {
-      epci.new_fd = events[n].data.fd;
-      fd = events[n].data.fd;
-      epci.event = &events[n];
-
-      // Handle a new listen connection
-      if (events[n].data.fd == listen_fd) {
-        fd_accept_and_epoll_add(&epci);
-        continue;
-      }
-
-      // Receive all the data into the queue
-      res = recv_request(fd, rcqu);
-      log_trace(
-          "main epoll loop: handling POLLIN event on fd '%d' with res: '%d'",
-          fd,
-          res);
-
-      // Handle error case while recv data
-      if (res < -1) {
-        log_error("main epoll loop: error while receiving data");
-        if (fd_poll_del_and_close(&epci) == -1) {
-          perror("epoll_ctl: recv 0");
-          exit(EXIT_FAILURE);
-        }
-
-        continue;
-      }
-
-      // Peek at the data to check if we have at least one complete request
-      complete_req = NULL;
-      size = queue_peek(rcqu, &data);
-      if (size > 0) {
-        complete_req = (char*)memrchr(data, PRIME_REQUEST_DELIMITERS[0], size);
-        log_trace("main epoll loop: complete_req = '%d'",
-                  (complete_req == NULL ? 0 : 1));
-      }
-
-      // If we do, process it
-      if (complete_req != NULL) {
-        size = queue_pop_no_copy(rcqu, &data);
-        log_trace(
-            "main epoll loop: raw request: fd: '%d', size: '%d'", fd, size);
-        rs = 0;
-        result = handle_request(sdqu, data, (size_t)size);
-        sdsize = queue_pop_no_copy(sdqu, &sddata);
-        if (sdsize > 0)
-          rs = sendall(fd, sddata, &sdsize);
-
-        if ((result <= 0) || (rs != 0)) {
-          if (result == 0)
-            log_info(
-                "main epoll loop: there was a malformed respoonse. need to "
-                "close socket");
-          else if (result < 0)
-            log_info(
-                "main epoll loop: there was an error handling the request. "
-                "need to close socket");
-          else if (rs != 0)
-            log_error("main epoll loop:: failed during sendall function");
-          if (fd_poll_del_and_close(&epci) == -1) {
-            perror("epoll_ctl: recv 0");
-            exit(EXIT_FAILURE);
-          }
-          continue;
-        }
-      }
-
-      // Handle socket still open
-      if (res == -1)
-        continue;
-
-      // Handle closing request received
-      log_info("main epoll loop:: closing connection");
-      if (fd_poll_del_and_close(&epci) == -1) {
-        perror("epoll_ctl: recv 0");
-        exit(EXIT_FAILURE);
-      }
+    slot->data = is_prime_response(&req, &slot->size);
+    slot->ready = true;
+    if ((prime_serve(srv, pc) == REACTOR_CLOSE)
+        || (prime_throttle(srv, pc) != 0))
+      reactor_close(pc->conn);
+  }
+  prime_retry(srv);
+}
+
+void* prime_worker_init(int id)
+{
+  (void)id;
+  struct prime_server* srv = malloc(sizeof(struct prime_server));
+  assert(srv != NULL);
+  srv->offload = false;
+  srv->waiting = NULL;
+  if (tasks_inbox_init(&srv->inbox) != 0)
+    log_warn("prime_worker_init: worker '%d' checks everything inline", id);
+  return srv;
+}
+
+void prime_worker_free(void* udata)
+{
+  struct prime_server* srv = udata;
+  if (srv->inbox.notify_fd != -1) {
+    // Every connection is closed by now, drop what is still running
+    tasks_inbox_drain(&srv->inbox);
+    struct task* next;
+    for (struct task* task = tasks_inbox_take(&srv->inbox); task != NULL;
+         task = next)
+    {
+      next = task->next;
+      struct prime_check* check = (struct prime_check*)task;
+      if (--check->pc->offloaded == 0)
+        prime_conn_free(check->pc);
+      pool_put(&prime_check_pool, check);
     }
+    tasks_inbox_destroy(&srv->inbox);
   }
-  printf("Hello world\n");
+  free(srv);
+}
+
+int main(int argc, char* argv[])
+{
+  FILE* log_fd = NULL;
+  struct server_options opts = {
+      PORT, 1, REACTOR_BACKEND_EPOLL, SOCKETS_DEFAULT_BACKLOG};
+
+  if (server_options_parse(argc, argv, &opts) != 0)
+    exit(EXIT_FAILURE);
+
+  if ((log_fd = fopen(LOG_FILE, LOG_FILE_MODE)) == NULL) {
+    printf("Cannot open log file\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (init_logs(log_fd, LOG_LEVEL) != 0)
+    exit(EXIT_FAILURE);
+
+  struct server_config cfg = {
+      .reactor = {.max_events = MAX_EVENTS,
+                  .timeout_ms = PRIME_BUDGET_RETRY_MS,
+                  .handlers = {.on_open = prime_on_open,
+                               .on_data = prime_on_data,
+                               .on_close = prime_on_close,
+                               .on_timeout = prime_on_timeout,
+                               .on_notify = prime_on_notify,
+                               .on_drain = prime_on_drain}},
+      .worker_init = prime_worker_init,
+      .worker_free = prime_worker_free,
+  };
+  log_trace("main: starting '%d' workers...", opts.workers);
+
+  // Numbers below 2^32 are looked up, the bitmap is built once and cached
+  struct sieve sieve = {0};
+  char sieve_path[PATH_MAX];
+  sieve_cache_path(sieve_path, sizeof(sieve_path));
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int threads = (cpus > 0 ? (int)cpus : 1);
+  if (sieve_open(&sieve, sieve_path, SIEVE_LIMIT_32, threads) == 0)
+    is_prime_use_sieve(&sieve);
+  else
+    log_warn("main: no sieve at '%s', using Miller-Rabin only", sieve_path);
+
+  if (tasks_init(&prime_tasks, threads) != 0)
+    log_warn("main: no worker pool, checking every number inline");
+
+  // Numbers asked about again, by anyone, aren't checked again
+  if (prime_cache_init(&prime_results) == 0)
+    is_prime_use_cache(prime_results);
+  else
+    log_warn("main: no result cache, checking every number every time");
+
+  int res = server_run(&opts, &cfg);
+  if (prime_tasks != NULL)
+    tasks_free(&prime_tasks);
+  is_prime_use_cache(NULL);
+  if (prime_results != NULL)
+    prime_cache_free(&prime_results);
+  is_prime_use_sieve(NULL);
+  sieve_close(&sieve);
+  return (res == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
 }
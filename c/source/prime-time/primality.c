@@ -0,0 +1,853 @@
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#  include <immintrin.h>
+#  define PRIMALITY_X86 1
+#endif
+
+#include "prime-time/primality.h"
+
+__extension__ typedef unsigned __int128 u128;
+
+static const uint32_t primality_small_primes[] = {
+    2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53, 59, 61, 67, 71,
+    73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131, 137, 139, 149, 151,
+    157, 163, 167, 173, 179, 181, 191, 193, 197, 199, 211, 223, 227, 229, 233,
+    239, 241, 251, 257, 263, 269, 271, 277, 281, 283, 293, 307, 311, 313, 317,
+    331, 337, 347, 349, 353, 359, 367, 373, 379, 383, 389, 397, 401, 409, 419,
+    421, 431, 433, 439, 443, 449, 457, 461, 463, 467, 479, 487, 491, 499, 503,
+    509, 521, 523, 541, 547, 557, 563, 569, 571, 577, 587, 593, 599, 601, 607,
+    613, 617, 619, 631, 641, 643, 647, 653, 659, 661, 673, 677, 683, 691, 701,
+    709, 719, 727, 733, 739, 743, 751, 757, 761, 769, 773, 787, 797, 809, 811,
+    821, 823, 827, 829, 839, 853, 857, 859, 863, 877, 881, 883, 887, 907, 911,
+    919, 929, 937, 941, 947, 953, 967, 971, 977, 983, 991, 997, 1009, 1013,
+    1019, 1021,
+};
+#define PRIMALITY_SMALL_PRIMES \
+  (sizeof(primality_small_primes) / sizeof(primality_small_primes[0]))
+// 64 bit numbers are only sieved with the primes below 100, anything below
+// 101^2 with none of them as a factor is prime
+#define PRIMALITY_U64_PRIMES 25
+#define PRIMALITY_SMALL_LIMIT (101 * 101)
+// Selfridge candidates tried before checking for a perfect square, which has
+// none with a Jacobi symbol of -1
+#define PRIMALITY_LUCAS_SQUARE_CHECK 16
+
+// Deterministic for every n < 2^64 (Jim Sinclair's set)
+static const uint64_t primality_bases[] = {
+    2, 325, 9375, 28178, 450775, 9780504, 1795265022,
+};
+#define PRIMALITY_BASES \
+  (sizeof(primality_bases) / sizeof(primality_bases[0]))
+
+// Montgomery arithmetic modulo an odd n with R = 2^64
+struct montgomery {
+  uint64_t n;
+  uint64_t ninv;  // n^-1 mod 2^64
+  uint64_t r2;  // R^2 mod n
+  uint64_t one;  // R mod n
+};
+
+// n^-1 mod 2^64 for an odd n
+static uint64_t montgomery_inverse(uint64_t n)
+{
+  // Newton's iteration doubles the correct low bits each step, n is its own
+  // inverse modulo 8 to start with
+  uint64_t inv = n;
+  for (int k = 0; k < 5; k++)
+    inv *= 2 - n * inv;
+  return inv;
+}
+
+static void montgomery_init(struct montgomery* m, uint64_t n)
+{
+  m->n = n;
+  m->ninv = montgomery_inverse(n);
+  m->one = (uint64_t)(-n) % n;
+  m->r2 = (uint64_t)(((u128)m->one * m->one) % n);
+}
+
+// t * R^-1 mod n, for t < n * R
+static inline uint64_t montgomery_reduce(const struct montgomery* m, u128 t)
+{
+  uint64_t q = (uint64_t)t * m->ninv;
+  uint64_t qn_hi = (uint64_t)(((u128)q * m->n) >> 64);
+  uint64_t t_hi = (uint64_t)(t >> 64);
+  // The low halves cancel out by construction of q
+  return (t_hi < qn_hi ? t_hi - qn_hi + m->n : t_hi - qn_hi);
+}
+
+static inline uint64_t montgomery_mul(const struct montgomery* m,
+                                      uint64_t a,
+                                      uint64_t b)
+{
+  return montgomery_reduce(m, (u128)a * b);
+}
+
+static uint64_t montgomery_pow(const struct montgomery* m,
+                               uint64_t base,
+                               uint64_t exp)
+{
+  uint64_t result = m->one;
+  while (exp > 0) {
+    if (exp & 1)
+      result = montgomery_mul(m, result, base);
+    base = montgomery_mul(m, base, base);
+    exp >>= 1;
+  }
+  return result;
+}
+
+// One Miller-Rabin round, n - 1 = d * 2^s. False means composite for sure.
+static bool primality_witness(const struct montgomery* m,
+                              uint64_t a,
+                              uint64_t d,
+                              int s)
+{
+  a %= m->n;
+  if (a == 0)
+    return true;
+
+  uint64_t minus_one = m->n - m->one;
+  uint64_t x = montgomery_pow(m, montgomery_mul(m, a, m->r2), d);
+  if ((x == m->one) || (x == minus_one))
+    return true;
+  for (int k = 1; k < s; k++) {
+    x = montgomery_mul(m, x, x);
+    if (x == minus_one)
+      return true;
+  }
+  return false;
+}
+
+// Settles n by trial division when it is small or has a small factor,
+// otherwise n is odd, above PRIMALITY_SMALL_LIMIT and needs Miller-Rabin
+static bool primality_u64_small(uint64_t n, bool* prime)
+{
+  for (size_t k = 0; k < PRIMALITY_U64_PRIMES; k++) {
+    if (n == primality_small_primes[k]) {
+      *prime = true;
+      return true;
+    }
+    if (n % primality_small_primes[k] == 0) {
+      *prime = false;
+      return true;
+    }
+  }
+  *prime = (n >= 2);
+  return (n < PRIMALITY_SMALL_LIMIT);
+}
+
+// Miller-Rabin on what primality_u64_small leaves
+static bool primality_u64_rounds(uint64_t n)
+{
+  int s = __builtin_ctzll(n - 1);
+  uint64_t d = (n - 1) >> s;
+  struct montgomery m;
+  montgomery_init(&m, n);
+  for (size_t k = 0; k < PRIMALITY_BASES; k++) {
+    if (!primality_witness(&m, primality_bases[k], d, s))
+      return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Deterministic primality test for any 64 bit number.
+ *
+ * Small factors are sieved out first, what is left goes through Miller-Rabin
+ * with the 7 bases known to have no pseudoprime below 2^64.
+ */
+bool primality_u64(uint64_t n)
+{
+  bool prime;
+  if (primality_u64_small(n, &prime))
+    return prime;
+  return primality_u64_rounds(n);
+}
+
+/// Reference implementation for the tests, O(sqrt(n))
+bool primality_trial_division(uint64_t n)
+{
+  if (n < 2)
+    return false;
+  for (uint64_t i = 2; i <= n / i; i++) {
+    if (n % i == 0)
+      return false;
+  }
+  return true;
+}
+
+// ---- Batches, one Miller-Rabin round per lane at a time ----
+
+#ifdef PRIMALITY_X86
+
+// The vector kernel works on the low 52 bits of each 64 bit lane
+#  define PRIMALITY_LIMIT_52 (1ULL << 52)
+
+// A number of a batch going through its rounds
+struct primality_job {
+  struct montgomery m;  // With R = 2^52, ninv = -n^-1 mod R
+  uint64_t d;
+  int s;
+  size_t base;  // Index of the next round in primality_bases
+  bool* prime;
+};
+
+static void primality_job_init(struct primality_job* job,
+                               uint64_t n,
+                               bool* prime)
+{
+  job->s = __builtin_ctzll(n - 1);
+  job->d = (n - 1) >> job->s;
+  job->base = 0;
+  job->prime = prime;
+  job->m.n = n;
+  job->m.ninv = -montgomery_inverse(n) & (PRIMALITY_LIMIT_52 - 1);
+  job->m.one = PRIMALITY_LIMIT_52 % n;
+  job->m.r2 = (uint64_t)(((u128)job->m.one * job->m.one) % n);
+}
+
+// a * b * 2^-52 mod n on 8 lanes, a, b < n < 2^52
+__attribute__((target("avx512f,avx512ifma"))) static inline __m512i
+primality_mul_52(__m512i a, __m512i b, __m512i n, __m512i ninv)
+{
+  __m512i zero = _mm512_setzero_si512();
+  __m512i lo = _mm512_madd52lo_epu64(zero, a, b);
+  __m512i hi = _mm512_madd52hi_epu64(zero, a, b);
+  __m512i q = _mm512_madd52lo_epu64(zero, lo, ninv);
+  // The low halves of a * b + q * n add up to 0 or 2^52, only the carry
+  // is left of them
+  __m512i carry = _mm512_srli_epi64(_mm512_madd52lo_epu64(lo, q, n), 52);
+  __m512i r = _mm512_add_epi64(_mm512_madd52hi_epu64(hi, q, n), carry);
+  return _mm512_mask_sub_epi64(r, _mm512_cmpge_epu64_mask(r, n), r, n);
+}
+
+// Runs round job->base of every lane, pass tells which survived it. The
+// exponents differ, each lane only takes the products its bits call for.
+__attribute__((target("avx512f,avx512ifma"))) static void
+primality_round_ifma(struct primality_job* const* lane, bool* pass)
+{
+  uint64_t vn[PRIMALITY_IFMA_LANES], vninv[PRIMALITY_IFMA_LANES];
+  uint64_t vone[PRIMALITY_IFMA_LANES], va[PRIMALITY_IFMA_LANES];
+  uint64_t vr2[PRIMALITY_IFMA_LANES], vd[PRIMALITY_IFMA_LANES];
+  uint64_t vs[PRIMALITY_IFMA_LANES], top = 0, s = 0;
+  for (size_t l = 0; l < PRIMALITY_IFMA_LANES; l++) {
+    const struct primality_job* job = lane[l];
+    vn[l] = job->m.n;
+    vninv[l] = job->m.ninv;
+    vone[l] = job->m.one;
+    vr2[l] = job->m.r2;
+    va[l] = primality_bases[job->base] % job->m.n;
+    vd[l] = job->d;
+    vs[l] = (uint64_t)job->s;
+    top |= vd[l];
+    s = (vs[l] > s ? vs[l] : s);
+  }
+
+  __m512i n = _mm512_loadu_si512(vn);
+  __m512i ninv = _mm512_loadu_si512(vninv);
+  __m512i one = _mm512_loadu_si512(vone);
+  __m512i minus_one = _mm512_sub_epi64(n, one);
+  __m512i a = _mm512_loadu_si512(va);
+  __m512i d = _mm512_loadu_si512(vd);
+  __m512i bit = _mm512_set1_epi64(1);
+  __m512i b = primality_mul_52(a, _mm512_loadu_si512(vr2), n, ninv);
+  __m512i x = one;
+  for (; top != 0; top >>= 1) {
+    __mmask8 set = _mm512_test_epi64_mask(d, bit);
+    x = _mm512_mask_mov_epi64(x, set, primality_mul_52(x, b, n, ninv));
+    b = primality_mul_52(b, b, n, ninv);
+    d = _mm512_srli_epi64(d, 1);
+  }
+
+  // A base that is a multiple of n says nothing
+  __m512i steps = _mm512_loadu_si512(vs);
+  __mmask8 ok = _mm512_cmpeq_epu64_mask(a, _mm512_setzero_si512())
+      | _mm512_cmpeq_epu64_mask(x, one) | _mm512_cmpeq_epu64_mask(x, minus_one);
+  for (uint64_t k = 1; k < s; k++) {
+    x = primality_mul_52(x, x, n, ninv);
+    ok |= _mm512_cmpeq_epu64_mask(x, minus_one)
+        & _mm512_cmpgt_epu64_mask(steps, _mm512_set1_epi64((long long)k));
+  }
+  for (size_t l = 0; l < PRIMALITY_IFMA_LANES; l++)
+    pass[l] = ((ok >> l) & 1) != 0;
+}
+
+// Keeps every lane busy, a lane moves on to the next job as soon as its
+// number fails a round or passes them all
+static void primality_schedule(struct primality_job* jobs, size_t count)
+{
+  struct primality_job* lane[PRIMALITY_IFMA_LANES];
+  bool pass[PRIMALITY_IFMA_LANES];
+  size_t next = 0, active = 0;
+  for (; (active < PRIMALITY_IFMA_LANES) && (next < count); active++)
+    lane[active] = &jobs[next++];
+
+  while (active > 0) {
+    // Idle lanes repeat a busy one, their answer is ignored
+    for (size_t l = active; l < PRIMALITY_IFMA_LANES; l++)
+      lane[l] = lane[0];
+    primality_round_ifma(lane, pass);
+
+    for (size_t l = 0; l < active;) {
+      struct primality_job* job = lane[l];
+      job->base++;
+      if (pass[l] && (job->base < PRIMALITY_BASES)) {
+        l++;
+        continue;
+      }
+      *job->prime = pass[l];
+      if (next < count) {
+        lane[l++] = &jobs[next++];
+      } else {
+        // The last busy lane moves in and is looked at next
+        lane[l] = lane[--active];
+        pass[l] = pass[active];
+      }
+    }
+  }
+}
+
+#endif
+
+/// Best implementation this CPU runs, PRIMALITY_ISA_*
+int primality_isa(void)
+{
+#ifdef PRIMALITY_X86
+  if (__builtin_cpu_supports("avx512f")
+      && __builtin_cpu_supports("avx512ifma"))
+    return PRIMALITY_ISA_AVX512IFMA;
+#endif
+  return PRIMALITY_ISA_SCALAR;
+}
+
+/**
+ * @brief primality_u64_batch with a given implementation, for tests and
+ * benchmarks.
+ *
+ * Falls back to the scalar one when the CPU lacks the instructions.
+ */
+void primality_u64_batch_isa(int isa,
+                             const uint64_t* n,
+                             bool* prime,
+                             size_t count)
+{
+  assert(n != NULL || count == 0);
+  assert(prime != NULL || count == 0);
+
+  int best = primality_isa();
+  if ((isa == PRIMALITY_ISA_AUTO) || (isa > best))
+    isa = best;
+
+#ifdef PRIMALITY_X86
+  struct primality_job jobs[PRIMALITY_BATCH];
+  size_t njobs = 0;
+#endif
+  for (size_t k = 0; k < count; k++) {
+    if (primality_u64_small(n[k], &prime[k]))
+      continue;
+#ifdef PRIMALITY_X86
+    if ((isa == PRIMALITY_ISA_AVX512IFMA) && (n[k] < PRIMALITY_LIMIT_52)) {
+      primality_job_init(&jobs[njobs++], n[k], &prime[k]);
+      if (njobs == PRIMALITY_BATCH) {
+        primality_schedule(jobs, njobs);
+        njobs = 0;
+      }
+      continue;
+    }
+#endif
+    prime[k] = primality_u64_rounds(n[k]);
+  }
+#ifdef PRIMALITY_X86
+  primality_schedule(jobs, njobs);
+#endif
+}
+
+/**
+ * @brief primality_u64 of count numbers at once, the answers land in prime
+ * in the same order.
+ *
+ * With AVX-512 IFMA the Miller-Rabin rounds of numbers below 2^52 run 8 at a
+ * time, one per lane. Wider numbers, or any without it, go one by one.
+ */
+void primality_u64_batch(const uint64_t* n, bool* prime, size_t count)
+{
+  primality_u64_batch_isa(PRIMALITY_ISA_AUTO, n, prime, count);
+}
+
+// ---- Multi limb numbers, little endian 64 bit limbs ----
+
+struct bignum {
+  uint64_t limb[PRIMALITY_MAX_LIMBS];
+  size_t size;  // Limbs in use, the top one is not zero
+};
+
+// Montgomery arithmetic modulo an odd n with R = 2^(64 * size). All the
+// numbers below have exactly size limbs.
+struct bn_montgomery {
+  const uint64_t* n;
+  size_t size;
+  uint64_t ninv;  // -n^-1 mod 2^64
+  uint64_t one[PRIMALITY_MAX_LIMBS];  // R mod n
+};
+
+static int bn_cmp(const uint64_t* a, const uint64_t* b, size_t size)
+{
+  for (size_t k = size; k-- > 0;) {
+    if (a[k] != b[k])
+      return (a[k] < b[k] ? -1 : 1);
+  }
+  return 0;
+}
+
+static bool bn_is_zero(const uint64_t* a, size_t size)
+{
+  for (size_t k = 0; k < size; k++) {
+    if (a[k] != 0)
+      return false;
+  }
+  return true;
+}
+
+static bool bn_bit(const uint64_t* a, size_t bit)
+{
+  return (a[bit / 64] >> (bit % 64)) & 1;
+}
+
+static size_t bn_top_bit(const uint64_t* a, size_t size)
+{
+  return 64 * size - 1 - (size_t)__builtin_clzll(a[size - 1]);
+}
+
+static uint64_t bn_add(uint64_t* r,
+                       const uint64_t* a,
+                       const uint64_t* b,
+                       size_t size)
+{
+  uint64_t carry = 0;
+  for (size_t k = 0; k < size; k++) {
+    u128 sum = (u128)a[k] + b[k] + carry;
+    r[k] = (uint64_t)sum;
+    carry = (uint64_t)(sum >> 64);
+  }
+  return carry;
+}
+
+static uint64_t bn_sub(uint64_t* r,
+                       const uint64_t* a,
+                       const uint64_t* b,
+                       size_t size)
+{
+  uint64_t borrow = 0;
+  for (size_t k = 0; k < size; k++) {
+    u128 diff = (u128)a[k] - b[k] - borrow;
+    r[k] = (uint64_t)diff;
+    borrow = (uint64_t)(diff >> 64) & 1;
+  }
+  return borrow;
+}
+
+// r = a >> bits, for bits < 64
+static void bn_shr(uint64_t* r, const uint64_t* a, size_t size, int bits)
+{
+  if (bits == 0) {
+    memmove(r, a, size * sizeof(*a));
+    return;
+  }
+  for (size_t k = 0; k < size; k++) {
+    uint64_t high = (k + 1 < size ? a[k + 1] << (64 - bits) : 0);
+    r[k] = (a[k] >> bits) | high;
+  }
+}
+
+// r = a << bits, for bits < 64 that don't overflow
+static void bn_shl(uint64_t* r, const uint64_t* a, size_t size, int bits)
+{
+  if (bits == 0) {
+    memmove(r, a, size * sizeof(*a));
+    return;
+  }
+  for (size_t k = size; k-- > 0;) {
+    uint64_t low = (k > 0 ? a[k - 1] >> (64 - bits) : 0);
+    r[k] = (a[k] << bits) | low;
+  }
+}
+
+// a mod m, one 32 bit half at a time to stay within 64 bit divisions
+static uint32_t bn_mod_u32(const uint64_t* a, size_t size, uint32_t m)
+{
+  uint64_t r = 0;
+  for (size_t k = size; k-- > 0;) {
+    r = ((r << 32) | (a[k] >> 32)) % m;
+    r = ((r << 32) | (a[k] & 0xffffffff)) % m;
+  }
+  return (uint32_t)r;
+}
+
+static int bn_from_decimal(struct bignum* n, const char* digits, size_t size)
+{
+  // 10^19 is the largest power of ten that fits in a limb
+  static const uint64_t pow10[20] = {
+      1ULL,
+      10ULL,
+      100ULL,
+      1000ULL,
+      10000ULL,
+      100000ULL,
+      1000000ULL,
+      10000000ULL,
+      100000000ULL,
+      1000000000ULL,
+      10000000000ULL,
+      100000000000ULL,
+      1000000000000ULL,
+      10000000000000ULL,
+      100000000000000ULL,
+      1000000000000000ULL,
+      10000000000000000ULL,
+      100000000000000000ULL,
+      1000000000000000000ULL,
+      10000000000000000000ULL,
+  };
+
+  n->size = 0;
+  size_t chunk = (size % 19 != 0 ? size % 19 : 19);
+  for (size_t at = 0; at < size; at += chunk, chunk = 19) {
+    uint64_t carry = 0;
+    for (size_t k = 0; k < chunk; k++)
+      carry = carry * 10 + (uint64_t)(digits[at + k] - '0');
+
+    // n = n * 10^chunk + carry
+    for (size_t k = 0; k < n->size; k++) {
+      u128 p = (u128)n->limb[k] * pow10[chunk] + carry;
+      n->limb[k] = (uint64_t)p;
+      carry = (uint64_t)(p >> 64);
+    }
+    if (carry != 0) {
+      if (n->size == PRIMALITY_MAX_LIMBS)
+        return -1;
+      n->limb[n->size++] = carry;
+    }
+  }
+  return 0;
+}
+
+static void bn_montgomery_init(struct bn_montgomery* m, const struct bignum* n)
+{
+  size_t size = n->size;
+  uint64_t inv = n->limb[0];
+  for (int k = 0; k < 5; k++)
+    inv *= 2 - n->limb[0] * inv;
+  m->n = n->limb;
+  m->size = size;
+  m->ninv = -inv;
+
+  // R mod n by long division of R - n. The top limb of n has spare bits
+  // leading zeros, so R < 2^(spare + 1) * n and shifting n up to spare bits
+  // never overflows.
+  uint64_t shifted[PRIMALITY_MAX_LIMBS];
+  memset(m->one, 0, size * sizeof(uint64_t));
+  bn_sub(m->one, m->one, n->limb, size);
+  for (int bits = __builtin_clzll(n->limb[size - 1]); bits >= 0; bits--) {
+    bn_shl(shifted, n->limb, size, bits);
+    if (bn_cmp(m->one, shifted, size) >= 0)
+      bn_sub(m->one, m->one, shifted, size);
+  }
+}
+
+static void bn_mod_add(const struct bn_montgomery* m,
+                       uint64_t* r,
+                       const uint64_t* a,
+                       const uint64_t* b)
+{
+  if ((bn_add(r, a, b, m->size) != 0) || (bn_cmp(r, m->n, m->size) >= 0))
+    bn_sub(r, r, m->n, m->size);
+}
+
+static void bn_mod_sub(const struct bn_montgomery* m,
+                       uint64_t* r,
+                       const uint64_t* a,
+                       const uint64_t* b)
+{
+  if (bn_sub(r, a, b, m->size) != 0)
+    bn_add(r, r, m->n, m->size);
+}
+
+// Coarsely integrated operand scanning, a * b * R^-1 mod n. r may alias a or b
+static void bn_mont_mul(const struct bn_montgomery* m,
+                        uint64_t* r,
+                        const uint64_t* a,
+                        const uint64_t* b)
+{
+  size_t size = m->size;
+  const uint64_t* n = m->n;
+  uint64_t t[PRIMALITY_MAX_LIMBS + 2];
+
+  memset(t, 0, (size + 2) * sizeof(*t));
+  for (size_t i = 0; i < size; i++) {
+    uint64_t carry = 0;
+    for (size_t j = 0; j < size; j++) {
+      u128 p = (u128)a[j] * b[i] + t[j] + carry;
+      t[j] = (uint64_t)p;
+      carry = (uint64_t)(p >> 64);
+    }
+    u128 sum = (u128)t[size] + carry;
+    t[size] = (uint64_t)sum;
+    t[size + 1] = (uint64_t)(sum >> 64);
+
+    // Adding q * n clears the low limb, which is then shifted out
+    uint64_t q = t[0] * m->ninv;
+    u128 p = (u128)q * n[0] + t[0];
+    carry = (uint64_t)(p >> 64);
+    for (size_t j = 1; j < size; j++) {
+      p = (u128)q * n[j] + t[j] + carry;
+      t[j - 1] = (uint64_t)p;
+      carry = (uint64_t)(p >> 64);
+    }
+    sum = (u128)t[size] + carry;
+    t[size - 1] = (uint64_t)sum;
+    t[size] = t[size + 1] + (uint64_t)(sum >> 64);
+    t[size + 1] = 0;
+  }
+
+  // t < 2n
+  if ((t[size] != 0) || (bn_cmp(t, n, size) >= 0))
+    bn_sub(t, t, n, size);
+  memcpy(r, t, size * sizeof(*r));
+}
+
+// Montgomery form of a small integer, by doubling and adding R mod n
+static void bn_mont_small(const struct bn_montgomery* m,
+                          uint64_t* r,
+                          uint64_t c)
+{
+  memset(r, 0, m->size * sizeof(*r));
+  for (int bit = 63 - __builtin_clzll(c); bit >= 0; bit--) {
+    bn_mod_add(m, r, r, r);
+    if ((c >> bit) & 1)
+      bn_mod_add(m, r, r, m->one);
+  }
+}
+
+// Strong probable prime test to base 2
+static bool bn_miller_rabin_2(const struct bn_montgomery* m)
+{
+  size_t size = m->size;
+  uint64_t x[PRIMALITY_MAX_LIMBS], minus_one[PRIMALITY_MAX_LIMBS];
+
+  // n - 1 = d * 2^s, n is odd so both share all the bits above the lowest
+  size_t s = 1;
+  while (!bn_bit(m->n, s))
+    s++;
+
+  // 2^d, multiplying by 2 is just a modular addition
+  memcpy(x, m->one, size * sizeof(*x));
+  for (size_t bit = bn_top_bit(m->n, size) + 1; bit-- > s;) {
+    bn_mont_mul(m, x, x, x);
+    if (bn_bit(m->n, bit))
+      bn_mod_add(m, x, x, x);
+  }
+
+  bn_sub(minus_one, m->n, m->one, size);
+  if ((bn_cmp(x, m->one, size) == 0) || (bn_cmp(x, minus_one, size) == 0))
+    return true;
+  for (size_t k = 1; k < s; k++) {
+    bn_mont_mul(m, x, x, x);
+    if (bn_cmp(x, minus_one, size) == 0)
+      return true;
+  }
+  return false;
+}
+
+static int jacobi_u64(uint64_t a, uint64_t n)
+{
+  int t = 1;
+  a %= n;
+  while (a != 0) {
+    while ((a & 1) == 0) {
+      a >>= 1;
+      if (((n & 7) == 3) || ((n & 7) == 5))
+        t = -t;
+    }
+    uint64_t tmp = a;
+    a = n;
+    n = tmp;
+    if (((a & 3) == 3) && ((n & 3) == 3))
+      t = -t;
+    a %= n;
+  }
+  return (n == 1 ? t : 0);
+}
+
+// Jacobi symbol (d / n) for a small positive d
+static int bn_jacobi(uint64_t d, const struct bignum* n)
+{
+  int t = 1;
+  uint64_t n8 = n->limb[0] & 7;
+  while ((d & 1) == 0) {
+    d >>= 1;
+    if ((n8 == 3) || (n8 == 5))
+      t = -t;
+  }
+  // Reciprocity, (d / n) = (n / d) unless both are 3 mod 4
+  if (((d & 3) == 3) && ((n8 & 3) == 3))
+    t = -t;
+  return t * jacobi_u64(bn_mod_u32(n->limb, n->size, (uint32_t)d), d);
+}
+
+// Bit by bit integer square root
+static bool bn_is_square(const struct bignum* n)
+{
+  size_t size = n->size;
+  uint64_t x[PRIMALITY_MAX_LIMBS], root[PRIMALITY_MAX_LIMBS] = {0};
+  uint64_t bit[PRIMALITY_MAX_LIMBS] = {0}, t[PRIMALITY_MAX_LIMBS];
+
+  memcpy(x, n->limb, size * sizeof(*x));
+  size_t top = bn_top_bit(n->limb, size) & ~(size_t)1;
+  bit[top / 64] = 1ULL << (top % 64);
+  while (!bn_is_zero(bit, size)) {
+    bn_add(t, root, bit, size);
+    bn_shr(root, root, size, 1);
+    if (bn_cmp(x, t, size) >= 0) {
+      bn_sub(x, x, t, size);
+      bn_add(root, root, bit, size);
+    }
+    bn_shr(bit, bit, size, 2);
+  }
+  return bn_is_zero(x, size);
+}
+
+// Extra strong Lucas probable prime test with Baillie's parameters: Q = 1 and
+// the first P in 3, 4, 5, ... with (P^2 - 4 / n) = -1. Only V is needed, so
+// the ladder takes two products per bit.
+static bool bn_lucas(const struct bn_montgomery* m, const struct bignum* n)
+{
+  size_t size = m->size;
+  uint64_t p = 3;
+  for (int tries = 1;; tries++, p++) {
+    int j = bn_jacobi(p * p - 4, n);
+    if (j == -1)
+      break;
+    // n is wider than any P^2 - 4, so a common factor makes it composite
+    if (j == 0)
+      return false;
+    if ((tries == PRIMALITY_LUCAS_SQUARE_CHECK) && bn_is_square(n))
+      return false;
+  }
+
+  uint64_t mp[PRIMALITY_MAX_LIMBS], two[PRIMALITY_MAX_LIMBS];
+  uint64_t v[PRIMALITY_MAX_LIMBS], w[PRIMALITY_MAX_LIMBS];
+  uint64_t np1[PRIMALITY_MAX_LIMBS];
+  bn_mont_small(m, mp, p);
+  bn_mod_add(m, two, m->one, m->one);
+
+  // n + 1 = d * 2^s. It can't overflow, 2^(64 * size) - 1 is a multiple of 3
+  uint64_t one[PRIMALITY_MAX_LIMBS] = {1};
+  uint64_t carry = bn_add(np1, n->limb, one, size);
+  assert(carry == 0);
+  (void)carry;
+  size_t s = 1;
+  while (!bn_bit(np1, s))
+    s++;
+
+  // (v, w) = (V_k, V_k+1) from k = 0, walking down the bits of d with
+  // V_2k = V_k^2 - 2 and V_2k+1 = V_k V_k+1 - P
+  memcpy(v, two, size * sizeof(*v));
+  memcpy(w, mp, size * sizeof(*w));
+  for (size_t bit = bn_top_bit(np1, size) + 1; bit-- > s;) {
+    if (bn_bit(np1, bit)) {
+      bn_mont_mul(m, v, v, w);
+      bn_mod_sub(m, v, v, mp);
+      bn_mont_mul(m, w, w, w);
+      bn_mod_sub(m, w, w, two);
+    } else {
+      bn_mont_mul(m, w, v, w);
+      bn_mod_sub(m, w, w, mp);
+      bn_mont_mul(m, v, v, v);
+      bn_mod_sub(m, v, v, two);
+    }
+  }
+
+  // U_d = 0 when 2 V_d+1 = P V_d, as D U_k = 2 V_k+1 - P V_k
+  uint64_t minus_two[PRIMALITY_MAX_LIMBS];
+  bn_sub(minus_two, m->n, two, size);
+  if ((bn_cmp(v, two, size) == 0) || (bn_cmp(v, minus_two, size) == 0)) {
+    bn_mod_add(m, w, w, w);
+    bn_mont_mul(m, mp, mp, v);
+    if (bn_cmp(w, mp, size) == 0)
+      return true;
+  }
+  for (size_t k = 0; k + 1 < s; k++) {
+    if (bn_is_zero(v, size))
+      return true;
+    bn_mont_mul(m, v, v, v);
+    bn_mod_sub(m, v, v, two);
+  }
+  return false;
+}
+
+// Baillie-PSW for an odd n wider than 64 bits
+static bool bn_baillie_psw(const struct bignum* n)
+{
+  // Products of consecutive small primes that fit in 32 bits, one pass over
+  // the limbs each. 2 is left to the caller.
+  for (size_t k = 1; k < PRIMALITY_SMALL_PRIMES;) {
+    size_t first = k;
+    uint64_t product = 1;
+    while ((k < PRIMALITY_SMALL_PRIMES)
+           && (product * primality_small_primes[k] <= UINT32_MAX))
+      product *= primality_small_primes[k++];
+    uint32_t r = bn_mod_u32(n->limb, n->size, (uint32_t)product);
+    for (size_t p = first; p < k; p++) {
+      if (r % primality_small_primes[p] == 0)
+        return false;
+    }
+  }
+
+  struct bn_montgomery m;
+  bn_montgomery_init(&m, n);
+  return bn_miller_rabin_2(&m) && bn_lucas(&m, n);
+}
+
+/**
+ * @brief Primality of a non negative decimal integer literal of any length up
+ * to PRIMALITY_MAX_DIGITS.
+ *
+ * Numbers that fit in 64 bits get the deterministic test, wider ones
+ * Baillie-PSW, which has no known counterexample.
+ *
+ * @return 0 with the answer in prime, -1 if the literal is too long.
+ */
+int primality_decimal(const char* digits, size_t size, bool* prime)
+{
+  assert(digits != NULL);
+  assert(size > 0);
+  assert(prime != NULL);
+
+  while ((size > 1) && (*digits == '0')) {
+    digits++;
+    size--;
+  }
+  if (size > PRIMALITY_MAX_DIGITS)
+    return -1;
+
+  // No prime past 5 ends with an even digit or a 5
+  int last = digits[size - 1] - '0';
+  if ((size > 1) && ((last % 2 == 0) || (last == 5))) {
+    *prime = false;
+    return 0;
+  }
+
+  struct bignum n;
+  if (bn_from_decimal(&n, digits, size) == -1)
+    return -1;
+  if (n.size <= 1)
+    *prime = primality_u64(n.size == 1 ? n.limb[0] : 0);
+  else
+    *prime = bn_baillie_psw(&n);
+  return 0;
+}
@@ -0,0 +1,39 @@
+#ifndef INCLUDE_PRIME_TIME_PRIMALITY_H_
+#define INCLUDE_PRIME_TIME_PRIMALITY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Widest number primality_decimal takes, 2048 bits
+#define PRIMALITY_MAX_LIMBS 32
+// Any decimal literal up to this length fits in PRIMALITY_MAX_LIMBS limbs
+#define PRIMALITY_MAX_DIGITS 616
+
+// Numbers primality_u64_batch keeps in flight, larger batches go in chunks
+#define PRIMALITY_BATCH 64
+// Numbers the vector kernel checks side by side, one 512 bit register
+#define PRIMALITY_IFMA_LANES 8
+
+#define PRIMALITY_ISA_AUTO 0  // Best one the CPU supports
+#define PRIMALITY_ISA_SCALAR 1
+#define PRIMALITY_ISA_AVX512IFMA 2  // Numbers below 2^52 only
+
+bool primality_u64(uint64_t n);
+bool primality_trial_division(uint64_t n);
+void primality_u64_batch(const uint64_t* n, bool* prime, size_t count);
+void primality_u64_batch_isa(int isa,
+                             const uint64_t* n,
+                             bool* prime,
+                             size_t count);
+int primality_isa(void);
+int primality_decimal(const char* digits, size_t size, bool* prime);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // INCLUDE_PRIME_TIME_PRIMALITY_H_
@@ -0,0 +1,297 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "prime-time/prime-cache.h"
+#include "prime-time/primality.h"
+
+// A wide number, checked or being checked
+struct prime_cache_entry {
+  uint64_t hash;
+  size_t size;
+  bool done;
+  bool prime;
+  struct prime_cache_waiter* waiters;  // Joined while not done
+  int32_t chain;  // Next entry in the same bucket, -1 for none
+  int32_t newer;  // Recency list, -1 at either end
+  int32_t older;
+  char digits[PRIMALITY_MAX_DIGITS];
+};
+
+// Numbers that fit in 64 bits live in one word each, (n << 1) | prime, so a
+// lookup racing an update sees either the old or the new number, never half
+// of both. 0 is empty, it is never cached. Hits don't touch the set, so a
+// number every worker asks about doesn't bounce its cache line between
+// them, and the oldest insert is the one evicted.
+//
+// Wider numbers are looked up under a lock, they take far longer to check
+// than to find. Only one check per number runs at a time, the rest wait
+// for its result.
+struct prime_cache {
+  _Atomic uint64_t words[PRIME_CACHE_SETS * PRIME_CACHE_WAYS];
+
+  pthread_mutex_t lock;
+  int32_t buckets[PRIME_CACHE_BUCKETS];
+  int32_t newest;
+  int32_t oldest;
+  int32_t used;  // Leading entries ever taken
+  struct prime_cache_entry entries[PRIME_CACHE_ENTRIES];
+};
+
+static size_t prime_cache_set(uint64_t n)
+{
+  // Fibonacci hashing, the low bits are the worst mixed
+  return (size_t)((n * 0x9E3779B97F4A7C15ULL) >> 32) & (PRIME_CACHE_SETS - 1);
+}
+
+// FNV-1a
+static uint64_t prime_cache_hash(const char* digits, size_t size)
+{
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (size_t k = 0; k < size; k++)
+    h = (h ^ (unsigned char)digits[k]) * 0x100000001b3ULL;
+  return h;
+}
+
+/**
+ * @brief Creates an empty cache.
+ *
+ * @return 0 on success, -1 when out of memory.
+ */
+int prime_cache_init(struct prime_cache** pc)
+{
+  assert(*pc == NULL);
+
+  struct prime_cache* c = calloc(1, sizeof(struct prime_cache));
+  if (c == NULL)
+    return -1;
+  pthread_mutex_init(&c->lock, NULL);
+  for (size_t k = 0; k < PRIME_CACHE_BUCKETS; k++)
+    c->buckets[k] = -1;
+  c->newest = -1;
+  c->oldest = -1;
+  *pc = c;
+  return 0;
+}
+
+/// Nobody may be waiting on it anymore
+void prime_cache_free(struct prime_cache** pc)
+{
+  assert(*pc != NULL);
+
+  pthread_mutex_destroy(&(*pc)->lock);
+  free(*pc);
+  *pc = NULL;
+}
+
+/**
+ * @brief Looks n up.
+ *
+ * @return true if it was there, its primality is in *prime then.
+ */
+bool prime_cache_get(struct prime_cache* c, uint64_t n, bool* prime)
+{
+  assert(c != NULL);
+  assert(prime != NULL);
+
+  _Atomic uint64_t* set = &c->words[prime_cache_set(n) * PRIME_CACHE_WAYS];
+  for (size_t k = 0; k < PRIME_CACHE_WAYS; k++) {
+    uint64_t word = atomic_load_explicit(&set[k], memory_order_relaxed);
+    if ((word >> 1) == n) {
+      *prime = (word & 1) != 0;
+      return true;
+    }
+  }
+  return false;
+}
+
+/// Remembers the primality of n, which must be below 2^63 and not 0
+void prime_cache_put(struct prime_cache* c, uint64_t n, bool prime)
+{
+  assert(c != NULL);
+  assert(n != 0 && n < (1ULL << 63));
+
+  // Newest first, the oldest falls off the end
+  _Atomic uint64_t* set = &c->words[prime_cache_set(n) * PRIME_CACHE_WAYS];
+  for (size_t k = PRIME_CACHE_WAYS - 1; k > 0; k--)
+    atomic_store_explicit(
+        &set[k],
+        atomic_load_explicit(&set[k - 1], memory_order_relaxed),
+        memory_order_relaxed);
+  atomic_store_explicit(&set[0], (n << 1) | prime, memory_order_relaxed);
+}
+
+static struct prime_cache_entry* prime_cache_find(struct prime_cache* c,
+                                                  uint64_t hash,
+                                                  const char* digits,
+                                                  size_t size)
+{
+  int32_t i = c->buckets[hash & (PRIME_CACHE_BUCKETS - 1)];
+  for (; i != -1; i = c->entries[i].chain) {
+    struct prime_cache_entry* e = &c->entries[i];
+    if ((e->hash == hash) && (e->size == size)
+        && (memcmp(e->digits, digits, size) == 0))
+      return e;
+  }
+  return NULL;
+}
+
+static void prime_cache_unlink(struct prime_cache* c, int32_t i)
+{
+  struct prime_cache_entry* e = &c->entries[i];
+  if (e->newer != -1)
+    c->entries[e->newer].older = e->older;
+  else
+    c->newest = e->older;
+  if (e->older != -1)
+    c->entries[e->older].newer = e->newer;
+  else
+    c->oldest = e->newer;
+}
+
+static void prime_cache_touch(struct prime_cache* c, int32_t i)
+{
+  if (c->newest == i)
+    return;
+  prime_cache_unlink(c, i);
+  struct prime_cache_entry* e = &c->entries[i];
+  e->newer = -1;
+  e->older = c->newest;
+  if (c->newest != -1)
+    c->entries[c->newest].newer = i;
+  c->newest = i;
+  if (c->oldest == -1)
+    c->oldest = i;
+}
+
+// Takes a never used entry, or evicts the least recently used one that is
+// done. -1 if every entry is still being checked.
+static int32_t prime_cache_evict(struct prime_cache* c)
+{
+  if (c->used < PRIME_CACHE_ENTRIES)
+    return c->used++;
+
+  int32_t i = c->oldest;
+  while ((i != -1) && !c->entries[i].done)
+    i = c->entries[i].newer;
+  if (i == -1)
+    return -1;
+
+  struct prime_cache_entry* e = &c->entries[i];
+  int32_t* link = &c->buckets[e->hash & (PRIME_CACHE_BUCKETS - 1)];
+  while (*link != i)
+    link = &c->entries[*link].chain;
+  *link = e->chain;
+  prime_cache_unlink(c, i);
+  return i;
+}
+
+static struct prime_cache_entry* prime_cache_insert(struct prime_cache* c,
+                                                    uint64_t hash,
+                                                    const char* digits,
+                                                    size_t size)
+{
+  int32_t i = prime_cache_evict(c);
+  if (i == -1)
+    return NULL;
+
+  struct prime_cache_entry* e = &c->entries[i];
+  e->hash = hash;
+  e->size = size;
+  memcpy(e->digits, digits, size);
+  e->done = false;
+  e->waiters = NULL;
+  int32_t* bucket = &c->buckets[hash & (PRIME_CACHE_BUCKETS - 1)];
+  e->chain = *bucket;
+  *bucket = i;
+
+  // Linked as the newest
+  e->newer = -1;
+  e->older = c->newest;
+  if (c->newest != -1)
+    c->entries[c->newest].newer = i;
+  c->newest = i;
+  if (c->oldest == -1)
+    c->oldest = i;
+  return e;
+}
+
+/**
+ * @brief Looks a decimal literal up, and if nobody is checking it yet
+ * records that the caller is about to.
+ *
+ * @param waiter Joins a check already running when not NULL, the caller
+ * has to check the number itself otherwise.
+ * @return PRIME_CACHE_HIT with the result in *prime, PRIME_CACHE_JOINED
+ * when waiter is going to get woken with it, PRIME_CACHE_MISS when the
+ * caller has to check it and hand the result to prime_cache_done.
+ */
+int prime_cache_join(struct prime_cache* c,
+                     const char* digits,
+                     size_t size,
+                     struct prime_cache_waiter* waiter,
+                     bool* prime)
+{
+  assert(c != NULL);
+  assert(digits != NULL);
+  assert(size > 0 && size <= PRIMALITY_MAX_DIGITS);
+  assert(prime != NULL);
+
+  uint64_t hash = prime_cache_hash(digits, size);
+  int res = PRIME_CACHE_MISS;
+  pthread_mutex_lock(&c->lock);
+  struct prime_cache_entry* e = prime_cache_find(c, hash, digits, size);
+  if (e == NULL) {
+    // Not tracked when full of running checks, the result still gets in
+    prime_cache_insert(c, hash, digits, size);
+  } else if (e->done) {
+    *prime = e->prime;
+    prime_cache_touch(c, (int32_t)(e - c->entries));
+    res = PRIME_CACHE_HIT;
+  } else if (waiter != NULL) {
+    waiter->next = e->waiters;
+    e->waiters = waiter;
+    res = PRIME_CACHE_JOINED;
+  }
+  pthread_mutex_unlock(&c->lock);
+  return res;
+}
+
+/**
+ * @brief Records the primality of a decimal literal and wakes whoever
+ * joined its check.
+ *
+ * Any check of the same number may complete it, they all agree.
+ */
+void prime_cache_done(struct prime_cache* c,
+                      const char* digits,
+                      size_t size,
+                      bool prime)
+{
+  assert(c != NULL);
+  assert(digits != NULL);
+  assert(size > 0 && size <= PRIMALITY_MAX_DIGITS);
+
+  uint64_t hash = prime_cache_hash(digits, size);
+  struct prime_cache_waiter* waiters = NULL;
+  pthread_mutex_lock(&c->lock);
+  struct prime_cache_entry* e = prime_cache_find(c, hash, digits, size);
+  if (e == NULL)
+    e = prime_cache_insert(c, hash, digits, size);
+  if (e != NULL) {
+    waiters = e->waiters;
+    e->waiters = NULL;
+    e->prime = prime;
+    e->done = true;
+  }
+  pthread_mutex_unlock(&c->lock);
+
+  struct prime_cache_waiter* next;
+  for (struct prime_cache_waiter* w = waiters; w != NULL; w = next) {
+    next = w->next;
+    w->wake(w, prime);
+  }
+}
@@ -0,0 +1,51 @@
+#ifndef INCLUDE_PRIME_TIME_PRIME_CACHE_H_
+#define INCLUDE_PRIME_TIME_PRIME_CACHE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Numbers that fit in 64 bits, 4 ways per set, 128 KiB
+#define PRIME_CACHE_SETS 4096  // Power of 2
+#define PRIME_CACHE_WAYS 4
+// Wider numbers, each entry holds up to PRIMALITY_MAX_DIGITS
+#define PRIME_CACHE_ENTRIES 1024
+#define PRIME_CACHE_BUCKETS 2048  // Power of 2
+
+// What prime_cache_join found
+#define PRIME_CACHE_MISS 0  // Check it and hand the result to prime_cache_done
+#define PRIME_CACHE_HIT 1  // The result is in *prime
+#define PRIME_CACHE_JOINED 2  // Being checked, the waiter gets woken with it
+
+// Results of recent checks shared by every thread, see prime-cache.c
+struct prime_cache;
+
+// Waits for a check someone else is running, see prime_cache_join
+struct prime_cache_waiter {
+  // Called once the result is in, on the thread calling prime_cache_done
+  void (*wake)(struct prime_cache_waiter* w, bool prime);
+  struct prime_cache_waiter* next;
+};
+
+int prime_cache_init(struct prime_cache** pc);
+void prime_cache_free(struct prime_cache** pc);
+bool prime_cache_get(struct prime_cache* c, uint64_t n, bool* prime);
+void prime_cache_put(struct prime_cache* c, uint64_t n, bool prime);
+int prime_cache_join(struct prime_cache* c,
+                     const char* digits,
+                     size_t size,
+                     struct prime_cache_waiter* waiter,
+                     bool* prime);
+void prime_cache_done(struct prime_cache* c,
+                      const char* digits,
+                      size_t size,
+                      bool prime);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // INCLUDE_PRIME_TIME_PRIME_CACHE_H_
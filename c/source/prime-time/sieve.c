@@ -0,0 +1,296 @@
+#define _GNU_SOURCE
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "log/log.h"
+#include "prime-time/sieve.h"
+
+struct sieve_job {
+  uint64_t* bits;
+  uint64_t limit;
+  const uint32_t* primes;  // Odd ones up to the square root of limit
+  size_t nprimes;
+  atomic_size_t next;  // Next segment up for grabs
+};
+
+// Odd primes up to max with a plain sieve, *nprimes of them
+static uint32_t* sieve_base_primes(uint32_t max, size_t* nprimes)
+{
+  char* composite = calloc((size_t)max + 1, 1);
+  uint32_t* primes = malloc(((size_t)max / 2 + 1) * sizeof(uint32_t));
+  if ((composite == NULL) || (primes == NULL)) {
+    free(composite);
+    free(primes);
+    return NULL;
+  }
+
+  size_t n = 0;
+  for (uint32_t p = 3; p <= max; p += 2) {
+    if (composite[p])
+      continue;
+    primes[n++] = p;
+    for (uint64_t m = (uint64_t)p * p; m <= max; m += 2 * p)
+      composite[m] = 1;
+  }
+  free(composite);
+  *nprimes = n;
+  return primes;
+}
+
+// Clears the odd multiples of every base prime in bits [lo, hi)
+static void sieve_segment(struct sieve_job* job, uint64_t lo, uint64_t hi)
+{
+  uint64_t* bits = job->bits;
+  uint64_t first = 2 * lo + 1;
+  uint64_t last = 2 * hi + 1;
+  for (size_t k = 0; k < job->nprimes; k++) {
+    uint64_t p = job->primes[k];
+    uint64_t m = p * p;
+    if (m >= last)
+      break;
+    if (m < first) {
+      m = (first + p - 1) / p * p;
+      if ((m & 1) == 0)
+        m += p;
+    }
+    for (uint64_t i = m >> 1; i < hi; i += p)
+      bits[i >> 6] &= ~(1ULL << (i & 63));
+  }
+}
+
+static void* sieve_worker(void* arg)
+{
+  struct sieve_job* job = arg;
+  uint64_t nbits = job->limit / 2;
+  size_t segment;
+  while ((segment = atomic_fetch_add(&job->next, 1))
+         < (nbits + SIEVE_SEGMENT_BITS - 1) / SIEVE_SEGMENT_BITS)
+  {
+    uint64_t lo = (uint64_t)segment * SIEVE_SEGMENT_BITS;
+    uint64_t hi = lo + SIEVE_SEGMENT_BITS;
+    if (hi > nbits)
+      hi = nbits;
+    memset(job->bits + lo / 64, 0xff, (hi - lo) / 8);
+    sieve_segment(job, lo, hi);
+  }
+  return NULL;
+}
+
+/**
+ * @brief Fills bits with the primality of the odd numbers below limit.
+ *
+ * Segments of SIEVE_SEGMENT_BITS are sieved by up to threads threads.
+ * limit must be a multiple of SIEVE_WORD_NUMBERS.
+ *
+ * @return 0 on success, -1 when out of memory.
+ */
+int sieve_build(uint64_t* bits, uint64_t limit, int threads)
+{
+  assert(bits != NULL);
+  assert(limit > 0 && limit % SIEVE_WORD_NUMBERS == 0);
+
+  uint32_t root = 1;
+  while ((uint64_t)root * root < limit)
+    root++;
+
+  struct sieve_job job = {.bits = bits, .limit = limit};
+  atomic_init(&job.next, 0);
+  uint32_t* primes = sieve_base_primes(root, &job.nprimes);
+  if (primes == NULL)
+    return -1;
+  job.primes = primes;
+
+  pthread_t workers[threads > 1 ? threads - 1 : 1];
+  int started = 0;
+  for (; started < threads - 1; started++) {
+    if (pthread_create(&workers[started], NULL, sieve_worker, &job) != 0)
+      break;
+  }
+  sieve_worker(&job);
+  for (int k = 0; k < started; k++)
+    pthread_join(workers[k], NULL);
+
+  bits[0] &= ~1ULL;  // 1 is not prime
+  free(primes);
+  return 0;
+}
+
+static size_t sieve_map_size(uint64_t limit)
+{
+  return SIEVE_HEADER_SIZE + (size_t)(limit / 8 / 2);
+}
+
+// Whether the file is ours alone, nobody else could have put bad bits in it
+static bool sieve_trusted(const struct stat* st)
+{
+  return S_ISREG(st->st_mode) && (st->st_uid == geteuid())
+      && ((st->st_mode & (S_IWGRP | S_IWOTH)) == 0);
+}
+
+// Maps an existing cache file, -1 if it isn't there, doesn't match limit or
+// isn't to be trusted
+static int sieve_load(struct sieve* s, const char* path, uint64_t limit)
+{
+  int fd = open(path, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+  if (fd < 0)
+    return -1;
+
+  struct stat st;
+  size_t size = sieve_map_size(limit);
+  void* map = MAP_FAILED;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return -1;
+  }
+  if (!sieve_trusted(&st)) {
+    log_warn("sieve_load: '%s' is writable by others, ignoring it", path);
+    close(fd);
+    return -1;
+  }
+  if ((size_t)st.st_size == size)
+    map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return -1;
+
+  uint64_t stored;
+  memcpy(&stored, (char*)map + sizeof(SIEVE_MAGIC) - 1, sizeof(stored));
+  if ((memcmp(map, SIEVE_MAGIC, sizeof(SIEVE_MAGIC) - 1) != 0)
+      || (stored != limit))
+  {
+    munmap(map, size);
+    return -1;
+  }
+
+  s->map = map;
+  s->map_size = size;
+  s->bits = (const uint64_t*)((char*)map + SIEVE_HEADER_SIZE);
+  s->limit = limit;
+  return 0;
+}
+
+// Sieves into a fresh file and moves it to path once complete, so that a
+// crash half way never leaves a bad cache behind
+static int sieve_create(struct sieve* s,
+                        const char* path,
+                        uint64_t limit,
+                        int threads)
+{
+  char tmp[PATH_MAX];
+  if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= (int)sizeof(tmp))
+    return -1;
+  int fd = mkostemp(tmp, O_CLOEXEC);
+  if (fd < 0) {
+    log_warn("sieve_create: cannot create '%s': %s", tmp, strerror(errno));
+    return -1;
+  }
+
+  // Left private as mkostemp makes it, only its owner maps it again
+  size_t size = sieve_map_size(limit);
+  void* map = MAP_FAILED;
+  if (ftruncate(fd, (off_t)size) == 0)
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    log_warn("sieve_create: cannot map '%s': %s", tmp, strerror(errno));
+    unlink(tmp);
+    return -1;
+  }
+
+  uint64_t* bits = (uint64_t*)((char*)map + SIEVE_HEADER_SIZE);
+  if (sieve_build(bits, limit, threads) != 0) {
+    munmap(map, size);
+    unlink(tmp);
+    return -1;
+  }
+  memcpy(map, SIEVE_MAGIC, sizeof(SIEVE_MAGIC) - 1);
+  memcpy((char*)map + sizeof(SIEVE_MAGIC) - 1, &limit, sizeof(limit));
+  mprotect(map, size, PROT_READ);
+  if (rename(tmp, path) != 0) {
+    // Still good for this process, the next one builds it again
+    log_warn("sieve_create: cannot rename to '%s': %s", path, strerror(errno));
+    unlink(tmp);
+  }
+
+  s->map = map;
+  s->map_size = size;
+  s->bits = bits;
+  s->limit = limit;
+  return 0;
+}
+
+/**
+ * @brief Maps the sieve cached at path, building and caching it first if
+ * needed.
+ *
+ * The mapping is shared, every process using the same file shares its pages.
+ * A file owned by someone else or writable by others is never mapped, it is
+ * replaced by a fresh one.
+ *
+ * @return 0 on success, -1 if the sieve is not available.
+ */
+int sieve_open(struct sieve* s, const char* path, uint64_t limit, int threads)
+{
+  assert(s != NULL);
+  assert(path != NULL);
+
+  if (sieve_load(s, path, limit) == 0) {
+    log_info("sieve_open: mapped '%s'", path);
+    return 0;
+  }
+
+  log_info("sieve_open: building '%s' with %d threads", path, threads);
+  return sieve_create(s, path, limit, threads);
+}
+
+/**
+ * @brief Writes where this user's sieve is cached to path.
+ *
+ * That is $XDG_CACHE_HOME or ~/.cache, created if missing, and /tmp with the
+ * uid in the name when neither is usable.
+ */
+void sieve_cache_path(char* path, size_t size)
+{
+  assert(path != NULL);
+
+  const char* cache = getenv("XDG_CACHE_HOME");
+  const char* home = getenv("HOME");
+  char dir[PATH_MAX];
+  int n = -1;
+  if ((cache != NULL) && (cache[0] == '/'))
+    n = snprintf(dir, sizeof(dir), "%s", cache);
+  else if ((home != NULL) && (home[0] == '/'))
+    n = snprintf(dir, sizeof(dir), "%s/.cache", home);
+
+  if ((n > 0) && (n < (int)sizeof(dir))
+      && ((mkdir(dir, 0700) == 0) || (errno == EEXIST)))
+  {
+    n = snprintf(path, size, "%s/%s", dir, SIEVE_FILE);
+    if ((n > 0) && ((size_t)n < size))
+      return;
+  }
+  snprintf(path, size, "/tmp/%u-%s", (unsigned)geteuid(), SIEVE_FILE);
+}
+
+void sieve_close(struct sieve* s)
+{
+  assert(s != NULL);
+
+  if (s->map != NULL)
+    munmap(s->map, s->map_size);
+  s->map = NULL;
+  s->bits = NULL;
+  s->limit = 0;
+}
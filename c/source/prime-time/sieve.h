@@ -0,0 +1,50 @@
+#ifndef INCLUDE_PRIME_TIME_SIEVE_H_
+#define INCLUDE_PRIME_TIME_SIEVE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Every number below 2^32, 256 MiB of bits
+#define SIEVE_LIMIT_32 (1ULL << 32)
+// Numbers per word, only odd ones get a bit
+#define SIEVE_WORD_NUMBERS 128
+// Bits sieved at once by a thread, 32 KiB fit in L1
+#define SIEVE_SEGMENT_BITS (32 * 1024 * 8)
+// The cache file starts with a header, the bitmap follows cache line aligned
+#define SIEVE_HEADER_SIZE 64
+#define SIEVE_MAGIC "NXSIEVE1"
+// Name of the cache file, see sieve_cache_path
+#define SIEVE_FILE "network-exercises-prime-time.sieve"
+
+// Primality of every number below limit. Bit i of the bitmap is set when
+// 2i + 1 is prime.
+struct sieve {
+  const uint64_t* bits;
+  uint64_t limit;
+  void* map;  // Whole mapping, header included
+  size_t map_size;
+};
+
+int sieve_build(uint64_t* bits, uint64_t limit, int threads);
+int sieve_open(struct sieve* s, const char* path, uint64_t limit, int threads);
+void sieve_cache_path(char* path, size_t size);
+void sieve_close(struct sieve* s);
+
+/// Whether n is prime, n must be below the sieve's limit
+static inline bool sieve_test(const struct sieve* s, uint64_t n)
+{
+  if ((n & 1) == 0)
+    return (n == 2);
+  uint64_t i = n >> 1;
+  return ((s->bits[i >> 6] >> (i & 63)) & 1) != 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // INCLUDE_PRIME_TIME_SIEVE_H_
@@ -1,6 +1,5 @@
 #define _POSIX_C_SOURCE 200112L
 
-#include <assert.h>
 #include <fcntl.h>
 #include <netdb.h>
 #include <stdarg.h>
@@ -16,8 +15,9 @@
 #include <stdatomic.h>
 
 #include "log/log.h"
-#include "utils/epoll.h"
-#include "utils/queue.h"
+#include "utils/reactor.h"
+#include "utils/ring.h"
+#include "utils/server.h"
 #include "utils/sockets.h"
 #include "utils/utils.h"
 
@@ -25,113 +25,86 @@
 #define LOG_FILE_MODE "w"
 #define LOG_LEVEL 0  // TRACE
 
-#define QUEUE_CAPACITY 65536  //  1024 * 64
+#define RING_CAPACITY 65536  //  1024 * 64
 
-#define MAX_NUM_CON 10
-#define MAX_EVENTS 10
+#define MAX_EVENTS 64
 #define PORT "18888"
 
-int main()
+int echo_on_data(struct reactor_conn* conn)
 {
-  FILE* log_fd = NULL;
-  int listen_fd;
-
-  if ((log_fd = fopen(LOG_FILE, LOG_FILE_MODE)) == NULL) {
-    fprintf(stderr, "Cannot open log file\n");
-    exit(EXIT_FAILURE);
+  struct ring* rg = conn->reactor->udata;
+
+  log_trace("echo_on_data: handling POLLIN event on fd '%d'", conn->fd);
+  int res = reactor_recv(conn, rg);
+  int size = (int)rg->size;
+  char* data = ring_read_ptr(rg);
+  // Shared by the whole worker, reactor_send copies what it cannot send
+  ring_reset(rg);
+
+  // Handle error case while recv data
+  if (res < -1)
+    return REACTOR_CLOSE;
+
+  // Handle there's data to echo back
+  if (size > 0) {
+    int nbytes = size;
+    if (reactor_send(conn, data, &size) != 0) {
+      log_error("echo_on_data: sending data on fd '%d'", conn->fd);
+      return REACTOR_KEEP;
+    }
+    if (nbytes != size) {
+      log_error("echo_on_data: Expected to send: '%u'. Actually sent: '%u'",
+                nbytes,
+                size);
+    }
   }
 
-  if (init_logs(log_fd, LOG_LEVEL) != 0)
-    exit(EXIT_FAILURE);
+  // Handle socket still open, otherwise close requested
+  return (res == -1 ? REACTOR_KEEP : REACTOR_CLOSE);
+}
 
-  if (create_server(PORT, &listen_fd) != 0) {
-    fprintf(stderr, "failed to create server\n");
-    exit(EXIT_FAILURE);
+void* echo_worker_init(int id)
+{
+  struct ring* rg = NULL;
+  if (ring_init(&rg, RING_CAPACITY) != 0) {
+    log_error("echo_worker_init: worker '%d' failed to create its ring", id);
+    return NULL;
   }
-  log_trace("main: listening...");
+  return rg;
+}
+
+void echo_worker_free(void* udata)
+{
+  struct ring* rg = udata;
+  ring_free(&rg);
+}
 
-  struct epoll_event ev, events[MAX_EVENTS];
-  int nfds, epollfd;
+int main(int argc, char* argv[])
+{
+  FILE* log_fd = NULL;
+  struct server_options opts = {
+      PORT, 1, REACTOR_BACKEND_EPOLL, SOCKETS_DEFAULT_BACKLOG};
 
-  epollfd = epoll_create1(0);
-  if (epollfd == -1) {
-    perror("epoll_create1 failed\n");
+  if (server_options_parse(argc, argv, &opts) != 0)
     exit(EXIT_FAILURE);
-  }
-  log_trace("main: epoll created...");
 
-  ev.events = EPOLLIN | EPOLLRDHUP;
-  ev.data.fd = listen_fd;
-  if (epoll_ctl(epollfd, EPOLL_CTL_ADD, listen_fd, &ev) == -1) {
-    perror("epoll_ctl: listen_fd\n");
+  if ((log_fd = fopen(LOG_FILE, LOG_FILE_MODE)) == NULL) {
+    fprintf(stderr, "Cannot open log file\n");
     exit(EXIT_FAILURE);
   }
 
-  char* data;
-  int n, fd, res, size;
-  struct queue* qu = nullptr;
-  struct epoll_ctl_info epci = {epollfd, 0, 0};
-
-  queue_init(&qu, QUEUE_CAPACITY);
-
-  for (;;) {
-    log_trace("main epoll loop: epoll listening...");
-    nfds = epoll_wait(epollfd, events, MAX_EVENTS, -1);
-    if (nfds == -1) {
-      perror("epoll_wait\n");
-      exit(EXIT_FAILURE);
-    }
+  if (init_logs(log_fd, LOG_LEVEL) != 0)
+    exit(EXIT_FAILURE);
 
-    log_trace("main epoll loop: epoll got '%d' events", nfds);
-    for (n = 0; n < nfds; ++n) {
-      epci.new_fd = events[n].data.fd;
-      fd = events[n].data.fd;
-      epci.event = &events[n];
-
-      // Handle a new listen connection
-      if (events[n].data.fd == listen_fd) {
-        fd_accept_and_epoll_add(&epci);
-        continue;
-      }
-
-      log_trace("main epoll loop: handling POLLIN event on fd '%d'", fd);
-      res = recv_request(fd, qu);
-      size = queue_pop_no_copy(qu, &data);
-
-      // Handle error case while recv data
-      if (res < -1) {
-        if (fd_poll_del_and_close(&epci) == -1) {
-          perror("epoll_ctl: recv 0");
-          exit(EXIT_FAILURE);
-        }
-
-        continue;
-      }
-
-      // Handle there's data to echo back
-      if (size > 0) {
-        int nbytes = size;
-        if (sendall(fd, data, &size) != 0) {
-          log_error("recv_echo: sending data on fd '%d'", fd);
-          continue;
-        }
-        if (nbytes != size) {
-          log_error("recv_echo: Expected to send: '%u'. Actually sent: '%u'",
-                    nbytes,
-                    size);
-        }
-      }
-
-      // Handle socket still open
-      if (res == -1)
-        continue;
-
-      // Handle closing request received
-      if (fd_poll_del_and_close(&epci) == -1) {
-        perror("epoll_ctl: recv 0");
-        exit(EXIT_FAILURE);
-      }
-    }
-  }
-  printf("Hello world\n");
+  struct server_config cfg = {
+      .reactor = {.max_events = MAX_EVENTS,
+                  .timeout_ms = REACTOR_WAIT_FOREVER,
+                  .handlers = {.on_data = echo_on_data}},
+      .worker_init = echo_worker_init,
+      .worker_free = echo_worker_free,
+  };
+  log_trace("main: starting '%d' workers...", opts.workers);
+
+  int res = server_run(&opts, &cfg);
+  return (res == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
 }
@@ -0,0 +1,188 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#  include <immintrin.h>
+#  define FRAME_X86 1
+#endif
+
+#include "utils/frame.h"
+
+static size_t frame_scan_scalar(
+    const char* data, size_t size, char delim, uint32_t* ends, size_t max)
+{
+  size_t n = 0;
+  const char* p = data;
+  const char* end = data + size;
+  while ((n < max) && (p < end)
+         && ((p = memchr(p, delim, (size_t)(end - p))) != NULL))
+  {
+    p++;
+    ends[n++] = (uint32_t)(p - data);
+  }
+  return n;
+}
+
+#ifdef FRAME_X86
+
+// Every set bit of mask is a delimiter at offset + its index
+static inline size_t frame_collect(
+    uint32_t mask, size_t offset, uint32_t* ends, size_t n, size_t max)
+{
+  while ((mask != 0) && (n < max)) {
+    ends[n++] = (uint32_t)(offset + (size_t)__builtin_ctz(mask) + 1);
+    mask &= mask - 1;
+  }
+  return n;
+}
+
+__attribute__((target("sse2"))) static size_t frame_scan_sse2(
+    const char* data, size_t size, char delim, uint32_t* ends, size_t max)
+{
+  __m128i d = _mm_set1_epi8(delim);
+  size_t n = 0, k = 0;
+  for (; (k + 16 <= size) && (n < max); k += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)(data + k));
+    uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, d));
+    n = frame_collect(mask, k, ends, n, max);
+  }
+  if ((n < max) && (k < size)) {
+    size_t tail =
+        frame_scan_scalar(data + k, size - k, delim, ends + n, max - n);
+    for (size_t j = n; j < n + tail; j++)
+      ends[j] += (uint32_t)k;
+    n += tail;
+  }
+  return n;
+}
+
+__attribute__((target("avx2"))) static size_t frame_scan_avx2(
+    const char* data, size_t size, char delim, uint32_t* ends, size_t max)
+{
+  __m256i d = _mm256_set1_epi8(delim);
+  size_t n = 0, k = 0;
+  for (; (k + 32 <= size) && (n < max); k += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)(data + k));
+    uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, d));
+    n = frame_collect(mask, k, ends, n, max);
+  }
+  if ((n < max) && (k < size)) {
+    size_t tail = frame_scan_sse2(data + k, size - k, delim, ends + n, max - n);
+    for (size_t j = n; j < n + tail; j++)
+      ends[j] += (uint32_t)k;
+    n += tail;
+  }
+  return n;
+}
+
+#endif
+
+/// Best implementation this CPU runs, FRAME_ISA_*
+int frame_isa(void)
+{
+#ifdef FRAME_X86
+  if (__builtin_cpu_supports("avx2"))
+    return FRAME_ISA_AVX2;
+  if (__builtin_cpu_supports("sse2"))
+    return FRAME_ISA_SSE2;
+#endif
+  return FRAME_ISA_SCALAR;
+}
+
+/**
+ * @brief frame_scan with a given implementation, for tests and benchmarks.
+ *
+ * Falls back to the scalar one when the CPU lacks the instructions.
+ */
+size_t frame_scan_isa(int isa,
+                      const char* data,
+                      size_t size,
+                      char delim,
+                      uint32_t* ends,
+                      size_t max)
+{
+  assert(data != NULL || size == 0);
+  assert(ends != NULL);
+  assert(size <= UINT32_MAX);
+
+  int best = frame_isa();
+  if ((isa == FRAME_ISA_AUTO) || (isa > best))
+    isa = best;
+  switch (isa) {
+#ifdef FRAME_X86
+    case FRAME_ISA_AVX2:
+      return frame_scan_avx2(data, size, delim, ends, max);
+    case FRAME_ISA_SSE2:
+      return frame_scan_sse2(data, size, delim, ends, max);
+#endif
+    default:
+      return frame_scan_scalar(data, size, delim, ends, max);
+  }
+}
+
+/**
+ * @brief Finds up to max delimiters in data, 16 or 32 bytes at a time.
+ *
+ * @return How many were found, ends holds the offset just past each one.
+ */
+size_t frame_scan(
+    const char* data, size_t size, char delim, uint32_t* ends, size_t max)
+{
+  return frame_scan_isa(FRAME_ISA_AUTO, data, size, delim, ends, max);
+}
+
+void frame_init(struct frame* f, char delim)
+{
+  assert(f != NULL);
+  f->delim = delim;
+  frame_reset(f);
+}
+
+/// Forgets everything scanned, for when the data is dropped behind its back
+void frame_reset(struct frame* f)
+{
+  f->scanned = 0;
+  f->count = 0;
+  f->next = 0;
+  f->base = 0;
+  f->clean = 0;
+}
+
+/**
+ * @brief Size of the complete line at the front of data, delimiter included,
+ * or 0 if there is none yet.
+ *
+ * The caller drops each line from the front of data (e.g. with ring_consume)
+ * before asking for the next one. Bytes may be appended at the end between
+ * calls.
+ */
+size_t frame_next(struct frame* f, const char* data, size_t size)
+{
+  assert(f != NULL);
+
+  if (f->next == f->count) {
+    assert(f->scanned <= size);
+    size_t from = f->scanned;
+    size_t n = frame_scan(
+        data + from, size - from, f->delim, f->ends, FRAME_BATCH);
+    if (n == 0) {
+      f->scanned = size;
+      return 0;
+    }
+    for (size_t k = 0; k < n; k++)
+      f->ends[k] += (uint32_t)from;
+    f->count = n;
+    f->next = 0;
+    f->base = 0;
+    // A full batch may have stopped short of the end
+    f->clean = (n < FRAME_BATCH ? size : f->ends[n - 1]);
+  }
+
+  size_t line = f->ends[f->next++] - f->base;
+  f->base += line;
+  f->scanned = (f->next == f->count ? f->clean - f->base : 0);
+  return line;
+}
@@ -0,0 +1,50 @@
+#ifndef INCLUDE_UTILS_FRAME_H_
+#define INCLUDE_UTILS_FRAME_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Delimiters located per scan, lines are then handed out without looking at
+// the data again
+#define FRAME_BATCH 64
+
+#define FRAME_ISA_AUTO 0  // Best one the CPU supports
+#define FRAME_ISA_SCALAR 1
+#define FRAME_ISA_SSE2 2
+#define FRAME_ISA_AVX2 3
+
+// Splits a byte stream into delimiter terminated lines. The unfinished line
+// at the end stays where it is for the next read, and the bytes of it already
+// scanned are not scanned again.
+struct frame {
+  char delim;
+  size_t scanned;  // Leading bytes known to hold no delimiter
+  size_t count;  // Delimiters found by the last scan
+  size_t next;  // Index in ends of the next line to hand out
+  size_t base;  // Bytes handed out since the last scan
+  size_t clean;  // Scanned bytes as of the last scan
+  uint32_t ends[FRAME_BATCH];  // Offsets past each delimiter found
+};
+
+void frame_init(struct frame* f, char delim);
+void frame_reset(struct frame* f);
+size_t frame_next(struct frame* f, const char* data, size_t size);
+size_t frame_scan(
+    const char* data, size_t size, char delim, uint32_t* ends, size_t max);
+size_t frame_scan_isa(int isa,
+                      const char* data,
+                      size_t size,
+                      char delim,
+                      uint32_t* ends,
+                      size_t max);
+int frame_isa(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // INCLUDE_UTILS_FRAME_H_
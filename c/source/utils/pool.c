@@ -0,0 +1,113 @@
+#include <assert.h>
+#include <stdalign.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "log/log.h"
+#include "utils/pool.h"
+
+struct pool_slab {
+  struct pool_slab* next;
+  alignas(max_align_t) char objects[];
+};
+
+// Every object must hold the free list link and keep the next one aligned
+static size_t pool_object_size(size_t size)
+{
+  const size_t align = alignof(max_align_t);
+  if (size < sizeof(void*))
+    size = sizeof(void*);
+  return (size + align - 1) / align * align;
+}
+
+static void pool_grow(struct pool* p)
+{
+  size_t obj_size = pool_object_size(p->obj_size);
+  struct pool_slab* slab =
+      malloc(sizeof(struct pool_slab) + p->slab_objects * obj_size);
+  assert(slab != NULL);
+  log_trace("pool_grow(%p): new slab of '%zu' objects", p, p->slab_objects);
+
+  slab->next = p->slabs;
+  p->slabs = slab;
+
+  // Thread the new objects into the free list, first one on top
+  for (size_t k = p->slab_objects; k > 0; k--) {
+    void** obj = (void**)(slab->objects + (k - 1) * obj_size);
+    *obj = p->free;
+    p->free = obj;
+  }
+}
+
+/**
+ * @brief Initializes a pool, same as assigning POOL_INIT.
+ *
+ * @param obj_size Size of every object handed out.
+ * @param slab_objects Objects allocated at once when the pool runs dry.
+ */
+void pool_init(struct pool* p, size_t obj_size, size_t slab_objects)
+{
+  assert(p != NULL);
+  assert(obj_size > 0);
+
+  p->obj_size = obj_size;
+  p->slab_objects =
+      (slab_objects > 0 ? slab_objects : POOL_DEFAULT_SLAB_OBJECTS);
+  p->free = NULL;
+  p->slabs = NULL;
+  p->in_use = 0;
+}
+
+/**
+ * @brief Releases every slab. Objects still in use become invalid.
+ */
+void pool_destroy(struct pool* p)
+{
+  assert(p != NULL);
+
+  if (p->in_use > 0)
+    log_warn("pool_destroy(%p): '%zu' objects still in use", p, p->in_use);
+
+  struct pool_slab* next;
+  for (struct pool_slab* slab = p->slabs; slab != NULL; slab = next) {
+    next = slab->next;
+    free(slab);
+  }
+  p->slabs = NULL;
+  p->free = NULL;
+  p->in_use = 0;
+}
+
+/**
+ * @brief Hands out an object, contents undefined.
+ */
+void* pool_get(struct pool* p)
+{
+  assert(p != NULL);
+  assert(p->obj_size > 0);
+
+  if (p->free == NULL)
+    pool_grow(p);
+
+  void** obj = p->free;
+  p->free = *obj;
+  p->in_use++;
+  return obj;
+}
+
+/**
+ * @brief Gives obj back to the pool it came from.
+ */
+void pool_put(struct pool* p, void* obj)
+{
+  assert(p != NULL);
+  assert(obj != NULL);
+  assert(p->in_use > 0);
+
+  *(void**)obj = p->free;
+  p->free = obj;
+  p->in_use--;
+}
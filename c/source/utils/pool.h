@@ -0,0 +1,36 @@
+#ifndef INCLUDE_UTILS_POOL_H_
+#define INCLUDE_UTILS_POOL_H_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define POOL_DEFAULT_SLAB_OBJECTS 64
+
+// Fixed size object allocator. Objects are carved out of slabs allocated in
+// bulk and go back to a free list when released, so steady state churn never
+// reaches malloc. Not thread safe on purpose, every thread uses its own pool
+// (a _Thread_local one, or one owned by its reactor).
+struct pool {
+  size_t obj_size;
+  size_t slab_objects;
+  void* free;  // Released objects, linked through their first bytes
+  struct pool_slab* slabs;
+  size_t in_use;
+};
+
+// Static initializer, usable for _Thread_local pools
+#define POOL_INIT(size, objects) {(size), (objects), NULL, NULL, 0}
+
+void pool_init(struct pool* p, size_t obj_size, size_t slab_objects);
+void pool_destroy(struct pool* p);
+void* pool_get(struct pool* p);
+void pool_put(struct pool* p, void* obj);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // INCLUDE_UTILS_POOL_H_
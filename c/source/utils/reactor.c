@@ -0,0 +1,1083 @@
+#define _GNU_SOURCE
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "log/log.h"
+#include "utils/pool.h"
+#include "utils/reactor.h"
+#include "utils/ring.h"
+#include "utils/uring.h"
+#include "utils/utils.h"
+
+// io_uring user_data is the connection pointer with the operation in the
+// low bits, pool alignment leaves them free
+#define REACTOR_OP_ACCEPT 0x1
+#define REACTOR_OP_RECV 0x2
+#define REACTOR_OP_SEND 0x3
+#define REACTOR_OP_NOTIFY 0x4
+#define REACTOR_OP_CANCEL 0x5
+#define REACTOR_OP_MASK UINT64_C(7)
+
+#define REACTOR_SEND_RING_CAPACITY 4096
+// Connections accepted per listener event, so a storm can't starve the rest
+#define REACTOR_ACCEPT_BATCH 256
+
+static int reactor_uring_arm(struct reactor_conn* conn);
+
+static struct reactor_conn* reactor_conn_new(struct reactor* r, int fd)
+{
+  struct reactor_conn* conn = pool_get(&r->conn_pool);
+  memset(conn, 0, sizeof(struct reactor_conn));
+
+  conn->fd = fd;
+  conn->reactor = r;
+  conn->rx_res = -1;
+
+  // Track it so that reactor_free can reach every connection
+  conn->prev = NULL;
+  conn->next = r->conns;
+  if (r->conns != NULL)
+    r->conns->prev = conn;
+  r->conns = conn;
+  return conn;
+}
+
+static int reactor_conn_register(struct reactor_conn* conn, uint32_t events)
+{
+  struct epoll_event ev;
+  ev.events = events;
+  ev.data.ptr = conn;
+  return epoll_ctl(conn->reactor->efd, EPOLL_CTL_ADD, conn->fd, &ev);
+}
+
+static int reactor_conn_modify(struct reactor_conn* conn, uint32_t events)
+{
+  struct epoll_event ev;
+  ev.events = events;
+  ev.data.ptr = conn;
+  return epoll_ctl(conn->reactor->efd, EPOLL_CTL_MOD, conn->fd, &ev);
+}
+
+// Output queued but not handed over to the kernel yet
+static bool reactor_conn_pending(struct reactor_conn* conn)
+{
+  if (conn->reactor->backend == REACTOR_BACKEND_URING)
+    return (conn->sending != NULL) && (conn->sending->size > 0);
+  return (conn->out != NULL) && (conn->out->size > 0);
+}
+
+// Move it from the live list to the closed list
+static void reactor_conn_unlink(struct reactor_conn* conn)
+{
+  struct reactor* r = conn->reactor;
+  if (conn->prev != NULL)
+    conn->prev->next = conn->next;
+  else
+    r->conns = conn->next;
+  if (conn->next != NULL)
+    conn->next->prev = conn->prev;
+
+  conn->prev = NULL;
+  conn->next = r->closed;
+  r->closed = conn;
+}
+
+// Actually close the fd, regardless of any pending output
+static void reactor_conn_shutdown(struct reactor_conn* conn)
+{
+  struct reactor* r = conn->reactor;
+  if (conn->fd == -1)
+    return;
+
+  if (!conn->listener && (r->handlers.on_close != NULL))
+    r->handlers.on_close(conn);
+  log_info("reactor_close: closing fd '%d'", conn->fd);
+  if (r->backend == REACTOR_BACKEND_URING) {
+    // Completes the in flight operations on it
+    shutdown(conn->fd, SHUT_RDWR);
+  } else if (epoll_ctl(r->efd, EPOLL_CTL_DEL, conn->fd, NULL) == -1) {
+    log_warn("reactor_close: epoll_ctl del failed: %s", strerror(errno));
+  }
+  close(conn->fd);
+  conn->fd = -1;
+  reactor_conn_unlink(conn);
+
+  // A descriptor is free again, the starved listener can accept once more
+  if (r->starved == conn) {
+    r->starved = NULL;
+  } else if (r->starved != NULL) {
+    struct reactor_conn* listener = r->starved;
+    r->starved = NULL;
+    if (reactor_uring_arm(listener) != 0)
+      log_error("reactor_close: failed to re-arm accept");
+  }
+}
+
+static void reactor_conn_free(struct reactor_conn* conn)
+{
+  if (conn->out != NULL)
+    ring_free(&conn->out);
+  if (conn->sending != NULL)
+    ring_free(&conn->sending);
+  pool_put(&conn->reactor->conn_pool, conn);
+}
+
+// Free the connections closed while dispatching the last batch of events.
+// io_uring connections have to wait for their operations to complete.
+static void reactor_collect(struct reactor* r, bool force)
+{
+  struct reactor_conn *next, **pconn = &r->closed;
+  for (struct reactor_conn* conn = r->closed; conn != NULL; conn = next) {
+    next = conn->next;
+    if ((conn->inflight > 0) && !force) {
+      pconn = &conn->next;
+      continue;
+    }
+    *pconn = next;
+    reactor_conn_free(conn);
+  }
+}
+
+// Edge-triggered, EPOLLIN while not paused and EPOLLOUT while writable
+static uint32_t reactor_epoll_events(struct reactor_conn* conn, bool writable)
+{
+  return (conn->paused ? 0 : EPOLLIN) | EPOLLET | (writable ? EPOLLOUT : 0);
+}
+
+static int reactor_epoll_watch_output(struct reactor_conn* conn, bool enable)
+{
+  if (enable == conn->writable)
+    return 0;
+
+  if (reactor_conn_modify(conn, reactor_epoll_events(conn, enable)) == -1) {
+    log_error("reactor_epoll_watch_output: epoll_ctl mod failed for fd '%d': "
+              "%s",
+              conn->fd,
+              strerror(errno));
+    return -1;
+  }
+  conn->writable = enable;
+  return 0;
+}
+
+// Send as much of the pending output as the socket takes. EPOLLOUT stays
+// armed only while something is left.
+static int reactor_epoll_flush(struct reactor_conn* conn)
+{
+  struct ring* out = conn->out;
+  while (out->size > 0) {
+    ssize_t nbytes =
+        send(conn->fd, ring_read_ptr(out), out->size, MSG_NOSIGNAL);
+    if (nbytes == -1) {
+      if (errno == EINTR)
+        continue;
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+        break;
+      log_error("reactor_epoll_flush: send failed on fd '%d': %s",
+                conn->fd,
+                strerror(errno));
+      return -1;
+    }
+    ring_consume(out, (size_t)nbytes);
+  }
+
+  if (reactor_epoll_watch_output(conn, out->size > 0) != 0)
+    return -1;
+
+  log_trace("reactor_epoll_flush: fd '%d' has '%zu' bytes pending",
+            conn->fd,
+            out->size);
+  return 0;
+}
+
+// Nothing pending, try the socket first and only keep what it refuses
+static int reactor_epoll_send(struct reactor_conn* conn, char* buf, size_t len)
+{
+  size_t offset = 0;
+  while (!conn->writable && (offset < len)) {
+    ssize_t nbytes = send(conn->fd, buf + offset, len - offset, MSG_NOSIGNAL);
+    if (nbytes == -1) {
+      if (errno == EINTR)
+        continue;
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+        break;
+      log_error("reactor_epoll_send: send failed on fd '%d': %s",
+                conn->fd,
+                strerror(errno));
+      return -1;
+    }
+    offset += (size_t)nbytes;
+  }
+  if (offset == len)
+    return 0;
+
+  if ((conn->out == NULL)
+      && (ring_init(&conn->out, REACTOR_SEND_RING_CAPACITY) != 0))
+    return -1;
+  if (ring_push(conn->out, buf + offset, len - offset) != 0)
+    return -1;
+  return reactor_epoll_watch_output(conn, true);
+}
+
+// Same with several buffers, one sendmsg for all of them
+static int reactor_epoll_sendv(struct reactor_conn* conn,
+                               struct iovec* iov,
+                               int iovcnt)
+{
+  size_t sent = 0;
+  if (!conn->writable) {
+    struct msghdr msg = {.msg_iov = iov, .msg_iovlen = (size_t)iovcnt};
+    ssize_t nbytes;
+    do {
+      nbytes = sendmsg(conn->fd, &msg, MSG_NOSIGNAL);
+    } while ((nbytes == -1) && (errno == EINTR));
+    if ((nbytes == -1) && (errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+      log_error("reactor_epoll_sendv: sendmsg failed on fd '%d': %s",
+                conn->fd,
+                strerror(errno));
+      return -1;
+    }
+    if (nbytes > 0)
+      sent = (size_t)nbytes;
+  }
+
+  // The socket is full, whatever it did not take waits for EPOLLOUT
+  bool pending = false;
+  for (int k = 0; k < iovcnt; k++) {
+    if (sent >= iov[k].iov_len) {
+      sent -= iov[k].iov_len;
+      continue;
+    }
+    if ((conn->out == NULL)
+        && (ring_init(&conn->out, REACTOR_SEND_RING_CAPACITY) != 0))
+      return -1;
+    if (ring_push(conn->out,
+                  (char*)iov[k].iov_base + sent,
+                  iov[k].iov_len - sent)
+        != 0)
+      return -1;
+    sent = 0;
+    pending = true;
+  }
+  return (pending ? reactor_epoll_watch_output(conn, true) : 0);
+}
+
+// Out of descriptors: give up the reserve one to accept the pending
+// connection and close it right away. Otherwise it stays in the backlog and
+// the listener keeps reporting it, spinning the loop. Returns false once the
+// backlog is empty, accept fails with EMFILE before looking at it.
+static bool reactor_accept_shed(struct reactor* r, struct reactor_conn* listener)
+{
+  if (r->reserve_fd == -1)
+    return false;
+
+  close(r->reserve_fd);
+  int fd = accept4(listener->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+  if (fd != -1)
+    close(fd);
+  r->reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return false;
+
+  log_warn("reactor_accept_shed: out of file descriptors, connection dropped");
+  return true;
+}
+
+static void reactor_accept(struct reactor* r, struct reactor_conn* listener)
+{
+  // Bounded, the listener is level-triggered and reports what is left
+  for (int k = 0; k < REACTOR_ACCEPT_BATCH; k++) {
+    int fd = accept4(listener->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd == -1) {
+      int err = errno;
+      if ((err == EAGAIN) || (err == EWOULDBLOCK))
+        return;
+      if ((err == EMFILE) || (err == ENFILE)) {
+        if (reactor_accept_shed(r, listener))
+          continue;
+        return;
+      }
+      log_error("reactor_accept: accept failed: %s (errno: %d)",
+                strerror(err),
+                err);
+      // The client gave up before being accepted, the next one may be fine
+      if ((err == ECONNABORTED) || (err == EINTR) || (err == EPROTO))
+        continue;
+      return;
+    }
+
+    log_info("reactor_accept: new connection on socket '%d'", fd);
+
+    // Doing edge-level trigger
+    struct reactor_conn* conn = reactor_conn_new(r, fd);
+    if (reactor_conn_register(conn, EPOLLIN | EPOLLET) == -1) {
+      log_error("reactor_accept: epoll_ctl failed for fd '%d': %s",
+                fd,
+                strerror(errno));
+      reactor_close(conn);
+      continue;
+    }
+
+    if ((r->handlers.on_open != NULL) && (r->handlers.on_open(conn) < 0)) {
+      log_info("reactor_accept: connection on fd '%d' rejected", fd);
+      reactor_close(conn);
+    }
+  }
+}
+
+// ---- io_uring backend ----
+
+static struct io_uring_sqe* reactor_uring_sqe(struct reactor_conn* conn,
+                                              uint64_t op)
+{
+  struct io_uring_sqe* sqe = uring_get_sqe(conn->reactor->ring);
+  if (sqe == NULL) {
+    log_error("reactor_uring_sqe: submission queue full for fd '%d'",
+              conn->fd);
+    return NULL;
+  }
+  sqe->user_data = (uint64_t)(uintptr_t)conn | op;
+  conn->inflight++;
+  return sqe;
+}
+
+static int reactor_uring_arm(struct reactor_conn* conn)
+{
+  uint64_t op = (conn->listener ? REACTOR_OP_ACCEPT : REACTOR_OP_RECV);
+  if (conn->notifier)
+    op = REACTOR_OP_NOTIFY;
+  struct io_uring_sqe* sqe = reactor_uring_sqe(conn, op);
+  if (sqe == NULL)
+    return -1;
+
+  if (conn->notifier)
+    uring_prep_read(sqe, conn->fd, &conn->counter, sizeof(conn->counter));
+  else if (conn->listener)
+    uring_prep_accept_multishot(sqe, conn->fd);
+  else
+    uring_prep_recv_multishot(sqe, conn->fd);
+  conn->receiving = (op == REACTOR_OP_RECV);
+  return 0;
+}
+
+// Hand the pending output over to the kernel, only one send in flight
+static int reactor_uring_flush(struct reactor_conn* conn)
+{
+  // sending never grows while the kernel reads from it
+  if (conn->sending->size == 0) {
+    if (conn->out->size == 0)
+      return 0;
+    struct ring* tmp = conn->sending;
+    conn->sending = conn->out;
+    conn->out = tmp;
+  }
+
+  struct io_uring_sqe* sqe = reactor_uring_sqe(conn, REACTOR_OP_SEND);
+  if (sqe == NULL)
+    return -1;
+  uring_prep_send(sqe,
+                  conn->fd,
+                  ring_read_ptr(conn->sending),
+                  conn->sending->size);
+  return 0;
+}
+
+static void reactor_uring_accepted(struct reactor* r,
+                                   struct reactor_conn* listener,
+                                   int res,
+                                   uint32_t flags)
+{
+  bool starved = ((res == -EMFILE) || (res == -ENFILE));
+  if (starved && reactor_accept_shed(r, listener))
+    starved = false;
+
+  if (!(flags & IORING_CQE_F_MORE)) {
+    listener->inflight--;
+    // Accepting fails right away while no fd is free, wait for a close
+    if (starved && (listener->fd != -1))
+      r->starved = listener;
+    else if ((listener->fd != -1) && (reactor_uring_arm(listener) != 0))
+      log_error("reactor_uring_accepted: failed to re-arm accept");
+  }
+
+  if (res < 0) {
+    if ((listener->fd != -1) && (res != -EMFILE) && (res != -ENFILE))
+      log_error("reactor_uring_accepted: accept failed: %s", strerror(-res));
+    return;
+  }
+
+  log_info("reactor_uring_accepted: new connection on socket '%d'", res);
+  struct reactor_conn* conn = reactor_conn_new(r, res);
+  if (reactor_uring_arm(conn) != 0) {
+    reactor_conn_shutdown(conn);
+    return;
+  }
+
+  if ((r->handlers.on_open != NULL) && (r->handlers.on_open(conn) < 0)) {
+    log_info("reactor_uring_accepted: connection on fd '%d' rejected", res);
+    reactor_close(conn);
+  }
+}
+
+static void reactor_uring_received(struct reactor* r,
+                                   struct reactor_conn* conn,
+                                   int res,
+                                   uint32_t flags)
+{
+  bool more = (flags & IORING_CQE_F_MORE);
+  bool has_buf = (flags & IORING_CQE_F_BUFFER);
+  uint16_t bid = (uint16_t)(flags >> IORING_CQE_BUFFER_SHIFT);
+
+  if (!more) {
+    conn->inflight--;
+    conn->receiving = false;
+  }
+
+  if ((conn->fd == -1) || conn->closing) {
+    if (has_buf)
+      uring_buf_recycle(r->ring, bid);
+    return;
+  }
+
+  // Cancelled by reactor_pause or out of buffers, armed again unless paused
+  if ((res == -ECANCELED) || (res == -ENOBUFS)) {
+    if (res == -ENOBUFS)
+      log_warn("reactor_uring_received: out of buffers on fd '%d'", conn->fd);
+    if (!more && !conn->paused && (reactor_uring_arm(conn) != 0))
+      reactor_conn_shutdown(conn);
+    return;
+  }
+
+  conn->rx = NULL;
+  conn->rx_size = 0;
+  conn->rx_res = -1;
+  if ((res > 0) && has_buf) {
+    conn->rx = uring_buf(r->ring, bid);
+    conn->rx_size = (size_t)res;
+  } else if (res == 0) {
+    conn->rx_res = 0;
+  } else if (res < 0) {
+    log_error("reactor_uring_received: recv failed on fd '%d': %s",
+              conn->fd,
+              strerror(-res));
+    conn->rx_res = -2;
+  }
+
+  int action = r->handlers.on_data(conn);
+  conn->rx = NULL;
+  conn->rx_size = 0;
+  if (has_buf)
+    uring_buf_recycle(r->ring, bid);
+
+  // Multishot recv is done for good after end of file or an error. Past
+  // the end of file the handler may keep it open to finish answering
+  if ((action == REACTOR_CLOSE) || (res < 0)) {
+    reactor_close(conn);
+    return;
+  }
+  if (res == 0)
+    return;
+
+  if (!more && (conn->fd != -1) && !conn->paused
+      && (reactor_uring_arm(conn) != 0))
+    reactor_conn_shutdown(conn);
+}
+
+static void reactor_uring_sent(struct reactor_conn* conn, int res)
+{
+  conn->inflight--;
+  if (conn->fd == -1)
+    return;
+
+  if (res < 0) {
+    log_error("reactor_uring_sent: send failed on fd '%d': %s",
+              conn->fd,
+              strerror(-res));
+    reactor_conn_shutdown(conn);
+    return;
+  }
+
+  ring_consume(conn->sending, (size_t)res);
+
+  if (reactor_uring_flush(conn) != 0) {
+    reactor_conn_shutdown(conn);
+    return;
+  }
+
+  if (conn->sending->size > 0)
+    return;
+  if (conn->closing)
+    reactor_conn_shutdown(conn);
+  else if ((conn->reactor->handlers.on_drain != NULL)
+           && (conn->reactor->handlers.on_drain(conn) == REACTOR_CLOSE))
+    reactor_close(conn);
+}
+
+static void reactor_uring_notified(struct reactor* r,
+                                   struct reactor_conn* conn,
+                                   int res)
+{
+  conn->inflight--;
+  if (res < 0)
+    log_warn("reactor_uring_notified: read failed: %s", strerror(-res));
+  if (r->handlers.on_notify != NULL)
+    r->handlers.on_notify(r);
+  if (reactor_uring_arm(conn) != 0)
+    log_error("reactor_uring_notified: failed to re-arm the notifier");
+}
+
+static int reactor_run_uring(struct reactor* r)
+{
+  int n, res;
+  uint64_t user_data;
+  uint32_t flags;
+  struct reactor_conn* conn;
+  struct io_uring_cqe* cqe;
+
+  r->running = true;
+  while (r->running) {
+    log_trace("reactor_run: io_uring waiting...");
+    res = uring_submit_and_wait(r->ring, r->timeout_ms);
+    if (res == -EINTR)
+      continue;
+    if ((res < 0) && (res != -ETIME)) {
+      log_error("reactor_run: io_uring_enter failed: %s", strerror(-res));
+      return -1;
+    }
+
+    if ((res == -ETIME) && (uring_peek_cqe(r->ring) == NULL)) {
+      log_trace("reactor_run: timeout hit");
+      if ((r->handlers.on_timeout != NULL)
+          && (r->handlers.on_timeout(r) == REACTOR_CLOSE))
+        r->running = false;
+      continue;
+    }
+
+    for (n = 0; n < r->max_events; n++) {
+      cqe = uring_peek_cqe(r->ring);
+      if (cqe == NULL)
+        break;
+      user_data = cqe->user_data;
+      res = cqe->res;
+      flags = cqe->flags;
+      uring_cqe_seen(r->ring);
+
+      conn = (struct reactor_conn*)(uintptr_t)(user_data & ~REACTOR_OP_MASK);
+      switch (user_data & REACTOR_OP_MASK) {
+        case REACTOR_OP_ACCEPT:
+          reactor_uring_accepted(r, conn, res, flags);
+          break;
+        case REACTOR_OP_RECV:
+          reactor_uring_received(r, conn, res, flags);
+          break;
+        case REACTOR_OP_SEND:
+          reactor_uring_sent(conn, res);
+          break;
+        case REACTOR_OP_NOTIFY:
+          reactor_uring_notified(r, conn, res);
+          break;
+        case REACTOR_OP_CANCEL:
+          // The recv completes on its own, -ENOENT if it already had
+          conn->inflight--;
+          break;
+        default:
+          break;
+      }
+    }
+    log_trace("reactor_run: io_uring got '%d' completions", n);
+
+    reactor_collect(r, false);
+  }
+
+  return 0;
+}
+
+// ---- Public interface ----
+
+/**
+ * @brief Creates the event loop.
+ *
+ * The io_uring backend falls back to epoll when the kernel does not support
+ * it.
+ *
+ * @param pr Pointer to the reactor to create. Must point to NULL.
+ * @param cfg Backend, handlers, batch size and timeout to use.
+ * @return 0 on success, -1 if the epoll instance could not be created.
+ */
+int reactor_init(struct reactor** pr, struct reactor_config* cfg)
+{
+  assert(*pr == NULL);
+  assert(cfg != NULL);
+  assert(cfg->handlers.on_data != NULL);
+
+  struct reactor* r = calloc(1, sizeof(struct reactor));
+  assert(r != NULL);
+
+  r->efd = -1;
+  r->backend = REACTOR_BACKEND_EPOLL;
+  if (cfg->backend == REACTOR_BACKEND_URING) {
+    if (uring_init(&r->ring, URING_ENTRIES) == 0)
+      r->backend = REACTOR_BACKEND_URING;
+    else
+      log_warn("reactor_init: io_uring not available, using epoll");
+  }
+
+  if (r->backend == REACTOR_BACKEND_EPOLL) {
+    r->efd = epoll_create1(EPOLL_CLOEXEC);
+    if (r->efd == -1) {
+      log_error("reactor_init: epoll_create1 failed: %s", strerror(errno));
+      free(r);
+      return -1;
+    }
+  }
+
+  r->max_events =
+      (cfg->max_events > 0 ? cfg->max_events : REACTOR_DEFAULT_MAX_EVENTS);
+  r->timeout_ms = cfg->timeout_ms;
+  r->running = false;
+  r->events = calloc((size_t)r->max_events, sizeof(struct epoll_event));
+  assert(r->events != NULL);
+  r->handlers = cfg->handlers;
+  r->udata = cfg->udata;
+  r->conns = NULL;
+  r->closed = NULL;
+  pool_init(&r->conn_pool, sizeof(struct reactor_conn), 0);
+  // Given up when the process runs out of descriptors, see
+  // reactor_accept_shed
+  r->reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+  r->starved = NULL;
+  if (r->reserve_fd == -1)
+    log_warn("reactor_init: no reserve fd: %s", strerror(errno));
+
+  *pr = r;
+  return 0;
+}
+
+/**
+ * @brief Closes every connection still registered and frees the reactor.
+ *
+ * on_close is invoked for each of the open client connections.
+ *
+ * @param pr Pointer to the reactor to free. Set to NULL afterwards.
+ */
+void reactor_free(struct reactor** pr)
+{
+  assert(*pr != NULL);
+
+  struct reactor* r = *pr;
+  while (r->conns != NULL)
+    reactor_conn_shutdown(r->conns);
+
+  if (r->ring != NULL)
+    uring_free(&r->ring);
+  else
+    close(r->efd);
+  reactor_collect(r, true);
+  if (r->notifier != NULL)
+    pool_put(&r->conn_pool, r->notifier);
+  pool_destroy(&r->conn_pool);
+  if (r->reserve_fd != -1)
+    close(r->reserve_fd);
+
+  free(r->events);
+  free(r);
+  *pr = NULL;
+}
+
+int reactor_add_listener(struct reactor* r, int listen_fd)
+{
+  assert(r != NULL);
+  assert(listen_fd >= 0);
+
+  struct reactor_conn* conn = reactor_conn_new(r, listen_fd);
+  conn->listener = true;
+  int res = (r->backend == REACTOR_BACKEND_URING
+                 ? reactor_uring_arm(conn)
+                 : reactor_conn_register(conn, EPOLLIN));
+  if (res == -1) {
+    log_error("reactor_add_listener: failed to watch fd '%d'", listen_fd);
+    // The caller owns the listening socket on failure
+    conn->fd = -1;
+    reactor_conn_unlink(conn);
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * @brief Watches event_fd, an eventfd, and calls on_notify whenever it gets
+ * written to.
+ *
+ * The way for other threads to wake the loop up. The caller keeps owning
+ * event_fd, which must outlive the reactor. Only one per reactor.
+ *
+ * @return 0 on success, -1 otherwise.
+ */
+int reactor_add_notifier(struct reactor* r, int event_fd)
+{
+  assert(r != NULL);
+  assert(event_fd >= 0);
+
+  if (r->notifier != NULL)
+    return -1;
+
+  // Off the connection list, it is never closed by the reactor
+  struct reactor_conn* conn = pool_get(&r->conn_pool);
+  memset(conn, 0, sizeof(struct reactor_conn));
+  conn->fd = event_fd;
+  conn->reactor = r;
+  conn->notifier = true;
+  int res = (r->backend == REACTOR_BACKEND_URING
+                 ? reactor_uring_arm(conn)
+                 : reactor_conn_register(conn, EPOLLIN));
+  if (res == -1) {
+    log_error("reactor_add_notifier: failed to watch fd '%d'", event_fd);
+    pool_put(&r->conn_pool, conn);
+    return -1;
+  }
+
+  r->notifier = conn;
+  return 0;
+}
+
+/**
+ * @brief Closes the connection.
+ *
+ * Safe to call from within any handler. The connection memory stays valid
+ * until the current batch of events has been dispatched. Output still being
+ * is still sent before the fd is closed.
+ *
+ * @param conn Connection to close.
+ */
+void reactor_close(struct reactor_conn* conn)
+{
+  assert(conn != NULL);
+
+  if (conn->fd == -1)
+    return;
+
+  if (reactor_conn_pending(conn)) {
+    conn->closing = true;
+    return;
+  }
+
+  reactor_conn_shutdown(conn);
+}
+
+void reactor_stop(struct reactor* r)
+{
+  assert(r != NULL);
+  r->running = false;
+}
+
+/**
+ * @brief Receives whatever the connection has available into qu.
+ *
+ * Use from on_data, in place of recv_request. Data is appended to whatever
+ * is left in rg from previous calls. Once rg holds conn->recv_max bytes the
+ * connection is paused. The io_uring backend may still go past it by what
+ * the kernel had received by then, up to its provided buffers.
+ *
+ * @return Same as recv_request:
+ *    0 if close event received
+ *    -1 if there is nothing else to read for now
+ *    -2 for any other kind of error
+ */
+int reactor_recv(struct reactor_conn* conn, struct ring* rg)
+{
+  assert(conn != NULL);
+  assert(rg != NULL);
+
+  int res;
+  if (conn->reactor->backend == REACTOR_BACKEND_EPOLL) {
+    res = recv_request(conn->fd, rg, conn->recv_max);
+  } else {
+    if (conn->rx_size > 0) {
+      if (ring_push(rg, conn->rx, conn->rx_size) != 0)
+        return -2;
+      conn->rx_size = 0;
+    }
+    log_trace("reactor_recv: fd '%d' res '%d'", conn->fd, conn->rx_res);
+    res = conn->rx_res;
+  }
+
+  // The rest waits in the socket until reactor_resume
+  if ((res == -1) && (conn->recv_max > 0) && (rg->size >= conn->recv_max)
+      && (reactor_pause(conn) != 0))
+    return -2;
+  return res;
+}
+
+// Might be running from another connection's handler, so leave the actual
+// close to the loop. Arming EPOLLOUT makes sure it hears about it.
+static int reactor_send_failed(struct reactor_conn* conn)
+{
+  if (conn->out != NULL)
+    ring_reset(conn->out);
+  conn->closing = true;
+  reactor_epoll_watch_output(conn, true);
+  return EIO;
+}
+
+/**
+ * @brief Sends buf over the connection, same interface as sendall.
+ *
+ * Never blocks. Whatever the socket does not take right away is copied into
+ * the connection's output ring and goes out once it is writable again, so
+ * it always reports the whole buffer as sent. The io_uring backend queues
+ * everything and submits the send along with the rest of the batch.
+ *
+ * @return 0 on success, otherwise an errno value. The connection should be
+ * closed on errors.
+ */
+int reactor_send(struct reactor_conn* conn, char* buf, int* len)
+{
+  assert(conn != NULL);
+  assert(buf != NULL);
+  assert(*len > 0);
+
+  if ((conn->fd == -1) || conn->closing)
+    return EPIPE;
+
+  if (conn->reactor->backend == REACTOR_BACKEND_URING) {
+    if ((conn->out == NULL)
+        && (ring_init(&conn->out, REACTOR_SEND_RING_CAPACITY) != 0))
+      return ENOMEM;
+    if ((conn->sending == NULL)
+        && (ring_init(&conn->sending, REACTOR_SEND_RING_CAPACITY) != 0))
+      return ENOMEM;
+    if (ring_push(conn->out, buf, (size_t)*len) != 0)
+      return ENOMEM;
+    if ((conn->sending->size == 0) && (reactor_uring_flush(conn) != 0))
+      return EIO;
+    return 0;
+  }
+
+  if (reactor_epoll_send(conn, buf, (size_t)*len) == 0)
+    return 0;
+  return reactor_send_failed(conn);
+}
+
+/**
+ * @brief Sends iovcnt buffers over the connection as if concatenated.
+ *
+ * Same as reactor_send, but the epoll backend hands all of them to a single
+ * sendmsg without copying them first. Only what the socket refuses is
+ * copied, along with everything for the io_uring backend.
+ *
+ * @return 0 on success, otherwise an errno value.
+ */
+int reactor_sendv(struct reactor_conn* conn, struct iovec* iov, int iovcnt)
+{
+  assert(conn != NULL);
+  assert(iov != NULL);
+  assert(iovcnt > 0);
+
+  if ((conn->fd == -1) || conn->closing)
+    return EPIPE;
+
+  if (conn->reactor->backend == REACTOR_BACKEND_URING) {
+    for (int k = 0; k < iovcnt; k++) {
+      int len = (int)iov[k].iov_len;
+      int res = (len > 0 ? reactor_send(conn, iov[k].iov_base, &len) : 0);
+      if (res != 0)
+        return res;
+    }
+    return 0;
+  }
+
+  if (reactor_epoll_sendv(conn, iov, iovcnt) == 0)
+    return 0;
+  return reactor_send_failed(conn);
+}
+
+/**
+ * @brief Bytes sent over the connection that the socket has not taken yet.
+ */
+size_t reactor_pending(struct reactor_conn* conn)
+{
+  assert(conn != NULL);
+
+  size_t size = (conn->out != NULL ? conn->out->size : 0);
+  if (conn->sending != NULL)
+    size += conn->sending->size;
+  return size;
+}
+
+/**
+ * @brief Stops reading from the connection until reactor_resume.
+ *
+ * Whatever the client sends meanwhile waits in the socket, and eventually
+ * in the client. on_data is still called for a hang up or an error, and
+ * with the io_uring backend for data already received.
+ *
+ * @return 0 on success, -1 otherwise. The connection should be closed on
+ * errors.
+ */
+int reactor_pause(struct reactor_conn* conn)
+{
+  assert(conn != NULL);
+  assert(!conn->listener && !conn->notifier);
+
+  if (conn->paused || (conn->fd == -1))
+    return 0;
+  conn->paused = true;
+
+  if (conn->reactor->backend == REACTOR_BACKEND_EPOLL) {
+    if (reactor_conn_modify(conn, reactor_epoll_events(conn, conn->writable))
+        == -1)
+    {
+      log_error("reactor_pause: epoll_ctl mod failed for fd '%d': %s",
+                conn->fd,
+                strerror(errno));
+      return -1;
+    }
+    return 0;
+  }
+
+  if (!conn->receiving)
+    return 0;
+  struct io_uring_sqe* sqe = reactor_uring_sqe(conn, REACTOR_OP_CANCEL);
+  if (sqe == NULL)
+    return -1;
+  uring_prep_cancel(sqe, (uint64_t)(uintptr_t)conn | REACTOR_OP_RECV);
+  return 0;
+}
+
+/**
+ * @brief Reads from the connection again after reactor_pause.
+ *
+ * on_data follows if anything arrived in the meantime.
+ *
+ * @return 0 on success, -1 otherwise. The connection should be closed on
+ * errors.
+ */
+int reactor_resume(struct reactor_conn* conn)
+{
+  assert(conn != NULL);
+
+  if (!conn->paused || (conn->fd == -1))
+    return 0;
+  conn->paused = false;
+
+  if (conn->reactor->backend == REACTOR_BACKEND_EPOLL) {
+    // Modifying it reports the pending input as a new edge
+    if (reactor_conn_modify(conn, reactor_epoll_events(conn, conn->writable))
+        == -1)
+    {
+      log_error("reactor_resume: epoll_ctl mod failed for fd '%d': %s",
+                conn->fd,
+                strerror(errno));
+      return -1;
+    }
+    return 0;
+  }
+
+  // Still armed while the cancel is in flight, re-armed once it lands
+  if (conn->receiving || conn->closing)
+    return 0;
+  return reactor_uring_arm(conn);
+}
+
+/**
+ * @brief Runs the event loop until reactor_stop is called or on_timeout asks
+ * to stop.
+ *
+ * @param r Reactor to run.
+ * @return 0 when stopped, -1 if waiting for events failed.
+ */
+int reactor_run(struct reactor* r)
+{
+  assert(r != NULL);
+
+  if (r->backend == REACTOR_BACKEND_URING)
+    return reactor_run_uring(r);
+
+  int n, nfds;
+  struct reactor_conn* conn;
+
+  r->running = true;
+  while (r->running) {
+    log_trace("reactor_run: epoll listening...");
+    nfds = epoll_wait(r->efd, r->events, r->max_events, r->timeout_ms);
+    if (nfds == -1) {
+      if (errno == EINTR)
+        continue;
+      log_error("reactor_run: epoll_wait failed: %s", strerror(errno));
+      return -1;
+    }
+
+    if (nfds == 0) {
+      log_trace("reactor_run: timeout hit");
+      if ((r->handlers.on_timeout != NULL)
+          && (r->handlers.on_timeout(r) == REACTOR_CLOSE))
+        r->running = false;
+      continue;
+    }
+
+    log_trace("reactor_run: epoll got '%d' events", nfds);
+    for (n = 0; n < nfds; ++n) {
+      conn = r->events[n].data.ptr;
+      // Closed by a handler earlier in this batch
+      if (conn->fd == -1)
+        continue;
+
+      conn->events = r->events[n].events;
+      if (conn->notifier) {
+        // Level-triggered, reset the count before handling it
+        if (read(conn->fd, &conn->counter, sizeof(conn->counter)) == -1)
+          log_trace("reactor_run: notifier read: %s", strerror(errno));
+        if (r->handlers.on_notify != NULL)
+          r->handlers.on_notify(r);
+        continue;
+      }
+      if (conn->listener) {
+        reactor_accept(r, conn);
+        continue;
+      }
+
+      if ((conn->events & EPOLLOUT) && (reactor_epoll_flush(conn) != 0)) {
+        reactor_conn_shutdown(conn);
+        continue;
+      }
+
+      // Only waiting for the output to drain
+      if (conn->closing) {
+        if (!reactor_conn_pending(conn)
+            || (conn->events & (EPOLLERR | EPOLLHUP)))
+          reactor_conn_shutdown(conn);
+        continue;
+      }
+
+      // EPOLLOUT is only armed while output is pending
+      if ((conn->events & EPOLLOUT) && !reactor_conn_pending(conn)
+          && (r->handlers.on_drain != NULL)
+          && (r->handlers.on_drain(conn) == REACTOR_CLOSE))
+      {
+        reactor_close(conn);
+        continue;
+      }
+
+      if ((conn->events & ~(uint32_t)EPOLLOUT) && (conn->fd != -1)
+          && (r->handlers.on_data(conn) == REACTOR_CLOSE))
+        reactor_close(conn);
+    }
+
+    reactor_collect(r, false);
+  }
+
+  return 0;
+}
@@ -0,0 +1,124 @@
+#ifndef INCLUDE_UTILS_REACTOR_H_
+#define INCLUDE_UTILS_REACTOR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+
+#include "utils/pool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define REACTOR_DEFAULT_MAX_EVENTS 64
+#define REACTOR_WAIT_FOREVER -1
+
+#define REACTOR_BACKEND_EPOLL 0
+#define REACTOR_BACKEND_URING 1  // Falls back to epoll when not supported
+
+// Return values for the connection handlers
+#define REACTOR_KEEP 0
+#define REACTOR_CLOSE 1
+
+struct reactor;
+struct reactor_conn;
+struct ring;
+struct uring;
+
+struct reactor_handlers {
+  // Called after a connection is accepted and registered. Return < 0 to
+  // reject (close) it. Optional.
+  int (*on_open)(struct reactor_conn* conn);
+  // Called when the connection is readable, see reactor_recv. Return
+  // REACTOR_CLOSE to close it. Kept open past the end of file otherwise,
+  // until reactor_close.
+  int (*on_data)(struct reactor_conn* conn);
+  // Called right before the connection's fd is closed. Optional.
+  void (*on_close)(struct reactor_conn* conn);
+  // Called when epoll_wait times out. Return REACTOR_CLOSE to stop the loop.
+  // Optional, the loop keeps going when not provided.
+  int (*on_timeout)(struct reactor* r);
+  // Called after the eventfd given to reactor_add_notifier was written to,
+  // possibly more than once. Optional.
+  void (*on_notify)(struct reactor* r);
+  // Called once output that had to wait has all gone out, see
+  // reactor_pending. Return REACTOR_CLOSE to close the connection. Optional.
+  int (*on_drain)(struct reactor_conn* conn);
+};
+
+struct reactor_config {
+  int backend;
+  int max_events;  // Events handled per epoll_wait, 0 for the default
+  int timeout_ms;  // epoll_wait timeout, REACTOR_WAIT_FOREVER to block
+  struct reactor_handlers handlers;
+  void* udata;  // Server wide context, available as reactor->udata
+};
+
+// Lives in epoll_event.data.ptr for as long as the fd is registered
+struct reactor_conn {
+  int fd;  // -1 once closed
+  bool listener;
+  bool notifier;  // Wakes the loop up from other threads, not a connection
+  uint32_t events;  // Events reported by the last epoll_wait
+  void* udata;  // Per connection context, owned by the handlers
+  struct reactor* reactor;
+  size_t recv_max;  // reactor_recv stops and pauses past it, 0 for no limit
+  bool paused;  // Not reading, see reactor_pause
+
+  // Output not taken by the socket yet, see reactor_send
+  struct ring* out;
+  bool writable;  // EPOLLOUT armed, only while out has pending data
+  bool closing;  // Close requested, waiting for pending output to go out
+
+  // io_uring backend only
+  int inflight;  // Submitted operations that have not completed yet
+  char* rx;  // Data delivered by the last recv completion
+  size_t rx_size;
+  int rx_res;  // What reactor_recv reports once rx is consumed
+  struct ring* sending;  // Owned by the kernel while a send is in flight
+  uint64_t counter;  // eventfd reads land here, notifier only
+  bool receiving;  // Multishot recv armed, cancelled while paused
+
+  struct reactor_conn* next;
+  struct reactor_conn* prev;
+};
+
+struct reactor {
+  int backend;
+  int efd;
+  struct uring* ring;
+  int max_events;
+  int timeout_ms;
+  bool running;
+  struct epoll_event* events;
+  struct reactor_handlers handlers;
+  void* udata;
+  struct reactor_conn* conns;  // Every live connection, listeners included
+  struct reactor_conn* closed;  // Closed during this batch, freed after it
+  struct pool conn_pool;  // Recycles connections, only touched by the loop
+  int reserve_fd;  // Spare descriptor to shed connections on EMFILE
+  struct reactor_conn* starved;  // io_uring listener waiting for a free fd
+  struct reactor_conn* notifier;  // See reactor_add_notifier
+};
+
+int reactor_init(struct reactor** pr, struct reactor_config* cfg);
+void reactor_free(struct reactor** pr);
+int reactor_add_listener(struct reactor* r, int listen_fd);
+int reactor_add_notifier(struct reactor* r, int event_fd);
+int reactor_run(struct reactor* r);
+void reactor_stop(struct reactor* r);
+void reactor_close(struct reactor_conn* conn);
+int reactor_recv(struct reactor_conn* conn, struct ring* rg);
+int reactor_send(struct reactor_conn* conn, char* buf, int* len);
+int reactor_sendv(struct reactor_conn* conn, struct iovec* iov, int iovcnt);
+size_t reactor_pending(struct reactor_conn* conn);
+int reactor_pause(struct reactor_conn* conn);
+int reactor_resume(struct reactor_conn* conn);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // INCLUDE_UTILS_REACTOR_H_
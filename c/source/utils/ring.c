@@ -0,0 +1,251 @@
+#define _GNU_SOURCE
+
+#include <assert.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "log/log.h"
+#include "utils/ring.h"
+
+// Released rings, mapped and ready to be handed out again
+static _Thread_local struct ring* ring_cache = NULL;
+static _Thread_local size_t ring_cache_size = 0;
+
+static size_t ring_round_capacity(size_t capacity)
+{
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  size_t rounded = page;
+  while (rounded < capacity)
+    rounded *= 2;
+  return rounded;
+}
+
+// First cached ring big enough, unlinked from the cache
+static struct ring* ring_cache_take(size_t capacity)
+{
+  for (struct ring** pr = &ring_cache; *pr != NULL; pr = &(*pr)->next) {
+    struct ring* r = *pr;
+    if (r->capacity >= capacity) {
+      *pr = r->next;
+      ring_cache_size--;
+      return r;
+    }
+  }
+  return NULL;
+}
+
+// Map the same memfd twice in a row, so that data + capacity aliases data
+static char* ring_map(size_t capacity)
+{
+  int fd = memfd_create("ring", MFD_CLOEXEC);
+  if (fd == -1) {
+    log_error("ring_map: memfd_create failed: %s", strerror(errno));
+    return NULL;
+  }
+
+  char* data = MAP_FAILED;
+  if (ftruncate(fd, (off_t)capacity) == 0) {
+    // Reserve the whole range first, then place both views inside it
+    data = mmap(
+        NULL, 2 * capacity, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  }
+
+  for (size_t k = 0; (data != MAP_FAILED) && (k < 2); k++) {
+    void* view = mmap(data + k * capacity,
+                      capacity,
+                      PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_FIXED,
+                      fd,
+                      0);
+    if (view == MAP_FAILED) {
+      munmap(data, 2 * capacity);
+      data = MAP_FAILED;
+    }
+  }
+
+  if (data == MAP_FAILED)
+    log_error("ring_map: failed to map '%zu' bytes: %s",
+              capacity,
+              strerror(errno));
+
+  // The mappings keep the memory alive
+  close(fd);
+  return (data == MAP_FAILED ? NULL : data);
+}
+
+/**
+ * @brief Creates a ring with at least the given capacity.
+ *
+ * The capacity is rounded up to a power of 2 multiple of the page size. A
+ * ring released earlier on this thread is reused when one is big enough.
+ *
+ * @param pr Pointer to the ring to create. Must point to NULL.
+ * @return 0 on success, -1 if the memory could not be mapped.
+ */
+int ring_init(struct ring** pr, size_t capacity)
+{
+  assert(*pr == NULL);
+  assert(capacity > 0);
+
+  capacity = ring_round_capacity(capacity);
+  struct ring* r = ring_cache_take(capacity);
+  if (r == NULL) {
+    r = malloc(sizeof(struct ring));
+    assert(r != NULL);
+
+    r->capacity = capacity;
+    r->data = ring_map(r->capacity);
+    if (r->data == NULL) {
+      free(r);
+      return -1;
+    }
+  }
+  r->head = 0;
+  r->size = 0;
+  r->next = NULL;
+
+  *pr = r;
+  return 0;
+}
+
+/**
+ * @brief Releases a ring, small ones are kept in the cache of this thread.
+ */
+void ring_free(struct ring** pr)
+{
+  assert(*pr != NULL);
+
+  struct ring* r = *pr;
+  *pr = NULL;
+  if ((r->capacity <= RING_CACHE_MAX_CAPACITY)
+      && (ring_cache_size < RING_CACHE_MAX_RINGS))
+  {
+    r->next = ring_cache;
+    ring_cache = r;
+    ring_cache_size++;
+    return;
+  }
+
+  munmap(r->data, 2 * r->capacity);
+  free(r);
+}
+
+/**
+ * @brief Makes sure there is room to write at least size bytes.
+ *
+ * Grows the ring when needed, which is the only time the data moves. Pointers
+ * previously returned by the ring are invalid afterwards.
+ *
+ * @return 0 on success, -1 if the ring could not grow.
+ */
+int ring_reserve(struct ring* r, size_t size)
+{
+  assert(r != NULL);
+
+  if (r->capacity - r->size >= size)
+    return 0;
+
+  size_t capacity = ring_round_capacity(r->size + size);
+  char* data = ring_map(capacity);
+  if (data == NULL)
+    return -1;
+
+  log_info("ring_reserve(%p): expanding capacity to %zu", r, capacity);
+  memcpy(data, r->data + r->head, r->size);
+  munmap(r->data, 2 * r->capacity);
+  r->data = data;
+  r->capacity = capacity;
+  r->head = 0;
+  return 0;
+}
+
+/**
+ * @brief Copies data at the end of the ring, growing it if needed.
+ *
+ * @return 0 on success, -1 if the ring could not grow.
+ */
+int ring_push(struct ring* r, const char* data, size_t size)
+{
+  assert(r != NULL);
+  assert(data != NULL);
+
+  if (ring_reserve(r, size) != 0)
+    return -1;
+
+  memcpy(ring_write_ptr(r), data, size);
+  r->size += size;
+  return 0;
+}
+
+/**
+ * @brief Marks size bytes written at ring_write_ptr as readable.
+ */
+void ring_commit(struct ring* r, size_t size)
+{
+  assert(r != NULL);
+  assert(size <= r->capacity - r->size);
+
+  r->size += size;
+}
+
+/**
+ * @brief Drops size bytes from the front, the rest stays where it is.
+ */
+void ring_consume(struct ring* r, size_t size)
+{
+  assert(r != NULL);
+  assert(size <= r->size);
+
+  r->size -= size;
+  r->head += size;
+  if (r->head >= r->capacity)
+    r->head -= r->capacity;
+  // Keeps the next writes on the first view, closer to the last reads
+  if (r->size == 0)
+    r->head = 0;
+}
+
+void ring_reset(struct ring* r)
+{
+  assert(r != NULL);
+
+  r->head = 0;
+  r->size = 0;
+}
+
+/// First readable byte, r->size bytes are contiguous from there
+char* ring_read_ptr(struct ring* r)
+{
+  return r->data + r->head;
+}
+
+/// First writable byte, ring_space bytes are contiguous from there
+char* ring_write_ptr(struct ring* r)
+{
+  return r->data + r->head + r->size;
+}
+
+size_t ring_space(struct ring* r)
+{
+  return r->capacity - r->size;
+}
+
+void ring_read_iov(struct ring* r, struct iovec* iov)
+{
+  iov->iov_base = ring_read_ptr(r);
+  iov->iov_len = r->size;
+}
+
+void ring_write_iov(struct ring* r, struct iovec* iov)
+{
+  iov->iov_base = ring_write_ptr(r);
+  iov->iov_len = ring_space(r);
+}
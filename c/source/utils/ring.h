@@ -0,0 +1,44 @@
+#ifndef INCLUDE_UTILS_RING_H_
+#define INCLUDE_UTILS_RING_H_
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Byte ring buffer mapped twice, back to back, so that both the readable and
+// the writable regions are always contiguous. Data is consumed from the front
+// without moving whatever is left.
+struct ring {
+  char* data;
+  size_t capacity;  // Multiple of the page size
+  size_t head;  // Offset of the first readable byte, < capacity
+  size_t size;  // Readable bytes
+  struct ring* next;  // Link in the per-thread cache of released rings
+};
+
+// Released rings up to this capacity are kept mapped for the next ring_init
+// on the same thread, instead of going through memfd_create and mmap again
+#define RING_CACHE_MAX_CAPACITY (64 * 1024)
+#define RING_CACHE_MAX_RINGS 256
+
+int ring_init(struct ring** pr, size_t capacity);
+void ring_free(struct ring** pr);
+int ring_reserve(struct ring* r, size_t size);
+int ring_push(struct ring* r, const char* data, size_t size);
+void ring_commit(struct ring* r, size_t size);
+void ring_consume(struct ring* r, size_t size);
+void ring_reset(struct ring* r);
+char* ring_read_ptr(struct ring* r);
+char* ring_write_ptr(struct ring* r);
+size_t ring_space(struct ring* r);
+void ring_read_iov(struct ring* r, struct iovec* iov);
+void ring_write_iov(struct ring* r, struct iovec* iov);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // INCLUDE_UTILS_RING_H_
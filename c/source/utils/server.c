@@ -0,0 +1,224 @@
+#define _GNU_SOURCE
+
+#include <assert.h>
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "log/log.h"
+#include "utils/reactor.h"
+#include "utils/sockets.h"
+#include "utils/server.h"
+
+struct server_worker {
+  int id;
+  int listen_fd;
+  int result;
+  pthread_t thread;
+  struct reactor* reactor;
+  void* udata;
+  struct server_config* cfg;
+};
+
+static void server_usage(const char* prog)
+{
+  fprintf(stderr,
+          "usage: %s [-w|--workers N] [-u|--io-uring] [-b|--backlog N]\n"
+          "  -w, --workers N  worker threads, each with its own SO_REUSEPORT\n"
+          "                   listener. 0 uses one per online cpu\n"
+          "  -u, --io-uring   use io_uring instead of epoll when supported\n"
+          "  -b, --backlog N  pending connections queued by the kernel\n",
+          prog);
+}
+
+/**
+ * @brief Parses the command line options shared by all the servers.
+ *
+ * opts must come in with its defaults set, they are kept for the options not
+ * provided.
+ *
+ * @return 0 on success, -1 on invalid options.
+ */
+int server_options_parse(int argc, char* argv[], struct server_options* opts)
+{
+  assert(opts != NULL);
+
+  static const struct option long_opts[] = {
+      {"workers", required_argument, NULL, 'w'},
+      {"io-uring", no_argument, NULL, 'u'},
+      {"backlog", required_argument, NULL, 'b'},
+      {"help", no_argument, NULL, 'h'},
+      {NULL, 0, NULL, 0},
+  };
+
+  int c;
+  long val;
+  char* end;
+  while ((c = getopt_long(argc, argv, "w:ub:h", long_opts, NULL)) != -1) {
+    switch (c) {
+      case 'w':
+        errno = 0;
+        val = strtol(optarg, &end, 10);
+        if ((errno != 0) || (*end != 0) || (val < 0)
+            || (val > SERVER_MAX_WORKERS))
+        {
+          fprintf(stderr, "invalid number of workers: '%s'\n", optarg);
+          return -1;
+        }
+        if (val == 0)
+          val = sysconf(_SC_NPROCESSORS_ONLN);
+        opts->workers = (val > 0 ? (int)val : 1);
+        break;
+      case 'u':
+        opts->backend = REACTOR_BACKEND_URING;
+        break;
+      case 'b':
+        errno = 0;
+        val = strtol(optarg, &end, 10);
+        if ((errno != 0) || (*end != 0) || (val < 1) || (val > INT_MAX)) {
+          fprintf(stderr, "invalid backlog: '%s'\n", optarg);
+          return -1;
+        }
+        opts->backlog = (int)val;
+        break;
+      default:
+        server_usage(argv[0]);
+        return -1;
+    }
+  }
+
+  return 0;
+}
+
+static void server_worker_free(struct server_worker* w,
+                               struct server_config* cfg)
+{
+  if (w->reactor != NULL)
+    reactor_free(&w->reactor);
+  else if (w->listen_fd != -1)
+    close(w->listen_fd);
+  w->listen_fd = -1;
+
+  if ((cfg->worker_free != NULL) && (w->udata != NULL))
+    cfg->worker_free(w->udata);
+  w->udata = NULL;
+}
+
+static void* server_worker_run(void* arg)
+{
+  struct server_worker* w = arg;
+  log_info("server_worker_run: worker '%d' running", w->id);
+  w->result = reactor_run(w->reactor);
+  log_info("server_worker_run: worker '%d' done with '%d'", w->id, w->result);
+  // Right away, the kernel keeps handing its SO_REUSEPORT listener new
+  // connections while the other workers run
+  server_worker_free(w, w->cfg);
+  return NULL;
+}
+
+static int server_worker_init(struct server_worker* w,
+                              struct server_options* opts,
+                              struct server_config* cfg)
+{
+  if (create_server(
+          opts->port, (opts->workers > 1), opts->backlog, &w->listen_fd)
+      != 0)
+  {
+    log_error("server_worker_init: worker '%d' failed to listen", w->id);
+    return -1;
+  }
+
+  struct reactor_config rcfg = cfg->reactor;
+  rcfg.backend = opts->backend;
+  if (cfg->worker_init != NULL) {
+    if ((w->udata = cfg->worker_init(w->id)) == NULL) {
+      log_error("server_worker_init: worker '%d' has no context", w->id);
+      return -1;
+    }
+    rcfg.udata = w->udata;
+  }
+
+  if (reactor_init(&w->reactor, &rcfg) != 0) {
+    log_error("server_worker_init: worker '%d' failed to start", w->id);
+    return -1;
+  }
+  if (reactor_add_listener(w->reactor, w->listen_fd) != 0) {
+    // Still ours, server_worker_free only closes it without a reactor
+    log_error("server_worker_init: worker '%d' failed to listen", w->id);
+    close(w->listen_fd);
+    w->listen_fd = -1;
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * @brief Runs opts->workers reactors until all of them stop.
+ *
+ * With more than one worker every thread binds its own SO_REUSEPORT listener
+ * and the kernel spreads the incoming connections across them. A worker that
+ * stops closes its listener, the rest take its share from then on. The first
+ * worker runs on the calling thread.
+ *
+ * @return 0 if every worker stopped cleanly, -1 otherwise.
+ */
+int server_run(struct server_options* opts, struct server_config* cfg)
+{
+  assert(opts != NULL);
+  assert(cfg != NULL);
+  assert(opts->workers > 0);
+
+  int k, res = 0, started = 0;
+  struct server_worker* workers =
+      calloc((size_t)opts->workers, sizeof(struct server_worker));
+  assert(workers != NULL);
+
+  for (k = 0; k < opts->workers; k++) {
+    workers[k].id = k;
+    workers[k].listen_fd = -1;
+    workers[k].cfg = cfg;
+    if (server_worker_init(&workers[k], opts, cfg) != 0) {
+      res = -1;
+      break;
+    }
+  }
+  if (res == 0) {
+    log_info("server_run: listening on '%s' with '%d' workers",
+             opts->port,
+             opts->workers);
+    for (started = 1; started < opts->workers; started++) {
+      if (pthread_create(&workers[started].thread,
+                         NULL,
+                         server_worker_run,
+                         &workers[started])
+          != 0)
+      {
+        log_error("server_run: failed to start worker '%d'", started);
+        // Stop the kernel from routing connections to the idle listeners
+        for (k = started; k < opts->workers; k++)
+          server_worker_free(&workers[k], cfg);
+        break;
+      }
+    }
+
+    // Keep going with the threads that made it
+    server_worker_run(&workers[0]);
+    for (k = 1; k < started; k++)
+      pthread_join(workers[k].thread, NULL);
+    for (k = 0; k < started; k++)
+      if (workers[k].result != 0)
+        res = -1;
+  }
+
+  for (k = 0; k < opts->workers; k++)
+    server_worker_free(&workers[k], cfg);
+  free(workers);
+  return res;
+}
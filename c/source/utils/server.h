@@ -0,0 +1,36 @@
+#ifndef INCLUDE_UTILS_SERVER_H_
+#define INCLUDE_UTILS_SERVER_H_
+
+#include "utils/reactor.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SERVER_MAX_WORKERS 256
+
+struct server_options {
+  const char* port;
+  int workers;  // Threads, each one with its own listener and reactor
+  int backend;  // REACTOR_BACKEND_*
+  int backlog;  // Listen backlog, <= 0 for SOCKETS_DEFAULT_BACKLOG
+};
+
+struct server_config {
+  // Template for every worker's reactor
+  struct reactor_config reactor;
+  // Creates the worker's context, passed along as its reactor udata.
+  // Optional, reactor.udata is shared by all workers when not provided.
+  // Returning NULL fails the server start.
+  void* (*worker_init)(int id);
+  void (*worker_free)(void* udata);
+};
+
+int server_options_parse(int argc, char* argv[], struct server_options* opts);
+int server_run(struct server_options* opts, struct server_config* cfg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // INCLUDE_UTILS_SERVER_H_
@@ -1,5 +1,6 @@
 
 #define _POSIX_C_SOURCE 200112L
+#define _DEFAULT_SOURCE
 
 #include <assert.h>
 #include <errno.h>
@@ -18,9 +19,7 @@
 #include <stdatomic.h>
 
 #include "log/log.h"
-
-#define MAX_NUM_CON 10
-#define MAX_EVENTS 10
+#include "utils/sockets.h"
 
 int sendall(int sfd, char* buf, int* len)
 {
@@ -31,11 +30,7 @@ int sendall(int sfd, char* buf, int* len)
   long nbytes_sent = 0;
   int total_to_send = *len, total_sent = 0;
 
-  char msg[*len + 2];
-  memcpy(msg, buf, *len + 2);
-  msg[*len + 1] = 0;
-  log_trace(msg);
-  /*return 0;*/
+  log_trace("sendall: sending '%d' bytes on fd '%d'", *len, sfd);
 
   for (; nbytes_sent < total_to_send;) {
     nbytes_sent = send(sfd, buf, (size_t)total_to_send, 0);
@@ -62,7 +57,23 @@ int sendall(int sfd, char* buf, int* len)
   return 0;
 }
 
-int create_server(const char* port, int* listen_fd)
+/**
+ * @brief Creates a listening socket bound to port on any address.
+ *
+ * The socket is non-blocking, so accepting until EAGAIN drains the backlog.
+ *
+ * @param port Port to bind to.
+ * @param reuseport Set SO_REUSEPORT, so several sockets can share the port
+ * and the kernel balances the connections among them.
+ * @param backlog Pending connections queued by the kernel, <= 0 for
+ * SOCKETS_DEFAULT_BACKLOG.
+ * @param listen_fd Where to store the listening socket.
+ * @return 0 on success, -1 if binding failed, -2 if listening failed.
+ */
+int create_server(const char* port,
+                  bool reuseport,
+                  int backlog,
+                  int* listen_fd)
 {
   assert(port != NULL);
   assert(listen_fd != NULL);
@@ -85,14 +96,26 @@ int create_server(const char* port, int* listen_fd)
     return -1;
   }
 
-  int fd;
+  int fd, on = 1;
   struct addrinfo* rp;
   log_trace("main: passed getaddrinfo");
   for (rp = result; rp != NULL; rp = rp->ai_next) {
-    fd = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+    fd = socket(rp->ai_family,
+                rp->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                rp->ai_protocol);
     if (fd == -1)
       continue;
 
+    // Allow restarting while old connections linger in TIME_WAIT
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (reuseport
+        && (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) == -1))
+    {
+      log_error("create_server: SO_REUSEPORT failed: %s", strerror(errno));
+      close(fd);
+      continue;
+    }
+
     if (bind(fd, rp->ai_addr, rp->ai_addrlen) == 0) {
       log_info("main results loop: we binded to port '%s' baby!!!", port);
       break; /* Success */
@@ -109,8 +132,11 @@ int create_server(const char* port, int* listen_fd)
     return -1;
   }
 
-  if (listen(fd, MAX_NUM_CON) == -1) {
+  if (backlog <= 0)
+    backlog = SOCKETS_DEFAULT_BACKLOG;
+  if (listen(fd, backlog) == -1) {
     perror("listen failed\n");
+    close(fd);
     return -2;
   }
 
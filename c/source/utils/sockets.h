@@ -1,8 +1,15 @@
 #ifndef INCLUDE_UTILS_SOCKETS_H_
 #define INCLUDE_UTILS_SOCKETS_H_
 
+// Pending connections the kernel queues for accept. It clamps the value to
+// net.core.somaxconn
+#define SOCKETS_DEFAULT_BACKLOG 4096
+
 int sendall(int sfd, char* buf, int* len);
 
-int create_server(const char* port, int* listen_fd);
+int create_server(const char* port,
+                  bool reuseport,
+                  int backlog,
+                  int* listen_fd);
 
 #endif  // INCLUDE_UTILS_SOCKETS_H_
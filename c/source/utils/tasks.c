@@ -0,0 +1,229 @@
+#define _GNU_SOURCE
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "log/log.h"
+#include "utils/tasks.h"
+
+/**
+ * @brief Hands task back to its inbox, as if the pool had just run it.
+ *
+ * For tasks held with tasks_inbox_hold, the pool puts back the ones it runs.
+ * Safe from any thread.
+ */
+void tasks_inbox_put(struct tasks_inbox* in, struct task* task)
+{
+  assert(in != NULL);
+  assert(task != NULL);
+
+  uint64_t one = 1;
+  pthread_mutex_lock(&in->lock);
+  task->next = NULL;
+  if (in->tail != NULL)
+    in->tail->next = task;
+  else
+    in->head = task;
+  in->tail = task;
+  in->running--;
+
+  // Still under the lock, tasks_inbox_drain may close the fd right after
+  if (write(in->notify_fd, &one, sizeof(one)) != sizeof(one))
+    log_warn("tasks_inbox_put: eventfd write failed: %s", strerror(errno));
+  if (in->running == 0)
+    pthread_cond_broadcast(&in->idle);
+  pthread_mutex_unlock(&in->lock);
+}
+
+static void* tasks_thread(void* arg)
+{
+  struct tasks* t = arg;
+  for (;;) {
+    pthread_mutex_lock(&t->lock);
+    while ((t->head == NULL) && !t->stopping)
+      pthread_cond_wait(&t->ready, &t->lock);
+    struct task* task = t->head;
+    if (task == NULL) {
+      pthread_mutex_unlock(&t->lock);
+      return NULL;
+    }
+    t->head = task->next;
+    if (t->head == NULL)
+      t->tail = NULL;
+    pthread_mutex_unlock(&t->lock);
+
+    task->run(task);
+    tasks_inbox_put(task->inbox, task);
+  }
+}
+
+/**
+ * @brief Starts a pool of threads running tasks.
+ *
+ * @param pt Pointer to the pool to create. Must point to NULL.
+ * @param threads How many, clamped to [1, TASKS_MAX_THREADS].
+ * @return 0 on success, -1 if no thread could be started.
+ */
+int tasks_init(struct tasks** pt, int threads)
+{
+  assert(*pt == NULL);
+
+  struct tasks* t = calloc(1, sizeof(struct tasks));
+  assert(t != NULL);
+  pthread_mutex_init(&t->lock, NULL);
+  pthread_cond_init(&t->ready, NULL);
+  if (threads < 1)
+    threads = 1;
+  if (threads > TASKS_MAX_THREADS)
+    threads = TASKS_MAX_THREADS;
+
+  for (; t->nthreads < threads; t->nthreads++) {
+    if (pthread_create(&t->threads[t->nthreads], NULL, tasks_thread, t) != 0)
+    {
+      log_warn(
+          "tasks_init: started '%d' of '%d' threads", t->nthreads, threads);
+      break;
+    }
+  }
+
+  if (t->nthreads == 0) {
+    tasks_free(&t);
+    return -1;
+  }
+  *pt = t;
+  return 0;
+}
+
+/**
+ * @brief Runs whatever is still queued and stops the threads.
+ */
+void tasks_free(struct tasks** pt)
+{
+  assert(*pt != NULL);
+
+  struct tasks* t = *pt;
+  pthread_mutex_lock(&t->lock);
+  t->stopping = true;
+  pthread_cond_broadcast(&t->ready);
+  pthread_mutex_unlock(&t->lock);
+  for (int k = 0; k < t->nthreads; k++)
+    pthread_join(t->threads[k], NULL);
+
+  pthread_cond_destroy(&t->ready);
+  pthread_mutex_destroy(&t->lock);
+  free(t);
+  *pt = NULL;
+}
+
+/**
+ * @brief Queues task, it comes back through task->inbox once run.
+ *
+ * Safe from any thread. The task must stay valid until taken back.
+ */
+void tasks_submit(struct tasks* t, struct task* task)
+{
+  assert(t != NULL);
+  assert(task != NULL);
+  assert(task->run != NULL);
+  assert(task->inbox != NULL);
+
+  tasks_inbox_hold(task->inbox);
+  task->next = NULL;
+  pthread_mutex_lock(&t->lock);
+  if (t->tail != NULL)
+    t->tail->next = task;
+  else
+    t->head = task;
+  t->tail = task;
+  pthread_cond_signal(&t->ready);
+  pthread_mutex_unlock(&t->lock);
+}
+
+/**
+ * @brief Initializes an empty inbox along with its eventfd.
+ *
+ * @return 0 on success, -1 if the eventfd could not be created.
+ */
+int tasks_inbox_init(struct tasks_inbox* in)
+{
+  assert(in != NULL);
+
+  in->notify_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (in->notify_fd == -1) {
+    log_error("tasks_inbox_init: eventfd failed: %s", strerror(errno));
+    return -1;
+  }
+  pthread_mutex_init(&in->lock, NULL);
+  pthread_cond_init(&in->idle, NULL);
+  in->head = NULL;
+  in->tail = NULL;
+  in->running = 0;
+  return 0;
+}
+
+/**
+ * @brief Counts one more task coming back to in, without submitting it.
+ *
+ * For work that finishes some other way, tasks_inbox_put hands it back
+ * then. tasks_inbox_drain waits for it meanwhile.
+ */
+void tasks_inbox_hold(struct tasks_inbox* in)
+{
+  assert(in != NULL);
+
+  pthread_mutex_lock(&in->lock);
+  in->running++;
+  pthread_mutex_unlock(&in->lock);
+}
+
+/**
+ * @brief Waits until every task submitted for in is back.
+ *
+ * They are left in it, see tasks_inbox_take.
+ */
+void tasks_inbox_drain(struct tasks_inbox* in)
+{
+  assert(in != NULL);
+
+  pthread_mutex_lock(&in->lock);
+  while (in->running > 0)
+    pthread_cond_wait(&in->idle, &in->lock);
+  pthread_mutex_unlock(&in->lock);
+}
+
+/**
+ * @brief Takes every task that is back, oldest first, linked through next.
+ */
+struct task* tasks_inbox_take(struct tasks_inbox* in)
+{
+  assert(in != NULL);
+
+  pthread_mutex_lock(&in->lock);
+  struct task* head = in->head;
+  in->head = NULL;
+  in->tail = NULL;
+  pthread_mutex_unlock(&in->lock);
+  return head;
+}
+
+/// Drain and take the tasks left first, the inbox must be empty
+void tasks_inbox_destroy(struct tasks_inbox* in)
+{
+  assert(in != NULL);
+  assert(in->running == 0);
+  assert(in->head == NULL);
+
+  close(in->notify_fd);
+  in->notify_fd = -1;
+  pthread_cond_destroy(&in->idle);
+  pthread_mutex_destroy(&in->lock);
+}
@@ -0,0 +1,61 @@
+#ifndef INCLUDE_UTILS_TASKS_H_
+#define INCLUDE_UTILS_TASKS_H_
+
+#include <pthread.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TASKS_MAX_THREADS 256
+
+struct tasks_inbox;
+
+// Work handed to the pool. Embed it in whatever the work needs and get back
+// to the enclosing struct from run.
+struct task {
+  void (*run)(struct task* t);  // On one of the pool threads
+  struct tasks_inbox* inbox;  // Gets the task back once run
+  struct task* next;
+};
+
+// Tasks run for one owner, typically a reactor thread, in completion order.
+// Every time one lands in it notify_fd gets written to, see
+// reactor_add_notifier.
+struct tasks_inbox {
+  pthread_mutex_t lock;
+  pthread_cond_t idle;
+  struct task* head;
+  struct task* tail;
+  size_t running;  // Submitted and not back yet
+  int notify_fd;  // eventfd, owned by the inbox
+};
+
+// Fixed set of threads running tasks in submission order
+struct tasks {
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+  struct task* head;
+  struct task* tail;
+  bool stopping;
+  int nthreads;
+  pthread_t threads[TASKS_MAX_THREADS];
+};
+
+int tasks_init(struct tasks** pt, int threads);
+void tasks_free(struct tasks** pt);
+void tasks_submit(struct tasks* t, struct task* task);
+
+int tasks_inbox_init(struct tasks_inbox* in);
+void tasks_inbox_destroy(struct tasks_inbox* in);
+struct task* tasks_inbox_take(struct tasks_inbox* in);
+void tasks_inbox_drain(struct tasks_inbox* in);
+void tasks_inbox_hold(struct tasks_inbox* in);
+void tasks_inbox_put(struct tasks_inbox* in, struct task* task);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // INCLUDE_UTILS_TASKS_H_
@@ -0,0 +1,343 @@
+#define _GNU_SOURCE
+
+#include <assert.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+
+#include "log/log.h"
+#include "utils/uring.h"
+
+static int uring_setup(unsigned entries, struct io_uring_params* p)
+{
+  return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter(int fd,
+                       unsigned to_submit,
+                       unsigned min_complete,
+                       unsigned flags,
+                       void* arg,
+                       size_t argsz)
+{
+  return (int)syscall(
+      __NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static int uring_register(int fd, unsigned opcode, void* arg, unsigned nargs)
+{
+  return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nargs);
+}
+
+static int uring_map_rings(struct uring* u, struct io_uring_params* p)
+{
+  u->sq_ptr_size = p->sq_off.array + p->sq_entries * sizeof(unsigned);
+  u->cq_ptr_size = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+  if (p->features & IORING_FEAT_SINGLE_MMAP) {
+    if (u->cq_ptr_size > u->sq_ptr_size)
+      u->sq_ptr_size = u->cq_ptr_size;
+    u->cq_ptr_size = u->sq_ptr_size;
+  }
+
+  u->sq_ptr = mmap(NULL,
+                   u->sq_ptr_size,
+                   PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE,
+                   u->fd,
+                   IORING_OFF_SQ_RING);
+  if (u->sq_ptr == MAP_FAILED)
+    return -1;
+
+  if (p->features & IORING_FEAT_SINGLE_MMAP) {
+    u->cq_ptr = u->sq_ptr;
+  } else {
+    u->cq_ptr = mmap(NULL,
+                     u->cq_ptr_size,
+                     PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE,
+                     u->fd,
+                     IORING_OFF_CQ_RING);
+    if (u->cq_ptr == MAP_FAILED)
+      return -1;
+  }
+
+  u->sqes_size = p->sq_entries * sizeof(struct io_uring_sqe);
+  u->sqes = mmap(NULL,
+                 u->sqes_size,
+                 PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE,
+                 u->fd,
+                 IORING_OFF_SQES);
+  if (u->sqes == MAP_FAILED)
+    return -1;
+
+  char* sq = u->sq_ptr;
+  u->sq_head = (unsigned*)(sq + p->sq_off.head);
+  u->sq_tail = (unsigned*)(sq + p->sq_off.tail);
+  u->sq_mask = *(unsigned*)(sq + p->sq_off.ring_mask);
+  // sqes are always used in ring order, so the index array is the identity
+  unsigned* array = (unsigned*)(sq + p->sq_off.array);
+  for (unsigned k = 0; k < p->sq_entries; k++)
+    array[k] = k;
+
+  char* cq = u->cq_ptr;
+  u->cq_head = (unsigned*)(cq + p->cq_off.head);
+  u->cq_tail = (unsigned*)(cq + p->cq_off.tail);
+  u->cq_mask = *(unsigned*)(cq + p->cq_off.ring_mask);
+  u->cqes = (struct io_uring_cqe*)(cq + p->cq_off.cqes);
+  return 0;
+}
+
+static int uring_setup_buffers(struct uring* u)
+{
+  u->buf_size = URING_BUF_SIZE;
+  u->br_mask = URING_BUF_COUNT - 1;
+  u->br_size = URING_BUF_COUNT * sizeof(struct io_uring_buf);
+  u->br = mmap(NULL,
+               u->br_size,
+               PROT_READ | PROT_WRITE,
+               MAP_ANONYMOUS | MAP_PRIVATE,
+               -1,
+               0);
+  if (u->br == MAP_FAILED) {
+    u->br = NULL;
+    return -1;
+  }
+
+  struct io_uring_buf_reg reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (uint64_t)(uintptr_t)u->br;
+  reg.ring_entries = URING_BUF_COUNT;
+  reg.bgid = URING_BUF_GROUP;
+  if (uring_register(u->fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1)
+    return -1;
+
+  u->bufs = malloc((size_t)URING_BUF_COUNT * u->buf_size);
+  assert(u->bufs != NULL);
+
+  u->br_tail = 0;
+  for (uint16_t bid = 0; bid < URING_BUF_COUNT; bid++)
+    uring_buf_recycle(u, bid);
+  return 0;
+}
+
+/**
+ * @brief Creates an io_uring instance with a provided buffer ring for recv.
+ *
+ * @param pu Where to store the ring. Must point to NULL.
+ * @param entries Submission queue entries.
+ * @return 0 on success, -1 if the kernel lacks any of the needed features.
+ */
+int uring_init(struct uring** pu, unsigned entries)
+{
+  assert(*pu == NULL);
+
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  // Not SINGLE_ISSUER, the ring is created on the main thread and driven
+  // by its worker thread
+  p.flags = IORING_SETUP_COOP_TASKRUN;
+  int fd = uring_setup(entries, &p);
+  if ((fd == -1) && (errno == EINVAL)) {
+    memset(&p, 0, sizeof(p));
+    fd = uring_setup(entries, &p);
+  }
+  if (fd == -1) {
+    log_warn("uring_init: io_uring_setup failed: %s", strerror(errno));
+    return -1;
+  }
+
+  struct uring* u = calloc(1, sizeof(struct uring));
+  assert(u != NULL);
+  u->fd = fd;
+
+  if (!(p.features & IORING_FEAT_EXT_ARG)) {
+    log_warn("uring_init: kernel lacks IORING_FEAT_EXT_ARG");
+    uring_free(&u);
+    return -1;
+  }
+
+  if (uring_map_rings(u, &p) != 0) {
+    log_warn("uring_init: mmap failed: %s", strerror(errno));
+    uring_free(&u);
+    return -1;
+  }
+
+  if (uring_setup_buffers(u) != 0) {
+    log_warn("uring_init: buffer ring failed: %s", strerror(errno));
+    uring_free(&u);
+    return -1;
+  }
+
+  *pu = u;
+  return 0;
+}
+
+void uring_free(struct uring** pu)
+{
+  assert(*pu != NULL);
+
+  struct uring* u = *pu;
+  if ((u->sqes != NULL) && (u->sqes != MAP_FAILED))
+    munmap(u->sqes, u->sqes_size);
+  if ((u->cq_ptr != NULL) && (u->cq_ptr != MAP_FAILED)
+      && (u->cq_ptr != u->sq_ptr))
+    munmap(u->cq_ptr, u->cq_ptr_size);
+  if ((u->sq_ptr != NULL) && (u->sq_ptr != MAP_FAILED))
+    munmap(u->sq_ptr, u->sq_ptr_size);
+  // Closing the ring cancels whatever is still in flight
+  close(u->fd);
+  if (u->br != NULL)
+    munmap(u->br, u->br_size);
+  free(u->bufs);
+  free(u);
+  *pu = NULL;
+}
+
+/**
+ * @brief Returns the next free submission entry, zeroed.
+ *
+ * Entries are only handed to the kernel on the next uring_submit_and_wait,
+ * unless the submission queue is full.
+ */
+struct io_uring_sqe* uring_get_sqe(struct uring* u)
+{
+  assert(u != NULL);
+
+  unsigned tail = *u->sq_tail;
+  unsigned head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+  if (tail - head > u->sq_mask) {
+    // Full, flush what we have
+    int res = uring_enter(u->fd, u->to_submit, 0, 0, NULL, 0);
+    if (res < 0) {
+      log_error("uring_get_sqe: io_uring_enter failed: %s", strerror(errno));
+      return NULL;
+    }
+    u->to_submit -= (unsigned)res;
+    head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+    if (tail - head > u->sq_mask)
+      return NULL;
+  }
+
+  struct io_uring_sqe* sqe = &u->sqes[tail & u->sq_mask];
+  memset(sqe, 0, sizeof(*sqe));
+  __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  u->to_submit++;
+  return sqe;
+}
+
+/**
+ * @brief Submits every pending entry and waits for at least one completion.
+ *
+ * @param timeout_ms Max time to wait, -1 to wait forever.
+ * @return 0 on success, -ETIME on timeout, -errno on failure.
+ */
+int uring_submit_and_wait(struct uring* u, int timeout_ms)
+{
+  assert(u != NULL);
+
+  struct __kernel_timespec ts;
+  struct io_uring_getevents_arg arg;
+  memset(&arg, 0, sizeof(arg));
+  arg.sigmask_sz = _NSIG / 8;
+  if (timeout_ms >= 0) {
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+    arg.ts = (uint64_t)(uintptr_t)&ts;
+  }
+
+  int res = uring_enter(u->fd,
+                        u->to_submit,
+                        1,
+                        IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                        &arg,
+                        sizeof(arg));
+  if (res < 0)
+    return -errno;
+  u->to_submit -= (unsigned)res;
+  return 0;
+}
+
+struct io_uring_cqe* uring_peek_cqe(struct uring* u)
+{
+  unsigned head = *u->cq_head;
+  if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE))
+    return NULL;
+  return &u->cqes[head & u->cq_mask];
+}
+
+void uring_cqe_seen(struct uring* u)
+{
+  __atomic_store_n(u->cq_head, *u->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+char* uring_buf(struct uring* u, uint16_t bid)
+{
+  return u->bufs + (size_t)bid * u->buf_size;
+}
+
+/// Hand a provided buffer back to the kernel
+void uring_buf_recycle(struct uring* u, uint16_t bid)
+{
+  struct io_uring_buf* buf = &u->br->bufs[u->br_tail & u->br_mask];
+  buf->addr = (uint64_t)(uintptr_t)uring_buf(u, bid);
+  buf->len = (uint32_t)u->buf_size;
+  buf->bid = bid;
+  u->br_tail++;
+  __atomic_store_n(&u->br->tail, u->br_tail, __ATOMIC_RELEASE);
+}
+
+void uring_prep_accept_multishot(struct io_uring_sqe* sqe, int fd)
+{
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = fd;
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->accept_flags = SOCK_CLOEXEC;
+}
+
+void uring_prep_recv_multishot(struct io_uring_sqe* sqe, int fd)
+{
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = fd;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = URING_BUF_GROUP;
+}
+
+void uring_prep_send(struct io_uring_sqe* sqe, int fd, char* buf, size_t len)
+{
+  sqe->opcode = IORING_OP_SEND;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)(uintptr_t)buf;
+  sqe->len = (uint32_t)len;
+  sqe->msg_flags = MSG_NOSIGNAL;
+}
+
+void uring_prep_read(struct io_uring_sqe* sqe, int fd, void* buf, size_t len)
+{
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)(uintptr_t)buf;
+  sqe->len = (uint32_t)len;
+  sqe->off = (uint64_t)-1;  // Current position, eventfds have none
+}
+
+// Cancels the operation submitted with user_data, it completes -ECANCELED
+void uring_prep_cancel(struct io_uring_sqe* sqe, uint64_t user_data)
+{
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = -1;
+  sqe->addr = user_data;
+}
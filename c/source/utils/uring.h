@@ -0,0 +1,70 @@
+#ifndef INCLUDE_UTILS_URING_H_
+#define INCLUDE_UTILS_URING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Minimal io_uring wrapper over the raw syscalls. Requires linux >= 6.0 for
+// the provided buffer ring and multishot accept/recv.
+
+#define URING_ENTRIES 256
+#define URING_BUF_GROUP 0
+#define URING_BUF_COUNT 512  // Power of 2
+#define URING_BUF_SIZE 4096
+
+struct uring {
+  int fd;
+  unsigned to_submit;  // sqes filled since the last io_uring_enter
+
+  // Submission queue
+  unsigned* sq_head;
+  unsigned* sq_tail;
+  unsigned sq_mask;
+  struct io_uring_sqe* sqes;
+
+  // Completion queue
+  unsigned* cq_head;
+  unsigned* cq_tail;
+  unsigned cq_mask;
+  struct io_uring_cqe* cqes;
+
+  // Provided buffers, the kernel picks one per recv completion
+  struct io_uring_buf_ring* br;
+  unsigned short br_tail;
+  unsigned br_mask;
+  char* bufs;
+  size_t buf_size;
+
+  void* sq_ptr;
+  size_t sq_ptr_size;
+  void* cq_ptr;
+  size_t cq_ptr_size;
+  size_t sqes_size;
+  size_t br_size;
+};
+
+int uring_init(struct uring** pu, unsigned entries);
+void uring_free(struct uring** pu);
+struct io_uring_sqe* uring_get_sqe(struct uring* u);
+int uring_submit_and_wait(struct uring* u, int timeout_ms);
+struct io_uring_cqe* uring_peek_cqe(struct uring* u);
+void uring_cqe_seen(struct uring* u);
+char* uring_buf(struct uring* u, uint16_t bid);
+void uring_buf_recycle(struct uring* u, uint16_t bid);
+
+void uring_prep_accept_multishot(struct io_uring_sqe* sqe, int fd);
+void uring_prep_recv_multishot(struct io_uring_sqe* sqe, int fd);
+void uring_prep_send(struct io_uring_sqe* sqe, int fd, char* buf, size_t len);
+void uring_prep_read(struct io_uring_sqe* sqe, int fd, void* buf, size_t len);
+void uring_prep_cancel(struct io_uring_sqe* sqe, uint64_t user_data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // INCLUDE_UTILS_URING_H_
@@ -18,12 +18,24 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <stdatomic.h>
+#include <pthread.h>
 
 #include "log/log.h"
-#include "utils/queue.h"
+#include "utils/ring.h"
 
 #include "utils/utils.h"
 
+static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void log_lock_fn(bool lock, void* udata)
+{
+  pthread_mutex_t* mutex = udata;
+  if (lock)
+    pthread_mutex_lock(mutex);
+  else
+    pthread_mutex_unlock(mutex);
+}
+
 int init_logs(FILE* fd, int log_level)
 {
   if (log_add_fp(fd, log_level) == -1) {
@@ -35,29 +47,52 @@ int init_logs(FILE* fd, int log_level)
 
   log_set_quiet(true);
 
+  // Worker threads share the log file
+  log_set_lock(log_lock_fn, &log_mutex);
+
+  // Format and write from a background thread, the handlers only pay for
+  // copying the arguments. Whatever is pending goes out on exit.
+  if (log_async_start() != 0) {
+    log_warn("init_logs: failed to start the log thread, logging inline");
+    return 0;
+  }
+  atexit(log_async_stop);
+
   return 0;
 }
 
 /**
  * @brief Receive from socket fd while there isn't an event
  *
- * @param ctx Pointer to structure to hold context
- * @param qu Pointer to queue to store all the received data
+ * Data goes straight into the ring's writable region, which grows when full.
+ *
+ * @param fd Socket to read from
+ * @param rg Ring to append all the received data to
+ * @param max Stops once rg holds that many bytes, 0 for no limit
  * @return
  *    0 if close event received
- *    -1 if EWOULDBLOCK received
+ *    -1 if EWOULDBLOCK received or rg is full
  *    -2 for any other kind of error
  */
-int recv_request(int fd, struct queue* qu)
+int recv_request(int fd, struct ring* rg, size_t max)
 {
   assert(fd > 0);
-  assert(qu != NULL);
+  assert(rg != NULL);
 
   ssize_t nbytes;
 
   for (;;) {
-    // TODO: code smell here. Do not manipulate queue this way
-    nbytes = recv(fd, qu->head, qu->free_capacity, 0);
+    if ((max > 0) && (rg->size >= max))
+      return -1;
+    if ((ring_space(rg) == 0) && (ring_reserve(rg, rg->capacity) != 0)) {
+      log_error("recv_request: out of memory for fd '%d'", fd);
+      return -2;
+    }
+
+    size_t space = ring_space(rg);
+    if ((max > 0) && (space > max - rg->size))
+      space = max - rg->size;
+    nbytes = recv(fd, ring_write_ptr(rg), space, 0);
     if (nbytes == 0) {
       log_warn("recv_request: handling close while reading on fd '%d'", fd);
       return 0;
@@ -73,6 +108,6 @@ int recv_request(int fd, struct queue* qu)
       return -2;
     }
     log_trace("recv_request: read '%d' bytes from fd '%d'", nbytes, fd);
-    queue_push_ex(qu, (size_t)nbytes);
+    ring_commit(rg, (size_t)nbytes);
   }
 }
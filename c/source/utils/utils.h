@@ -3,6 +3,6 @@
 
 int init_logs(FILE* fd, int log_level);
 
-int recv_request(int fd, struct queue* qu);
+int recv_request(int fd, struct ring* rg, size_t max);
 
 #endif  // INCLUDE_UTILS_UTILS_H_
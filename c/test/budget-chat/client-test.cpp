@@ -15,8 +15,10 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <string>
+
 #include <catch2/catch.hpp>
-#include "utils/queue.h"
+#include "utils/ring.h"
 #include "budget-chat/client.h"
 
 
@@ -29,13 +31,12 @@ TEST_CASE("client_open creates a new client", "[client]") {
     REQUIRE(c != nullptr);
     REQUIRE(c->id == fd);
     REQUIRE(c->name[0] == 0);
-    REQUIRE(c->recv_qu != nullptr);
+    REQUIRE(c->recv_rg != nullptr);
     REQUIRE(c->next == nullptr);
     REQUIRE(c->prev == nullptr);
 
     // Clean up
-    queue_free(&(c->recv_qu));
-    free(c);
+    client_free(&c);
 }
 
 TEST_CASE("client_close removes a client", "[client]") {
@@ -79,8 +80,7 @@ TEST_CASE("client_find locates a client by id", "[client]") {
     // Clean up
     while (c != nullptr) {
         struct client* next = c->next;
-        queue_free(&(c->recv_qu));
-        free(c);
+        client_free(&c);
         c = next;
     }
 }
@@ -93,7 +93,7 @@ TEST_CASE("client_handle_request processes client requests", "[client]") {
 
     SECTION("New client without name") {
         char* test_name = "TestUser\r";
-        queue_push(c->recv_qu, test_name, strlen(test_name));
+        ring_push(c->recv_rg, test_name, strlen(test_name));
 
         int result = client_handle_request(c);
         REQUIRE(result == 1);
@@ -103,15 +103,14 @@ TEST_CASE("client_handle_request processes client requests", "[client]") {
     SECTION("Existing client with message") {
         strcpy(c->name, "ExistingUser");
         char* test_message = "Hello, World!\r";
-        queue_push(c->recv_qu, test_message, strlen(test_message));
+        ring_push(c->recv_rg, test_message, strlen(test_message));
 
         int result = client_handle_request(c);
         REQUIRE(result == 1);
     }
 
     // Clean up
-    queue_free(&(c->recv_qu));
-    free(c);
+    client_free(&c);
 }
 
 TEST_CASE("client_handle_request processes new client requests", "[client]") {
@@ -126,7 +125,7 @@ TEST_CASE("client_handle_request processes new client requests", "[client]") {
 
   SECTION("New client with unique name") {
     char* test_name = "UniqueUser\r";
-    queue_push(c1->recv_qu, test_name, strlen(test_name));
+    ring_push(c1->recv_rg, test_name, strlen(test_name));
 
     int result = client_handle_request(c1);
     REQUIRE(result == 1);
@@ -138,7 +137,7 @@ TEST_CASE("client_handle_request processes new client requests", "[client]") {
     c2->name_size = strlen("ExistingUser");
 
     char* test_name = "ExistingUser\r";
-    queue_push(c1->recv_qu, test_name, strlen(test_name));
+    ring_push(c1->recv_rg, test_name, strlen(test_name));
 
     int result = client_handle_request(c1);
     REQUIRE(result == -1);
@@ -147,7 +146,7 @@ TEST_CASE("client_handle_request processes new client requests", "[client]") {
 
   SECTION("New client with empty name") {
     char* test_name = "\r";
-    queue_push(c1->recv_qu, test_name, strlen(test_name));
+    ring_push(c1->recv_rg, test_name, strlen(test_name));
 
     int result = client_handle_request(c1);
     REQUIRE(result == -1);
@@ -159,7 +158,7 @@ TEST_CASE("client_handle_request processes new client requests", "[client]") {
     memset(long_name, 'a', CLIENT_MAX_NAME + 9);
     long_name[CLIENT_MAX_NAME + 9] = '\r';
 
-    queue_push(c1->recv_qu, long_name, CLIENT_MAX_NAME + 10);
+    ring_push(c1->recv_rg, long_name, CLIENT_MAX_NAME + 10);
 
     int result = client_handle_request(c1);
     REQUIRE(result == -1);
@@ -168,7 +167,7 @@ TEST_CASE("client_handle_request processes new client requests", "[client]") {
 
   SECTION("New client with non-alphanumeric characters") {
     char* test_name = "Invalid!User@123\r";
-    queue_push(c1->recv_qu, test_name, strlen(test_name));
+    ring_push(c1->recv_rg, test_name, strlen(test_name));
 
     int result = client_handle_request(c1);
     REQUIRE(result == -1);
@@ -176,8 +175,39 @@ TEST_CASE("client_handle_request processes new client requests", "[client]") {
   }
 
   // Clean up
-  queue_free(&(c1->recv_qu));
-  queue_free(&(c2->recv_qu));
-  free(c1);
-  free(c2);
+  client_free(&c1);
+  client_free(&c2);
+}
+
+TEST_CASE("client_handle_request relays the longest message whole", "[client]") {
+  int fds[2];
+  REQUIRE(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) == 0);
+  struct client* c1 = nullptr;
+  struct client* c2 = nullptr;
+  client_open(&c1, 10);
+  client_open(&c2, fds[0]);
+  c1->next = c2;
+  c2->prev = c1;
+  strcpy(c2->name, "Peer");
+  c2->name_size = strlen("Peer");
+
+  std::string name(CLIENT_MAX_NAME - 1, 'n');
+  strcpy(c1->name, name.c_str());
+  c1->name_size = name.size();
+  std::string message(CLIENT_MAX_MESSAGE_SIZE, 'm');
+  message += MESSAGE_DELIMETER;
+  ring_push(c1->recv_rg, message.data(), message.size());
+  REQUIRE(client_handle_request(c1) == 1);
+
+  std::string got;
+  char buf[4096];
+  ssize_t n;
+  while ((n = read(fds[1], buf, sizeof(buf))) > 0)
+    got.append(buf, static_cast<size_t>(n));
+  REQUIRE(got == CLIENT_WELCOME_PROMPT "[" + name + "] " + message);
+
+  client_free(&c1);
+  client_free(&c2);
+  close(fds[0]);
+  close(fds[1]);
 }
@@ -0,0 +1,76 @@
+#include <stdint.h>
+#include <string.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include <catch2/catch.hpp>
+#include "utils/frame.h"
+
+static std::vector<uint32_t> scan(int isa, const std::string& data, size_t max)
+{
+  std::vector<uint32_t> ends(max);
+  size_t n =
+      frame_scan_isa(isa, data.data(), data.size(), '\n', ends.data(), max);
+  ends.resize(n);
+  return ends;
+}
+
+TEST_CASE("frame_scan finds the same delimiters with every ISA", "[frame]")
+{
+  std::mt19937 rng(1234);
+  for (int k = 0; k < 500; k++) {
+    // Dense and sparse lines, sizes around the vector widths
+    std::string data(rng() % 200, 'x');
+    uint32_t density = static_cast<uint32_t>(1 + rng() % 40);
+    for (char& ch : data)
+      if (rng() % density == 0)
+        ch = '\n';
+    size_t max = 1 + rng() % FRAME_BATCH;
+
+    std::vector<uint32_t> expected = scan(FRAME_ISA_SCALAR, data, max);
+    REQUIRE(scan(FRAME_ISA_SSE2, data, max) == expected);
+    REQUIRE(scan(FRAME_ISA_AVX2, data, max) == expected);
+    REQUIRE(scan(FRAME_ISA_AUTO, data, max) == expected);
+  }
+}
+
+TEST_CASE("frame_next keeps the partial line for the next read", "[frame]")
+{
+  struct frame f;
+  frame_init(&f, '\n');
+  std::string buf = "first\nsecond\npar";
+
+  REQUIRE(frame_next(&f, buf.data(), buf.size()) == 6);
+  buf.erase(0, 6);
+  REQUIRE(frame_next(&f, buf.data(), buf.size()) == 7);
+  buf.erase(0, 7);
+  REQUIRE(frame_next(&f, buf.data(), buf.size()) == 0);
+  // The tail is not scanned again
+  REQUIRE(f.scanned == 3);
+
+  buf += "tial\nlast";
+  REQUIRE(frame_next(&f, buf.data(), buf.size()) == 8);
+  buf.erase(0, 8);
+  REQUIRE(frame_next(&f, buf.data(), buf.size()) == 0);
+  REQUIRE(buf == "last");
+}
+
+TEST_CASE("frame_next hands out more lines than a batch", "[frame]")
+{
+  struct frame f;
+  frame_init(&f, '\n');
+  std::string buf;
+  for (int k = 0; k < 3 * FRAME_BATCH + 5; k++)
+    buf += std::to_string(k) + "\n";
+  buf += "tail";
+
+  for (int k = 0; k < 3 * FRAME_BATCH + 5; k++) {
+    size_t size = frame_next(&f, buf.data(), buf.size());
+    REQUIRE(buf.substr(0, size) == std::to_string(k) + "\n");
+    buf.erase(0, size);
+  }
+  REQUIRE(frame_next(&f, buf.data(), buf.size()) == 0);
+  REQUIRE(buf == "tail");
+}
@@ -0,0 +1,261 @@
+#define CATCH_CONFIG_RUNNER
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <limits.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <iterator>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <catch2/catch.hpp>
+// Vendored without C++ guards
+extern "C" {
+#include "log/log.h"
+}
+#include "prime-time/is-prime-request.h"
+#include "prime-time/is-prime-scan.h"
+#include "prime-time/primality.h"
+#include "prime-time/sieve.h"
+#include "utils/queue.h"
+
+// Numbers per distribution, each benchmark run goes through all of them
+#define BENCH_NUMBERS 1024
+
+int main(int argc, char* argv[])
+{
+  // Measure the work, not the logs written about it
+  log_set_quiet(true);
+  return Catch::Session().run(argc, argv);
+}
+
+static std::vector<int64_t> bench_numbers(uint32_t seed, int64_t lo, int64_t hi)
+{
+  std::mt19937_64 rng(seed);
+  std::uniform_int_distribution<int64_t> dist(lo, hi);
+  std::vector<int64_t> numbers(BENCH_NUMBERS);
+  for (int64_t& n : numbers)
+    n = dist(rng);
+  return numbers;
+}
+
+static std::vector<int64_t> bench_primes(uint32_t seed, int64_t lo, int64_t hi)
+{
+  std::vector<int64_t> numbers = bench_numbers(seed, lo, hi);
+  for (int64_t& n : numbers) {
+    n |= 1;
+    while (!primality_u64(static_cast<uint64_t>(n)))
+      n += 2;
+  }
+  return numbers;
+}
+
+// Cycles through known until there are BENCH_NUMBERS of them
+static std::vector<int64_t> bench_repeat(const int64_t* known, size_t count)
+{
+  std::vector<int64_t> numbers;
+  while (numbers.size() < BENCH_NUMBERS)
+    numbers.insert(numbers.end(), known, known + count);
+  numbers.resize(BENCH_NUMBERS);
+  return numbers;
+}
+
+// Carmichael numbers. Those with a factor below 100 are stopped by trial
+// division before any round, the last four only have larger ones and get
+// past base 2.
+static std::vector<int64_t> bench_carmichaels()
+{
+  static const int64_t known[] = {561,
+                                  1105,
+                                  1729,
+                                  2465,
+                                  2821,
+                                  6601,
+                                  8911,
+                                  41041,
+                                  825265,
+                                  321197185,
+                                  5394826801LL,
+                                  232250619601LL,
+                                  3215031751LL,
+                                  2152302898747LL,
+                                  3474749660383LL,
+                                  3825123056546413051LL};
+  return bench_repeat(known, sizeof(known) / sizeof(known[0]));
+}
+
+// Smallest strong pseudoprimes to every prime base up to 7, 11, 13, 17 and
+// 23. Of the 7 bases primality_u64 uses they pass 1 to 3 before a witness.
+static std::vector<int64_t> bench_strong_pseudoprimes()
+{
+  static const int64_t known[] = {3215031751LL,
+                                  2152302898747LL,
+                                  3474749660383LL,
+                                  341550071728321LL,
+                                  3825123056546413051LL};
+  return bench_repeat(known, sizeof(known) / sizeof(known[0]));
+}
+
+static int bench_count_primes(const std::vector<int64_t>& numbers)
+{
+  int primes = 0;
+  for (int64_t n : numbers)
+    primes += is_prime_f(n);
+  return primes;
+}
+
+static void bench_is_prime_f(const char* prefix)
+{
+  std::vector<int64_t> small = bench_numbers(1, 0, 1 << 16);
+  std::vector<int64_t> u32 = bench_numbers(2, 1LL << 31, (1LL << 32) - 1);
+  std::vector<int64_t> u64 = bench_numbers(3, 1LL << 32, INT64_MAX);
+  std::vector<int64_t> primes = bench_primes(4, 1LL << 32, INT64_MAX - 1024);
+  std::vector<int64_t> carmichaels = bench_carmichaels();
+  std::vector<int64_t> pseudo = bench_strong_pseudoprimes();
+  // Composite all of them, or they would measure something else
+  REQUIRE(bench_count_primes(carmichaels) == 0);
+  REQUIRE(bench_count_primes(pseudo) == 0);
+
+  std::string name(prefix);
+  BENCHMARK(name + " below 2^16 x1024")
+  {
+    return bench_count_primes(small);
+  };
+  BENCHMARK(name + " 32 bit x1024")
+  {
+    return bench_count_primes(u32);
+  };
+  BENCHMARK(name + " 64 bit x1024")
+  {
+    return bench_count_primes(u64);
+  };
+  BENCHMARK(name + " 64 bit primes x1024")
+  {
+    return bench_count_primes(primes);
+  };
+  BENCHMARK(name + " Carmichael numbers x1024")
+  {
+    return bench_count_primes(carmichaels);
+  };
+  BENCHMARK(name + " strong pseudoprimes x1024")
+  {
+    return bench_count_primes(pseudo);
+  };
+}
+
+TEST_CASE("is_prime_f", "[bench]")
+{
+  is_prime_use_sieve(NULL);
+  bench_is_prime_f("is_prime_f");
+}
+
+// Builds or maps the server's 256 MiB cache the first time, hence its own tag
+TEST_CASE("is_prime_f with the sieve", "[bench][sieve]")
+{
+  struct sieve sieve = {};
+  char path[PATH_MAX];
+  sieve_cache_path(path, sizeof(path));
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  REQUIRE(sieve_open(&sieve,
+                     path,
+                     SIEVE_LIMIT_32,
+                     (cpus > 0 ? static_cast<int>(cpus) : 1))
+          == 0);
+  is_prime_use_sieve(&sieve);
+  bench_is_prime_f("is_prime_f sieve");
+  is_prime_use_sieve(NULL);
+  sieve_close(&sieve);
+}
+
+TEST_CASE("primality_u64_batch", "[bench]")
+{
+  std::vector<int64_t> primes = bench_primes(5, 1LL << 32, (1LL << 52) - 1);
+  std::vector<uint64_t> numbers(primes.begin(), primes.end());
+  std::unique_ptr<bool[]> answers(new bool[numbers.size()]);
+
+  BENCHMARK("primality_u64 primes below 2^52 x1024")
+  {
+    int count = 0;
+    for (uint64_t n : numbers)
+      count += primality_u64(n);
+    return count;
+  };
+  BENCHMARK("primality_u64_batch primes below 2^52 x1024")
+  {
+    primality_u64_batch(numbers.data(), answers.get(), numbers.size());
+    return answers[0];
+  };
+}
+
+TEST_CASE("is_prime_request_malformed", "[bench]")
+{
+  struct is_prime_request req;
+  const std::string valid = "{\"method\":\"isPrime\",\"number\":4294967311}";
+  const std::string reordered =
+      "{\"number\":-17.5e3, \"extra\":[1,{\"a\":null}],"
+      " \"method\":\"isPrime\"}";
+  const std::string wide = "{\"method\":\"isPrime\",\"number\":"
+      + std::string(PRIMALITY_MAX_DIGITS, '7') + "}";
+  const std::string nested = "{\"method\":\"isPrime\",\"number\":"
+      + std::string(IS_PRIME_SCAN_MAX_DEPTH - 1, '[')
+      + std::string(IS_PRIME_SCAN_MAX_DEPTH - 1, ']') + "}";
+  std::string escaped = "{\"method\":\"";
+  for (int k = 0; k < 64; k++)
+    escaped += "\\u0041\\n";
+  escaped += "\",\"number\":7}";
+  const std::string truncated = valid.substr(0, valid.size() - 1);
+
+  BENCHMARK("is_prime_request_malformed valid")
+  {
+    return is_prime_request_malformed(&req, valid.data(), valid.size());
+  };
+  BENCHMARK("is_prime_request_malformed reordered with extras")
+  {
+    return is_prime_request_malformed(
+        &req, reordered.data(), reordered.size());
+  };
+  BENCHMARK("is_prime_request_malformed widest number")
+  {
+    return is_prime_request_malformed(&req, wide.data(), wide.size());
+  };
+  BENCHMARK("is_prime_request_malformed deepest nesting")
+  {
+    return is_prime_request_malformed(&req, nested.data(), nested.size());
+  };
+  BENCHMARK("is_prime_request_malformed long escaped method")
+  {
+    return is_prime_request_malformed(&req, escaped.data(), escaped.size());
+  };
+  BENCHMARK("is_prime_request_malformed truncated")
+  {
+    return is_prime_request_malformed(
+        &req, truncated.data(), truncated.size());
+  };
+}
+
+TEST_CASE("is_prime_request_builder", "[bench]")
+{
+  std::vector<int64_t> numbers = bench_numbers(6, 0, INT64_MAX);
+  for (size_t count : {size_t{1}, size_t{16}, size_t{256}, size_t{1024}}) {
+    std::string buffer;
+    for (size_t k = 0; k < count; k++)
+      buffer += "{\"method\":\"isPrime\",\"number\":"
+          + std::to_string(numbers[k]) + "}\n";
+
+    // Responses are never wider than their requests
+    struct queue* sdq = NULL;
+    queue_init(&sdq, 2 * buffer.size());
+    BENCHMARK("is_prime_request_builder x" + std::to_string(count))
+    {
+      bool malformed;
+      queue_reset(sdq);
+      return is_prime_request_builder(
+          sdq, &buffer[0], buffer.size(), &malformed);
+    };
+    queue_free(&sdq);
+  }
+}
@@ -15,6 +15,7 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <string>
 #include <json-c/json.h>
 #include <json-c/json_tokener.h>
 
@@ -69,6 +70,26 @@ TEST_CASE("is_prime_request_builder handles valid requests", "[request]")
     REQUIRE(strncmp(data, PRIME_FALSE, size) == 0);
   }
 
+  SECTION("Valid requests with numbers wider than 64 bits")
+  {
+    char raw_request[] =
+        "{\"method\":\"isPrime\","
+        "\"number\":170141183460469231731687303715884105727}\n"
+        "{\"method\":\"isPrime\","
+        "\"number\":170141183460469231731687303715884105729}\n"
+        "{\"number\":-170141183460469231731687303715884105727,"
+        "\"method\":\"isPrime\"}\n";
+    REQUIRE(is_prime_request_builder(
+                sdqu, raw_request, strlen(raw_request), &malformed)
+            == 3);
+    REQUIRE(malformed == false);
+
+    char response[1024];
+    sprintf(response, "%s%s%s", PRIME_TRUE, PRIME_FALSE, PRIME_FALSE);
+    size = queue_pop_no_copy(sdqu, &data);
+    REQUIRE(strncmp(data, response, static_cast<size_t>(size)) == 0);
+  }
+
   SECTION(
       "Valid composite request with prime number; followed by non prime "
       "request")
@@ -162,3 +183,20 @@ TEST_CASE("is_prime_request_builder handles invalid requests", "[request]")
   if (sdqu)
     queue_free(&sdqu);
 }
+
+TEST_CASE("is_prime_response hands out the preformatted responses",
+          "[request]")
+{
+  size_t size;
+  const char* data;
+  struct is_prime_request req = {};
+  req.is_prime = true;
+  data = is_prime_response(&req, &size);
+  REQUIRE(std::string(data, size) == PRIME_TRUE);
+  req.is_prime = false;
+  data = is_prime_response(&req, &size);
+  REQUIRE(std::string(data, size) == PRIME_FALSE);
+  req.is_malformed = true;
+  data = is_prime_response(&req, &size);
+  REQUIRE(std::string(data, size) == PRIME_RESPONSE_ILL_RESPONSE);
+}
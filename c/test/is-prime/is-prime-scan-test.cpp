@@ -0,0 +1,254 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <random>
+#include <string>
+
+#include <json-c/json.h>
+#include <json-c/json_tokener.h>
+
+#include <catch2/catch.hpp>
+#include "prime-time/is-prime-scan.h"
+
+// json-c is the reference for anything both accept as JSON
+static void check_scan_value(const struct is_prime_scan_value& v,
+                             json_object* obj)
+{
+  // json-c hands out NULL for null members
+  if ((obj == NULL) || (json_object_get_type(obj) == json_type_null)) {
+    REQUIRE(
+        ((v.type == IS_PRIME_SCAN_ABSENT) || (v.type == IS_PRIME_SCAN_NULL)));
+    return;
+  }
+
+  switch (json_object_get_type(obj)) {
+    case json_type_string:
+      REQUIRE(v.type == IS_PRIME_SCAN_STRING);
+      REQUIRE(
+          is_prime_scan_equals(v.data, v.size, json_object_get_string(obj)));
+      break;
+    case json_type_int:
+      REQUIRE(v.type == IS_PRIME_SCAN_INT);
+      REQUIRE(strtoll(std::string(v.data, v.size).c_str(), NULL, 10)
+              == json_object_get_int64(obj));
+      break;
+    case json_type_double:
+      REQUIRE(v.type == IS_PRIME_SCAN_DOUBLE);
+      break;
+    case json_type_boolean:
+      REQUIRE(v.type == IS_PRIME_SCAN_BOOL);
+      break;
+    case json_type_array:
+      REQUIRE(v.type == IS_PRIME_SCAN_ARRAY);
+      break;
+    case json_type_object:
+      REQUIRE(v.type == IS_PRIME_SCAN_OBJECT);
+      break;
+    default:
+      FAIL("unexpected json-c type");
+  }
+}
+
+static bool check_scan(const std::string& line)
+{
+  INFO("line: " << line);
+  struct is_prime_scan scan;
+  int r = is_prime_scan_line(line.data(), line.size(), &scan);
+  json_object* root = json_tokener_parse(line.c_str());
+  bool object =
+      (root != NULL) && (json_object_get_type(root) == json_type_object);
+
+  REQUIRE((r == 0) == object);
+  if (object) {
+    check_scan_value(scan.method, json_object_object_get(root, "method"));
+    check_scan_value(scan.number, json_object_object_get(root, "number"));
+  }
+  json_object_put(root);
+  return (r == 0);
+}
+
+// Random requests, valid JSON with every kind of value on the way
+struct request_generator {
+  std::mt19937 rng;
+
+  explicit request_generator(uint32_t seed)
+      : rng(seed)
+  {
+  }
+
+  int pick(int n) { return static_cast<int>(rng() % static_cast<uint32_t>(n)); }
+
+  std::string space()
+  {
+    static const char* spaces[] = {"", "", "", " ", "\t", " \r ", "  "};
+    return spaces[pick(7)];
+  }
+
+  std::string string()
+  {
+    static const char* strings[] = {"\"isPrime\"",
+                                    "\"isPrim\\u0065\"",
+                                    "\"isprime\"",
+                                    "\"\"",
+                                    "\"is\\\"Prime\\\\\"",
+                                    "\"a\\/b\\n\\t\\r\\b\\f\"",
+                                    "\"number\""};
+    return strings[pick(7)];
+  }
+
+  std::string number()
+  {
+    static const char* numbers[] = {"0",
+                                    "-0",
+                                    "17",
+                                    "-17",
+                                    "123456789012345678",
+                                    "1.5",
+                                    "-0.25e-3",
+                                    "2E+10",
+                                    "7e2",
+                                    "4294967311"};
+    return numbers[pick(10)];
+  }
+
+  std::string value(int depth)
+  {
+    switch (pick(depth < 3 ? 8 : 6)) {
+      case 0:
+        return string();
+      case 1:
+      case 2:
+        return number();
+      case 3:
+        return (pick(2) != 0 ? "true" : "false");
+      case 4:
+        return "null";
+      case 5:
+        return "[]";
+      case 6: {
+        std::string s = "[" + space() + value(depth + 1);
+        for (int k = pick(3); k > 0; k--)
+          s += space() + "," + space() + value(depth + 1);
+        return s + space() + "]";
+      }
+      default:
+        return object(depth + 1, false);
+    }
+  }
+
+  std::string member(const std::string& key, const std::string& value)
+  {
+    return space() + "\"" + key + "\"" + space() + ":" + space() + value
+        + space();
+  }
+
+  std::string object(int depth, bool request)
+  {
+    static const char* keys[] = {"a", "prime", "Method", "nu\\u006d", "x y"};
+    std::string members[4];
+    int count = 0;
+    if (request) {
+      members[count++] =
+          member("method", pick(4) != 0 ? "\"isPrime\"" : value(depth));
+      members[count++] =
+          member(pick(4) != 0 ? "number" : "num\\u0062er", value(depth));
+    }
+    for (int k = pick(3); k > 0; k--)
+      members[count++] = member(keys[pick(5)], value(depth));
+    std::shuffle(members, members + count, rng);
+
+    std::string s = "{";
+    for (int k = 0; k < count; k++)
+      s += (k > 0 ? "," : "") + members[k];
+    return s + (count == 0 ? space() : "") + "}";
+  }
+};
+
+TEST_CASE("is_prime_scan_line agrees with json-c on valid requests", "[scan]")
+{
+  request_generator gen(1234);
+  for (int k = 0; k < 2000; k++) {
+    std::string line = gen.space() + gen.object(0, true) + gen.space();
+    REQUIRE(check_scan(line));
+    // Cut short anywhere
+    for (size_t size = 0; size < line.size();
+         size += 1 + static_cast<size_t>(gen.pick(4)))
+      check_scan(line.substr(0, size));
+  }
+}
+
+TEST_CASE("is_prime_scan_line agrees with json-c on invalid requests", "[scan]")
+{
+  const char* lines[] = {
+      "",
+      "{",
+      "}",
+      "17",
+      "\"isPrime\"",
+      "[{\"method\":\"isPrime\",\"number\":17}]",
+      "{\"method\"}",
+      "{\"method\":}",
+      "{\"method\" \"isPrime\"}",
+      "{\"method\":\"isPrime\" \"number\":17}",
+      "{\"method\":\"isPrime\",\"number\":[17}",
+      "{\"method\":\"isPrime\",\"number\":{17}}",
+      "{\"method\":\"isPrime\",\"number\":tru}",
+      "{\"method\":\"isPrime\",\"number\":nul}",
+      "{\"method\":\"isPrime\",\"number\":-}",
+      "{\"method\":\"isPrime\",\"number\":+17}",
+      "{\"method\":\"is\\xPrime\",\"number\":17}",
+      "{\"method\":\"is\\u00GPrime\",\"number\":17}",
+      "{method:\"isPrime\",\"number\":17}",
+      "{\"method\":\"isPrime\",,\"number\":17}",
+  };
+  for (const char* line : lines)
+    REQUIRE_FALSE(check_scan(line));
+}
+
+TEST_CASE("is_prime_scan_line is stricter than json-c", "[scan]")
+{
+  struct is_prime_scan scan;
+  const char* lines[] = {
+      "{\"method\":\"isPrime\",\"number\":17}x",
+      "{\"method\":\"isPrime\",\"number\":17,}",
+      "{\"method\":\"isPrime\",\"number\":[17,]}",
+      "{\"method\":\"isPrime\",\"number\":017}",
+      "{\"method\":\"isPrime\",\"number\":17.}",
+      "{\"method\":\"isPrime\",\"number\":NaN}",
+      "{'method':'isPrime','number':17}",
+      "{\"method\":\"is\tPrime\",\"number\":17}",
+  };
+  for (const char* line : lines) {
+    INFO("line: " << line);
+    REQUIRE(is_prime_scan_line(line, strlen(line), &scan) == -1);
+  }
+
+  // The request itself is the first level
+  std::string deepest = "{\"number\":"
+      + std::string(IS_PRIME_SCAN_MAX_DEPTH - 1, '[')
+      + std::string(IS_PRIME_SCAN_MAX_DEPTH - 1, ']') + "}";
+  std::string deeper = "{\"number\":"
+      + std::string(IS_PRIME_SCAN_MAX_DEPTH, '[')
+      + std::string(IS_PRIME_SCAN_MAX_DEPTH, ']') + "}";
+  REQUIRE(is_prime_scan_line(deepest.data(), deepest.size(), &scan) == 0);
+  REQUIRE(is_prime_scan_line(deeper.data(), deeper.size(), &scan) == -1);
+}
+
+TEST_CASE("is_prime_scan_line keeps the last of duplicate members", "[scan]")
+{
+  struct is_prime_scan scan;
+  const char line[] =
+      "{\"number\":1,\"method\":\"isPrime\",\"a\":{\"number\":2},"
+      "\"number\":123456789012345678901234567890}";
+  REQUIRE(is_prime_scan_line(line, strlen(line), &scan) == 0);
+  REQUIRE(scan.number.type == IS_PRIME_SCAN_INT);
+  REQUIRE(std::string(scan.number.data, scan.number.size)
+          == "123456789012345678901234567890");
+  REQUIRE(is_prime_scan_equals(scan.method.data, scan.method.size, "isPrime"));
+  REQUIRE_FALSE(
+      is_prime_scan_equals(scan.method.data, scan.method.size, "isPrim"));
+  REQUIRE_FALSE(
+      is_prime_scan_equals(scan.method.data, scan.method.size, "isPrimeX"));
+}
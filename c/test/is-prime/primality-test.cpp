@@ -0,0 +1,146 @@
+#include <stdint.h>
+
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <catch2/catch.hpp>
+#include "prime-time/primality.h"
+
+__extension__ typedef unsigned __int128 u128;
+
+TEST_CASE("Miller-Rabin agrees with trial division")
+{
+  for (uint64_t n = 0; n < 200000; n++)
+    REQUIRE(primality_u64(n) == primality_trial_division(n));
+
+  // Around 2^32, where products of two 32 bit primes start
+  for (uint64_t n = (1ULL << 32) - 2000; n < (1ULL << 32) + 2000; n++)
+    REQUIRE(primality_u64(n) == primality_trial_division(n));
+}
+
+TEST_CASE("Miller-Rabin rejects pseudoprimes")
+{
+  // Carmichael numbers
+  const uint64_t carmichael[] = {561, 1105, 1729, 2465, 2821, 6601, 8911,
+                                 41041, 825265, 321197185, 5394826801ULL};
+  for (uint64_t n : carmichael)
+    REQUIRE_FALSE(primality_u64(n));
+
+  // Strong pseudoprimes to several of the first prime bases
+  REQUIRE_FALSE(primality_u64(3215031751ULL));
+  REQUIRE_FALSE(primality_u64(2152302898747ULL));
+  REQUIRE_FALSE(primality_u64(3474749660383ULL));
+  REQUIRE_FALSE(primality_u64(341550071728321ULL));
+  REQUIRE_FALSE(primality_u64(3825123056546413051ULL));
+}
+
+TEST_CASE("Miller-Rabin handles the top of the 64 bit range")
+{
+  REQUIRE(primality_u64(2305843009213693951ULL));  // 2^61 - 1
+  REQUIRE(primality_u64(9223372036854775783ULL));  // Largest below 2^63
+  REQUIRE(primality_u64(18446744073709551557ULL));  // Largest below 2^64
+  REQUIRE_FALSE(primality_u64(18446744073709551615ULL));
+  REQUIRE_FALSE(primality_u64(18446744073709551559ULL));
+  REQUIRE_FALSE(primality_u64(4294967291ULL * 4294967279ULL));
+  REQUIRE_FALSE(primality_u64(2305843009213693951ULL * 3));
+}
+
+TEST_CASE("Batched Miller-Rabin agrees with primality_u64")
+{
+  std::vector<uint64_t> numbers = {0, 1, 2, 3, 10201, 10211, 3215031751ULL,
+                                   341550071728321ULL, 3825123056546413051ULL,
+                                   18446744073709551557ULL};
+  std::mt19937_64 rng(42);
+  // Odd ones mostly, evens never reach the kernels
+  for (int k = 0; k < 3000; k++) {
+    int bits = 14 + k % 50;
+    numbers.push_back((rng() >> (64 - bits)) | 1);
+  }
+  // Around the widest numbers the vector kernel takes
+  for (uint64_t n = (1ULL << 52) - 400; n < (1ULL << 52) + 400; n++)
+    numbers.push_back(n);
+  // Prime factors of bases, which then divide a base
+  numbers.push_back(407521);
+  numbers.push_back(299210837);
+  numbers.push_back(5394826801ULL);  // Carmichael
+
+  for (int isa :
+       {PRIMALITY_ISA_AUTO, PRIMALITY_ISA_SCALAR, PRIMALITY_ISA_AVX512IFMA})
+  {
+    INFO("isa: " << isa);
+    // Sizes that leave lanes idle and batches split across chunks
+    for (size_t count : {size_t{1}, size_t{7}, numbers.size()}) {
+      std::unique_ptr<bool[]> prime(new bool[count]);
+      primality_u64_batch_isa(isa, numbers.data(), prime.get(), count);
+      for (size_t k = 0; k < count; k++) {
+        INFO("n: " << numbers[k]);
+        REQUIRE(prime[k] == primality_u64(numbers[k]));
+      }
+    }
+  }
+}
+
+static std::string to_decimal(u128 n)
+{
+  std::string digits;
+  do {
+    digits.insert(digits.begin(), static_cast<char>('0' + n % 10));
+    n /= 10;
+  } while (n != 0);
+  return digits;
+}
+
+static bool decimal_prime(const std::string& digits)
+{
+  bool prime = false;
+  REQUIRE(primality_decimal(digits.data(), digits.size(), &prime) == 0);
+  return prime;
+}
+
+TEST_CASE("Baillie-PSW just above 64 bits")
+{
+  const u128 two64 = static_cast<u128>(1) << 64;
+  for (unsigned k = 1; k < 100; k++) {
+    bool prime = (k == 13) || (k == 37) || (k == 51) || (k == 81) || (k == 93);
+    REQUIRE(decimal_prime(to_decimal(two64 + k)) == prime);
+  }
+
+  // Products of primes with no small factor
+  std::vector<uint64_t> primes;
+  for (uint64_t n = (1ULL << 32) + 1; primes.size() < 40; n += 2) {
+    if (primality_u64(n))
+      primes.push_back(n);
+  }
+  for (size_t k = 1; k < primes.size(); k++)
+    REQUIRE_FALSE(decimal_prime(
+        to_decimal(static_cast<u128>(primes[k - 1]) * primes[k])));
+}
+
+TEST_CASE("Baillie-PSW on wide numbers")
+{
+  REQUIRE(decimal_prime("618970019642690137449562111"));  // 2^89 - 1
+  REQUIRE(decimal_prime("170141183460469231731687303715884105727"));
+  REQUIRE(decimal_prime("1" + std::string(96, '0') + "289"));  // 10^99 + 289
+  REQUIRE(decimal_prime(
+      "531137992816767098689588206552468627329593117727031923199444138200403559"
+      "860852242739162502265229285668889329486246501015346579337652707239409519"
+      "978766587351943831270835393219031728127"));  // 2^607 - 1
+  REQUIRE(decimal_prime("00018446744073709551557"));
+
+  // Strong pseudoprime to every prime base up to 37
+  REQUIRE_FALSE(decimal_prime("3317044064679887385961981"));
+  // (2^89 - 1)^2, no Selfridge parameter exists for squares
+  REQUIRE_FALSE(
+      decimal_prime("383123885216472214589586755549637256619304505646776321"));
+  // (2^89 - 1) * (2^127 - 1)
+  REQUIRE_FALSE(decimal_prime(
+      "105312291668557186697918027513529248857806893649219117400977309697"));
+  REQUIRE_FALSE(decimal_prime("1" + std::string(150, '0') + "5"));
+
+  bool prime;
+  std::string wide(PRIMALITY_MAX_DIGITS + 1, '9');
+  REQUIRE(primality_decimal(wide.data(), wide.size(), &prime) == -1);
+  REQUIRE(primality_decimal(wide.data(), wide.size() - 1, &prime) == 0);
+}
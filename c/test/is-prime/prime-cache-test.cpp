@@ -0,0 +1,158 @@
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <catch2/catch.hpp>
+#include "prime-time/is-prime-request.h"
+#include "prime-time/prime-cache.h"
+#include "prime-time/primality.h"
+
+struct cache_test_waiter {
+  struct prime_cache_waiter waiter;
+  int woken;
+  bool prime;
+};
+
+static void cache_test_wake(struct prime_cache_waiter* w, bool prime)
+{
+  // The waiter is its first member
+  struct cache_test_waiter* tw = reinterpret_cast<struct cache_test_waiter*>(w);
+  tw->woken++;
+  tw->prime = prime;
+}
+
+TEST_CASE("prime_cache keeps the latest numbers of each set")
+{
+  struct prime_cache* c = NULL;
+  REQUIRE(prime_cache_init(&c) == 0);
+
+  bool prime;
+  REQUIRE_FALSE(prime_cache_get(c, 4294967311ULL, &prime));
+  prime_cache_put(c, 4294967311ULL, true);
+  prime_cache_put(c, 4294967313ULL, false);
+  REQUIRE(prime_cache_get(c, 4294967311ULL, &prime));
+  REQUIRE(prime);
+  REQUIRE(prime_cache_get(c, 4294967313ULL, &prime));
+  REQUIRE_FALSE(prime);
+
+  // Far more numbers than it holds, the first ones are gone
+  const uint64_t total = 8 * PRIME_CACHE_SETS * PRIME_CACHE_WAYS;
+  for (uint64_t n = 1; n <= total; n++)
+    prime_cache_put(c, n, primality_u64(n));
+  REQUIRE_FALSE(prime_cache_get(c, 4294967311ULL, &prime));
+  int found = 0;
+  for (uint64_t n = 1; n <= total; n++) {
+    if (prime_cache_get(c, n, &prime)) {
+      REQUIRE(prime == primality_u64(n));
+      found++;
+    }
+  }
+  REQUIRE(found <= PRIME_CACHE_SETS * PRIME_CACHE_WAYS);
+  REQUIRE(prime_cache_get(c, total, &prime));
+
+  prime_cache_free(&c);
+  REQUIRE(c == NULL);
+}
+
+TEST_CASE("prime_cache wakes whoever joined a wide check")
+{
+  struct prime_cache* c = NULL;
+  REQUIRE(prime_cache_init(&c) == 0);
+  const std::string n = "170141183460469231731687303715884105727";
+  struct cache_test_waiter a = {{cache_test_wake, NULL}, 0, false};
+  struct cache_test_waiter b = {{cache_test_wake, NULL}, 0, false};
+  bool prime = false;
+
+  REQUIRE(prime_cache_join(c, n.data(), n.size(), &a.waiter, &prime)
+          == PRIME_CACHE_MISS);
+  REQUIRE(prime_cache_join(c, n.data(), n.size(), &a.waiter, &prime)
+          == PRIME_CACHE_JOINED);
+  REQUIRE(prime_cache_join(c, n.data(), n.size(), &b.waiter, &prime)
+          == PRIME_CACHE_JOINED);
+  // Without a waiter it's checked again
+  REQUIRE(prime_cache_join(c, n.data(), n.size(), NULL, &prime)
+          == PRIME_CACHE_MISS);
+
+  prime_cache_done(c, n.data(), n.size(), true);
+  REQUIRE(a.woken == 1);
+  REQUIRE(a.prime);
+  REQUIRE(b.woken == 1);
+  REQUIRE(b.prime);
+
+  // Known from now on, nobody is woken twice
+  prime_cache_done(c, n.data(), n.size(), true);
+  REQUIRE(a.woken == 1);
+  REQUIRE(prime_cache_join(c, n.data(), n.size(), &a.waiter, &prime)
+          == PRIME_CACHE_HIT);
+  REQUIRE(prime);
+  const std::string other = n.substr(1);
+  REQUIRE(prime_cache_join(c, other.data(), other.size(), NULL, &prime)
+          == PRIME_CACHE_MISS);
+
+  prime_cache_free(&c);
+}
+
+TEST_CASE("prime_cache evicts the least recently used wide numbers")
+{
+  struct prime_cache* c = NULL;
+  REQUIRE(prime_cache_init(&c) == 0);
+  bool prime;
+
+  std::vector<std::string> numbers;
+  for (size_t k = 0; k <= PRIME_CACHE_ENTRIES; k++)
+    numbers.push_back("1" + std::string(40, '0') + std::to_string(k));
+  for (size_t k = 0; k < PRIME_CACHE_ENTRIES; k++)
+    prime_cache_done(c, numbers[k].data(), numbers[k].size(), false);
+  const std::string& first = numbers[0];
+  const std::string& second = numbers[1];
+  const std::string& last = numbers[PRIME_CACHE_ENTRIES];
+  // Used again, the second one is the oldest now
+  REQUIRE(prime_cache_join(c, first.data(), first.size(), NULL, &prime)
+          == PRIME_CACHE_HIT);
+
+  prime_cache_done(c, last.data(), last.size(), false);
+  REQUIRE(prime_cache_join(c, last.data(), last.size(), NULL, &prime)
+          == PRIME_CACHE_HIT);
+  REQUIRE(prime_cache_join(c, first.data(), first.size(), NULL, &prime)
+          == PRIME_CACHE_HIT);
+  REQUIRE(prime_cache_join(c, second.data(), second.size(), NULL, &prime)
+          == PRIME_CACHE_MISS);
+
+  prime_cache_free(&c);
+}
+
+TEST_CASE("is_prime answers agree through the cache across threads")
+{
+  struct prime_cache* c = NULL;
+  REQUIRE(prime_cache_init(&c) == 0);
+  is_prime_use_cache(c);
+
+  const std::string wide = "170141183460469231731687303715884105727";
+  const std::string composite = "170141183460469231731687303715884105729";
+  std::atomic<int> wrong(0);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back(
+        [&]()
+        {
+          for (int k = 0; k < 256; k++) {
+            int64_t n = 4294967291LL + 2 * (k % 16);
+            if (is_prime_f(n) != primality_u64(static_cast<uint64_t>(n)))
+              wrong++;
+            if (!is_prime_digits(wide.data(), wide.size()))
+              wrong++;
+            if (is_prime_digits(composite.data(), composite.size()))
+              wrong++;
+          }
+        });
+  }
+  for (std::thread& t : threads)
+    t.join();
+  REQUIRE(wrong == 0);
+
+  is_prime_use_cache(NULL);
+  prime_cache_free(&c);
+}
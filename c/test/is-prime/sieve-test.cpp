@@ -0,0 +1,83 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include <catch2/catch.hpp>
+#include "prime-time/primality.h"
+#include "prime-time/sieve.h"
+
+// Several segments, the last one partial
+#define SIEVE_TEST_LIMIT (9ULL * SIEVE_SEGMENT_BITS + 6 * SIEVE_WORD_NUMBERS)
+
+TEST_CASE("Sieve agrees with Miller-Rabin")
+{
+  std::vector<uint64_t> bits(SIEVE_TEST_LIMIT / SIEVE_WORD_NUMBERS);
+  REQUIRE(sieve_build(bits.data(), SIEVE_TEST_LIMIT, 3) == 0);
+
+  struct sieve s = {bits.data(), SIEVE_TEST_LIMIT, NULL, 0};
+  for (uint64_t n = 0; n < SIEVE_TEST_LIMIT; n++)
+    REQUIRE(sieve_test(&s, n) == primality_u64(n));
+}
+
+TEST_CASE("Sieve is cached and mapped again")
+{
+  std::string path =
+      "/tmp/network-exercises-sieve-test-" + std::to_string(getpid());
+  unlink(path.c_str());
+
+  struct sieve built, mapped;
+  REQUIRE(sieve_open(&built, path.c_str(), SIEVE_TEST_LIMIT, 2) == 0);
+  REQUIRE(access(path.c_str(), R_OK) == 0);
+  REQUIRE(sieve_open(&mapped, path.c_str(), SIEVE_TEST_LIMIT, 2) == 0);
+  REQUIRE(memcmp(built.bits, mapped.bits, SIEVE_TEST_LIMIT / 16) == 0);
+  sieve_close(&mapped);
+
+  // A cache for another limit is rebuilt
+  REQUIRE(sieve_open(&mapped, path.c_str(), SIEVE_TEST_LIMIT / 2, 1) == 0);
+  REQUIRE(memcmp(built.bits, mapped.bits, SIEVE_TEST_LIMIT / 32) == 0);
+  sieve_close(&mapped);
+  sieve_close(&built);
+  unlink(path.c_str());
+}
+
+TEST_CASE("Sieve cache writable by others is built again")
+{
+  std::string path =
+      "/tmp/network-exercises-sieve-test-" + std::to_string(getpid());
+  std::string real = path + ".real";
+  unlink(path.c_str());
+  unlink(real.c_str());
+
+  struct sieve s;
+  REQUIRE(sieve_open(&s, path.c_str(), SIEVE_TEST_LIMIT, 2) == 0);
+  sieve_close(&s);
+  struct stat st;
+  REQUIRE(stat(path.c_str(), &st) == 0);
+  REQUIRE((st.st_mode & (S_IWGRP | S_IWOTH)) == 0);
+
+  // Anyone could have changed it, a fresh private one takes its place
+  REQUIRE(chmod(path.c_str(), 0666) == 0);
+  REQUIRE(stat(path.c_str(), &st) == 0);
+  ino_t shared = st.st_ino;
+  REQUIRE(sieve_open(&s, path.c_str(), SIEVE_TEST_LIMIT, 2) == 0);
+  sieve_close(&s);
+  REQUIRE(lstat(path.c_str(), &st) == 0);
+  REQUIRE(st.st_ino != shared);
+  REQUIRE((st.st_mode & (S_IWGRP | S_IWOTH)) == 0);
+
+  // Nor is a link followed, it is replaced by the file itself
+  REQUIRE(rename(path.c_str(), real.c_str()) == 0);
+  REQUIRE(symlink(real.c_str(), path.c_str()) == 0);
+  REQUIRE(sieve_open(&s, path.c_str(), SIEVE_TEST_LIMIT, 2) == 0);
+  sieve_close(&s);
+  REQUIRE(lstat(path.c_str(), &st) == 0);
+  REQUIRE(S_ISREG(st.st_mode));
+
+  unlink(path.c_str());
+  unlink(real.c_str());
+}
@@ -0,0 +1,156 @@
+#define CATCH_CONFIG_MAIN
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#include <catch2/catch.hpp>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include "log/log.h"
+}
+
+// Same lines for both runs, so only the timestamps differ
+static void log_samples()
+{
+  const char* text = "not null terminated";
+  log_info("plain message");
+  log_info("%d %i %u %x %X %o", -42, 7, 3000000000u, 0xbeef, 0xbeef, 8);
+  log_info("%ld %lu %lld %llu", -1L, 2UL, -3LL, 4ULL);
+  log_info("%zu %hhu %hd %c %%", size_t{99}, 300, static_cast<short>(-5), 'z');
+  log_info("'%s' '%.*s' '%-6s' '%5.3s'", "str", 3, text, "ab", "abcdef");
+  log_warn("%5.2f %e %g %-4d|", 3.14159, 1e10, 0.5, 12);
+  log_error("%*d|%-*d|", 5, 1, 4, 2);
+  log_trace("below the level, not written");
+}
+
+static std::vector<std::string> read_messages(FILE* fp)
+{
+  std::vector<std::string> lines;
+  char buf[512];
+  rewind(fp);
+  while (fgets(buf, sizeof(buf), fp) != nullptr) {
+    // Skip "YYYY-MM-DD HH:MM:SS.uuuuuu "
+    REQUIRE(strlen(buf) > 27);
+    lines.emplace_back(buf + 27);
+  }
+  return lines;
+}
+
+TEST_CASE("async logging writes the same lines as sync logging", "[log]")
+{
+  FILE* sync_fp = tmpfile();
+  FILE* async_fp = tmpfile();
+  REQUIRE(sync_fp != nullptr);
+  REQUIRE(async_fp != nullptr);
+
+  log_set_quiet(true);
+  REQUIRE(log_add_fp(sync_fp, LOG_DEBUG) == 0);
+  log_samples();
+
+  REQUIRE(log_add_fp(async_fp, LOG_DEBUG) == 0);
+  REQUIRE(log_async_start() == 0);
+  log_samples();
+  log_async_stop();
+
+  // The first file got both runs
+  std::vector<std::string> expected = read_messages(sync_fp);
+  std::vector<std::string> actual = read_messages(async_fp);
+  REQUIRE(expected.size() == 14);
+  expected.resize(7);
+  REQUIRE(actual == expected);
+
+  fclose(sync_fp);
+  fclose(async_fp);
+}
+
+// Voluntary context switches of every thread in the process so far
+static long context_switches()
+{
+  long total = 0;
+  DIR* dir = opendir("/proc/self/task");
+  REQUIRE(dir != nullptr);
+  for (struct dirent* de = readdir(dir); de != nullptr; de = readdir(dir)) {
+    if (de->d_name[0] == '.')
+      continue;
+    std::string path = std::string("/proc/self/task/") + de->d_name + "/status";
+    FILE* fp = fopen(path.c_str(), "r");
+    if (fp == nullptr)
+      continue;
+    char buf[256];
+    long n;
+    while (fgets(buf, sizeof(buf), fp) != nullptr)
+      if (sscanf(buf, "voluntary_ctxt_switches: %ld", &n) == 1)
+        total += n;
+    fclose(fp);
+  }
+  closedir(dir);
+  return total;
+}
+
+// Read through the descriptor, the writer thread owns the FILE. At least
+// expected, once the first test case ran its closed files are still outputs
+// and fp may reuse one of them.
+static size_t count_lines(FILE* fp, size_t expected)
+{
+  size_t lines = 0;
+  for (int k = 0; (k < 2000) && (lines < expected); k++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    char buf[4096];
+    ssize_t nbytes;
+    off_t offset = 0;
+    lines = 0;
+    while ((nbytes = pread(fileno(fp), buf, sizeof(buf), offset)) > 0) {
+      lines += static_cast<size_t>(std::count(buf, buf + nbytes, '\n'));
+      offset += nbytes;
+    }
+  }
+  return lines;
+}
+
+TEST_CASE("async writer sleeps while idle and wakes up for new records",
+          "[log]")
+{
+  FILE* fp = tmpfile();
+  REQUIRE(fp != nullptr);
+  log_set_quiet(true);
+  REQUIRE(log_add_fp(fp, LOG_INFO) == 0);
+  REQUIRE(log_async_start() == 0);
+
+  log_info("first");
+  REQUIRE(count_lines(fp, 1) >= 1);
+
+  // Nothing to write, it should not be polling for it either
+  long before = context_switches();
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  REQUIRE(context_switches() - before < 20);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back(
+        [t]()
+        {
+          for (int k = 0; k < 50; k++) {
+            log_info("thread %d record %d", t, k);
+            if (k % 10 == 0)
+              std::this_thread::sleep_for(std::chrono::milliseconds(2));
+          }
+        });
+  }
+  for (std::thread& t : threads)
+    t.join();
+  // Written without stopping it
+  REQUIRE(count_lines(fp, 201) >= 201);
+
+  log_async_stop();
+  fclose(fp);
+}
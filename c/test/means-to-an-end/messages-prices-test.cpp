@@ -14,11 +14,20 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <arpa/inet.h>
+
+#include <random>
+#include <vector>
 
 #include <catch2/catch.hpp>
 #include "means-to-an-end/asset-prices.h"
 #include "means-to-an-end/client-session.h"
 #include "utils/queue.h"
+#include "utils/ring.h"
+// Without C++ guards
+extern "C" {
+#include "means-to-an-end/messages.h"
+}
 
 TEST_CASE("prices_init initializes prices structure correctly", "[prices]")
 {
@@ -30,7 +39,7 @@ TEST_CASE("prices_init initializes prices structure correctly", "[prices]")
   REQUIRE(ps != nullptr);
   REQUIRE(ps->capacity == capacity);
   REQUIRE(ps->size == 0);
-  REQUIRE(ps->data != nullptr);
+  REQUIRE(ps->times != nullptr);
 
   asset_prices_free(&ps);
   REQUIRE(ps == nullptr);
@@ -65,13 +74,13 @@ TEST_CASE("prices_push adds data correctly", "[prices]")
   {
     asset_prices_push(ps, &p1);
     REQUIRE(ps->size == 1);
-    REQUIRE(ps->data[0].timestamp == 1);
-    REQUIRE(ps->data[0].price == 100);
+    REQUIRE(ps->times[0] == 1);
+    REQUIRE(ps->prices[0] == 100);
 
     asset_prices_push(ps, &p2);
     REQUIRE(ps->size == 2);
-    REQUIRE(ps->data[1].timestamp == 2);
-    REQUIRE(ps->data[1].price == 200);
+    REQUIRE(ps->times[1] == 2);
+    REQUIRE(ps->prices[1] == 200);
   }
 
   SECTION("Push beyond capacity triggers resize")
@@ -82,8 +91,8 @@ TEST_CASE("prices_push adds data correctly", "[prices]")
 
     REQUIRE(ps->size == 3);
     REQUIRE(ps->capacity == 4);  // Double the original capacity
-    REQUIRE(ps->data[2].timestamp == 3);
-    REQUIRE(ps->data[2].price == 300);
+    REQUIRE(ps->times[2] == 3);
+    REQUIRE(ps->prices[2] == 300);
   }
 
   asset_prices_free(&ps);
@@ -95,7 +104,7 @@ TEST_CASE("prices_free deallocates memory correctly", "[prices]")
   asset_prices_init(&ps, 10);
 
   REQUIRE(ps != nullptr);
-  REQUIRE(ps->data != nullptr);
+  REQUIRE(ps->times != nullptr);
 
   asset_prices_free(&ps);
 
@@ -108,7 +117,7 @@ TEST_CASE("detecting duplicate timestamps", "[prices]")
   asset_prices_init(&ps, 10);
 
   REQUIRE(ps != nullptr);
-  REQUIRE(ps->data != nullptr);
+  REQUIRE(ps->times != nullptr);
 
   struct asset_price p1 = {3, 300};
   struct asset_price p2 = {2, 200};
@@ -134,7 +143,7 @@ TEST_CASE("price query tests", "[prices]")
   asset_prices_init(&ps, 10);
 
   REQUIRE(ps != nullptr);
-  REQUIRE(ps->data != nullptr);
+  REQUIRE(ps->times != nullptr);
 
   struct asset_price p1 = {4, 300};
   struct asset_price p2 = {5, 200};
@@ -161,6 +170,175 @@ TEST_CASE("price query tests", "[prices]")
   REQUIRE(ps == nullptr);
 }
 
+static int32_t prices_mean(const std::vector<struct asset_price>& prices,
+                           struct asset_price_query* pq)
+{
+  int64_t sum = 0;
+  int64_t count = 0;
+  for (const struct asset_price& p : prices) {
+    if ((pq->mintime <= p.timestamp) && (p.timestamp <= pq->maxtime)) {
+      sum += p.price;
+      count++;
+    }
+  }
+  return count == 0 ? 0 : static_cast<int32_t>(sum / count);
+}
+
+TEST_CASE("price queries agree with a scan as prices come in", "[prices]")
+{
+  struct asset_prices* ps = nullptr;
+  asset_prices_init(&ps, ASSET_PRICES_POOL_CAPACITY);
+  std::vector<struct asset_price> pushed;
+  std::mt19937 rng(7);
+
+  // In order at first, then scattered among those, then in order again
+  for (int k = 0; k < 4000; k++) {
+    int32_t timestamp;
+    if ((k < 1000) || (k >= 3000))
+      timestamp = 1000 + 4 * k;
+    else
+      timestamp = 1000 + static_cast<int32_t>(rng() % 4000) * 4 + 1 + (k % 3);
+    int32_t price = static_cast<int32_t>(rng() % 20001) - 10000;
+    struct asset_price p = {timestamp, price};
+    if (asset_prices_duplicate_timestamp_check(ps, p.timestamp))
+      continue;
+    asset_prices_push(ps, &p);
+    pushed.push_back(p);
+
+    if (k % 7 == 0) {
+      int32_t a = static_cast<int32_t>(rng() % 20000);
+      int32_t b = static_cast<int32_t>(rng() % 20000);
+      struct asset_price_query q = {a, b};
+      REQUIRE(asset_prices_query(ps, &q) == prices_mean(pushed, &q));
+    }
+  }
+  REQUIRE(ps->size == pushed.size());
+
+  struct asset_price_query all = {INT32_MIN, INT32_MAX};
+  REQUIRE(asset_prices_query(ps, &all) == prices_mean(pushed, &all));
+  struct asset_price_query none = {INT32_MAX, INT32_MIN};
+  REQUIRE(asset_prices_query(ps, &none) == 0);
+
+  asset_prices_free(&ps);
+}
+
+TEST_CASE("range sum kernels agree with each other", "[prices]")
+{
+  std::mt19937 rng(11);
+  std::vector<int32_t> times(1027);
+  std::vector<int32_t> prices(times.size());
+  for (size_t k = 0; k < times.size(); k++) {
+    times[k] = static_cast<int32_t>(rng());
+    prices[k] = static_cast<int32_t>(rng());
+  }
+  times[3] = INT32_MIN;
+  times[9] = INT32_MAX;
+
+  const struct asset_price_query queries[] = {{INT32_MIN, INT32_MAX},
+                                              {INT32_MIN, INT32_MIN},
+                                              {INT32_MAX, INT32_MAX},
+                                              {-1000000000, 1000000000},
+                                              {0, 0},
+                                              {5, -5}};
+  const size_t sizes[] = {0, 1, 7, 8, 9, 64, 1027};
+  for (size_t size : sizes) {
+    for (const struct asset_price_query& q : queries) {
+      int64_t expected = 0;
+      size_t expected_count = 0;
+      for (size_t k = 0; k < size; k++) {
+        if ((q.mintime <= times[k]) && (times[k] <= q.maxtime)) {
+          expected += prices[k];
+          expected_count++;
+        }
+      }
+      for (int isa : {ASSET_PRICES_ISA_SCALAR, ASSET_PRICES_ISA_AUTO}) {
+        size_t count = 0;
+        REQUIRE(asset_prices_range_sum_isa(isa,
+                                           times.data(),
+                                           prices.data(),
+                                           size,
+                                           q.mintime,
+                                           q.maxtime,
+                                           &count)
+                == expected);
+        REQUIRE(count == expected_count);
+      }
+    }
+  }
+}
+
+static void message_put(std::vector<char>& data,
+                        char type,
+                        int32_t a,
+                        int32_t b)
+{
+  uint32_t words[2] = {htonl(static_cast<uint32_t>(a)),
+                       htonl(static_cast<uint32_t>(b))};
+  const char* bytes = reinterpret_cast<const char*>(words);
+  data.push_back(type);
+  data.insert(data.end(), bytes, bytes + sizeof(words));
+}
+
+TEST_CASE("message_parse stops at the flush threshold", "[messages]")
+{
+  struct asset_prices* ps = nullptr;
+  struct queue* sdqu = nullptr;
+  asset_prices_init(&ps, 10);
+  queue_init(&sdqu, 64);
+
+  std::vector<char> data;
+  message_put(data, MESSAGE_INSERT, 1, 100);
+  message_put(data, MESSAGE_INSERT, 2, 300);
+  for (int k = 0; k < 5; k++)
+    message_put(data, MESSAGE_QUERY, 1, 2);
+
+  // Two answers fill 8 bytes, the rest waits for the next call
+  size_t parsed = message_parse(ps, sdqu, data.data(), data.size(), 8);
+  REQUIRE(parsed == 4 * MESSAGE_SIZE);
+  REQUIRE(sdqu->size == 2 * sizeof(int32_t));
+
+  queue_reset(sdqu);
+  parsed +=
+      message_parse(ps, sdqu, data.data() + parsed, data.size() - parsed, 0);
+  REQUIRE(parsed == data.size());
+  REQUIRE(sdqu->size == 3 * sizeof(int32_t));
+  int32_t mean;
+  memcpy(&mean, sdqu->data, sizeof(mean));
+  REQUIRE(static_cast<int32_t>(ntohl(static_cast<uint32_t>(mean))) == 200);
+
+  queue_free(&sdqu);
+  asset_prices_free(&ps);
+}
+
+TEST_CASE("message_parse keeps the first price of a timestamp", "[messages]")
+{
+  struct asset_prices* ps = nullptr;
+  struct queue* sdqu = nullptr;
+  asset_prices_init(&ps, ASSET_PRICES_POOL_CAPACITY);
+  queue_init(&sdqu, 64);
+
+  // Well past the pooled capacity, the set is rebuilt a few times
+  std::vector<char> data;
+  for (int32_t k = 0; k < 1000; k++)
+    message_put(data, MESSAGE_INSERT, (k * 7919) % 1000 - 500, 10);
+  message_put(data, MESSAGE_INSERT, INT32_MIN, 10);
+  for (int32_t k = 0; k < 1000; k++)
+    message_put(data, MESSAGE_INSERT, k - 500, 1000);
+  message_put(data, MESSAGE_INSERT, INT32_MIN, 1000);
+  message_put(data, MESSAGE_QUERY, INT32_MIN, INT32_MAX);
+
+  REQUIRE(message_parse(ps, sdqu, data.data(), data.size(), 0) == data.size());
+  REQUIRE(ps->size == 1001);
+  REQUIRE(asset_prices_duplicate_timestamp_check(ps, INT32_MIN));
+  REQUIRE(asset_prices_duplicate_timestamp_check(ps, 499));
+  REQUIRE_FALSE(asset_prices_duplicate_timestamp_check(ps, 500));
+  int32_t mean;
+  memcpy(&mean, sdqu->data, sizeof(mean));
+  REQUIRE(static_cast<int32_t>(ntohl(static_cast<uint32_t>(mean))) == 10);
+
+  queue_free(&sdqu);
+  asset_prices_free(&ps);
+}
 
 // Helper function to create a list with multiple clients
 void create_test_list(struct clients_session **pca, int num_clients) {
@@ -199,9 +377,9 @@ TEST_CASE("clients_session operations", "[clients_session]") {
     clients_session_add(&ca, 3);
 
     // Check if we can find all added clients
-    REQUIRE(ca->recv_qu != NULL);
-    REQUIRE(ca->recv_qu->capacity == 512);
-    REQUIRE(ca->recv_qu->size == 0);
+    REQUIRE(ca->recv_rg != NULL);
+    REQUIRE(ca->recv_rg->capacity >= 512);
+    REQUIRE(ca->recv_rg->size == 0);
 
     clients_session_free_all(&ca);
   }
@@ -0,0 +1,64 @@
+#define CATCH_CONFIG_MAIN
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <catch2/catch.hpp>
+#include "netex-loadgen/histogram.h"
+
+// Left uninitialized for histogram_reset, freed with free()
+static struct histogram* histogram_test_alloc()
+{
+  return static_cast<struct histogram*>(malloc(sizeof(struct histogram)));
+}
+
+TEST_CASE("Histogram percentiles stay within the bucket error")
+{
+  struct histogram* h = histogram_test_alloc();
+  histogram_reset(h);
+  REQUIRE(histogram_percentile(h, 50.0) == 0);
+
+  // 1..100000 ns
+  for (uint64_t v = 1; v <= 100000; v++)
+    histogram_record(h, v);
+  REQUIRE(h->total == 100000);
+  REQUIRE(h->min == 1);
+  REQUIRE(h->max == 100000);
+
+  uint64_t p50 = histogram_percentile(h, 50.0);
+  uint64_t p99 = histogram_percentile(h, 99.0);
+  uint64_t p999 = histogram_percentile(h, 99.9);
+  REQUIRE(p50 >= 50000);
+  REQUIRE(p50 <= 50000 + 50000 / HISTOGRAM_SUB_BUCKETS);
+  REQUIRE(p99 >= 99000);
+  REQUIRE(p99 <= 100000);
+  REQUIRE(p999 >= 99900);
+  REQUIRE(p999 <= 100000);
+  REQUIRE(histogram_percentile(h, 100.0) == 100000);
+
+  free(h);
+}
+
+TEST_CASE("Histogram merge adds up both sides")
+{
+  struct histogram* a = histogram_test_alloc();
+  struct histogram* b = histogram_test_alloc();
+  histogram_reset(a);
+  histogram_reset(b);
+
+  for (int k = 0; k < 99; k++)
+    histogram_record(a, 10);
+  histogram_record(b, 1000000);
+  histogram_merge(a, b);
+
+  REQUIRE(a->total == 100);
+  REQUIRE(a->min == 10);
+  REQUIRE(a->max == 1000000);
+  REQUIRE(histogram_percentile(a, 50.0) == 10);
+  REQUIRE(histogram_percentile(a, 99.0) == 10);
+  REQUIRE(histogram_percentile(a, 100.0) == 1000000);
+
+  free(a);
+  free(b);
+}
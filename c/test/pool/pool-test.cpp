@@ -0,0 +1,60 @@
+#define CATCH_CONFIG_MAIN
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <catch2/catch.hpp>
+#include "utils/pool.h"
+
+struct pool_item {
+  int id;
+  char payload[20];
+};
+
+TEST_CASE("Pool hands out distinct aligned objects")
+{
+  struct pool p;
+  pool_init(&p, sizeof(struct pool_item), 4);
+
+  // More than a slab, forces a second one
+  struct pool_item* items[10];
+  for (int k = 0; k < 10; k++) {
+    items[k] = static_cast<struct pool_item*>(pool_get(&p));
+    REQUIRE(items[k] != nullptr);
+    uintptr_t addr = reinterpret_cast<uintptr_t>(items[k]);
+    REQUIRE((addr % alignof(max_align_t)) == 0);
+    items[k]->id = k;
+    memset(items[k]->payload, 'a' + k, sizeof(items[k]->payload));
+  }
+  REQUIRE(p.in_use == 10);
+
+  for (int k = 0; k < 10; k++) {
+    REQUIRE(items[k]->id == k);
+    REQUIRE(items[k]->payload[19] == 'a' + k);
+  }
+
+  for (int k = 0; k < 10; k++)
+    pool_put(&p, items[k]);
+  REQUIRE(p.in_use == 0);
+  pool_destroy(&p);
+}
+
+TEST_CASE("Pool recycles released objects first")
+{
+  struct pool p = POOL_INIT(sizeof(struct pool_item), 0);
+  pool_init(&p, sizeof(struct pool_item), 0);
+
+  void* a = pool_get(&p);
+  void* b = pool_get(&p);
+  pool_put(&p, a);
+  REQUIRE(pool_get(&p) == a);
+  pool_put(&p, b);
+  REQUIRE(pool_get(&p) == b);
+  REQUIRE(p.in_use == 2);
+
+  pool_put(&p, a);
+  pool_put(&p, b);
+  pool_destroy(&p);
+}
@@ -0,0 +1,451 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <catch2/catch.hpp>
+// Vendored without C++ guards
+extern "C" {
+#include "log/log.h"
+}
+#include "utils/reactor.h"
+#include "utils/ring.h"
+
+// A reactor running on its own thread behind a loopback listener. Handlers
+// only run on that thread, the test talks to it through blocking sockets.
+struct reactor_test {
+  struct reactor* r = nullptr;
+  uint16_t port = 0;
+  std::thread loop;
+  int res = -1;
+  std::atomic<bool> stop{false};
+  // Called from on_timeout, i.e. whenever the loop is idle
+  void (*on_idle)(struct reactor_test* t) = nullptr;
+
+  struct ring* rg = nullptr;  // Shared by every connection
+  std::vector<struct reactor_conn*> conns;  // Open ones, loop thread only
+  size_t recv_max = 0;  // For every new connection
+  std::vector<char> out;  // Sent by on_open when not empty
+  std::atomic<size_t> pending{0};  // Left by on_open's reactor_send
+
+  std::atomic<int> opens{0};
+  std::atomic<int> datas{0};
+  std::atomic<int> closes{0};
+  std::atomic<int> drains{0};
+  std::atomic<int> pauses{0};
+  std::atomic<int> wrong{0};  // Handler calls that should not happen
+  std::atomic<size_t> peak{0};  // Most rg ever held
+  std::atomic<bool> hold{false};
+  std::atomic<bool> holding{false};
+};
+
+// Sends back whatever arrives, unless the connection got paused
+static int reactor_test_echo(struct reactor_conn* conn)
+{
+  struct reactor_test* t =
+      static_cast<struct reactor_test*>(conn->reactor->udata);
+  t->datas++;
+  if (conn->fd == -1)
+    t->wrong++;
+  int res = reactor_recv(conn, t->rg);
+  t->peak = std::max(t->peak.load(), t->rg->size);
+  if (conn->paused) {
+    t->pauses++;
+    return (res == -1 ? REACTOR_KEEP : REACTOR_CLOSE);
+  }
+  if (t->rg->size > 0) {
+    int len = static_cast<int>(t->rg->size);
+    if (reactor_send(conn, ring_read_ptr(t->rg), &len) != 0)
+      res = -2;
+    ring_reset(t->rg);
+  }
+  return (res == -1 ? REACTOR_KEEP : REACTOR_CLOSE);
+}
+
+static int reactor_test_open(struct reactor_conn* conn)
+{
+  struct reactor_test* t =
+      static_cast<struct reactor_test*>(conn->reactor->udata);
+  t->conns.push_back(conn);
+  conn->udata = t;
+  conn->recv_max = t->recv_max;
+  if (!t->out.empty()) {
+    int len = static_cast<int>(t->out.size());
+    if (reactor_send(conn, t->out.data(), &len) != 0)
+      t->wrong++;
+    t->pending = reactor_pending(conn);
+  }
+  t->opens++;
+  return 0;
+}
+
+static void reactor_test_close(struct reactor_conn* conn)
+{
+  struct reactor_test* t =
+      static_cast<struct reactor_test*>(conn->reactor->udata);
+  if (conn->udata != t)
+    t->wrong++;
+  t->conns.erase(std::find(t->conns.begin(), t->conns.end(), conn));
+  t->closes++;
+}
+
+// All of on_open's output went out, done with the connection. io_uring
+// calls it after every send.
+static int reactor_test_drain(struct reactor_conn* conn)
+{
+  struct reactor_test* t =
+      static_cast<struct reactor_test*>(conn->reactor->udata);
+  t->drains++;
+  return (t->out.empty() ? REACTOR_KEEP : REACTOR_CLOSE);
+}
+
+static int reactor_test_timeout(struct reactor* r)
+{
+  struct reactor_test* t = static_cast<struct reactor_test*>(r->udata);
+  if (t->stop)
+    return REACTOR_CLOSE;
+  if (t->on_idle != nullptr)
+    t->on_idle(t);
+  return REACTOR_KEEP;
+}
+
+// Loopback listener on a port picked by the kernel
+static int reactor_test_listen(uint16_t* port)
+{
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  REQUIRE(fd != -1);
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  struct sockaddr* sa = reinterpret_cast<struct sockaddr*>(&addr);
+  socklen_t len = sizeof(addr);
+  REQUIRE(bind(fd, sa, len) == 0);
+  REQUIRE(listen(fd, 128) == 0);
+  REQUIRE(getsockname(fd, sa, &len) == 0);
+  *port = ntohs(addr.sin_port);
+  return fd;
+}
+
+static void reactor_test_start(struct reactor_test* t,
+                               int backend,
+                               int (*on_data)(struct reactor_conn* conn))
+{
+  log_set_quiet(true);
+  REQUIRE(ring_init(&t->rg, 4096) == 0);
+
+  int listen_fd = reactor_test_listen(&t->port);
+  struct reactor_config cfg = {};
+  cfg.backend = backend;
+  cfg.timeout_ms = 10;
+  cfg.handlers.on_open = reactor_test_open;
+  cfg.handlers.on_data = on_data;
+  cfg.handlers.on_close = reactor_test_close;
+  cfg.handlers.on_timeout = reactor_test_timeout;
+  cfg.handlers.on_drain = reactor_test_drain;
+  cfg.udata = t;
+  REQUIRE(reactor_init(&t->r, &cfg) == 0);
+  // Otherwise it silently tests epoll twice
+  REQUIRE(t->r->backend == backend);
+  REQUIRE(reactor_add_listener(t->r, listen_fd) == 0);
+  t->loop = std::thread([t]() { t->res = reactor_run(t->r); });
+}
+
+static void reactor_test_stop(struct reactor_test* t)
+{
+  t->stop = true;
+  t->loop.join();
+  REQUIRE(t->res == 0);
+  reactor_free(&t->r);
+  ring_free(&t->rg);
+  REQUIRE(t->wrong == 0);
+}
+
+// Blocking, so that a hung connection times out instead of hanging the test
+static int reactor_test_socket(void)
+{
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  REQUIRE(fd != -1);
+  struct timeval tv = {2, 0};
+  REQUIRE(setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == 0);
+  return fd;
+}
+
+static void reactor_test_connect(int fd, uint16_t port)
+{
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  struct sockaddr* sa = reinterpret_cast<struct sockaddr*>(&addr);
+  REQUIRE(connect(fd, sa, sizeof(addr)) == 0);
+}
+
+static int reactor_test_client(struct reactor_test* t)
+{
+  int fd = reactor_test_socket();
+  reactor_test_connect(fd, t->port);
+  return fd;
+}
+
+// Exactly size bytes, fewer once the server closes it or after the timeout.
+// io_uring task work interrupts blocking calls, which return EINTR instead
+// of restarting when they have a timeout.
+static ssize_t reactor_test_recv(int fd, char* buf, size_t size)
+{
+  size_t got = 0;
+  while (got < size) {
+    ssize_t nbytes = recv(fd, buf + got, size - got, 0);
+    if ((nbytes == -1) && (errno == EINTR))
+      continue;
+    if (nbytes <= 0)
+      return (got > 0 ? static_cast<ssize_t>(got) : nbytes);
+    got += static_cast<size_t>(nbytes);
+  }
+  return static_cast<ssize_t>(got);
+}
+
+// The server closed it, reset if it did not read everything first
+static bool reactor_test_closed(ssize_t nbytes)
+{
+  return (nbytes == 0) || ((nbytes == -1) && (errno == ECONNRESET));
+}
+
+// Handlers run on the loop thread, give them some time
+static bool reactor_test_wait(std::atomic<int>& value, int expected)
+{
+  for (int k = 0; (k < 2000) && (value != expected); k++)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  return (value == expected);
+}
+
+TEST_CASE("reactor opens, echoes and closes connections")
+{
+  struct reactor_test t;
+  const int backend = GENERATE(REACTOR_BACKEND_EPOLL, REACTOR_BACKEND_URING);
+  reactor_test_start(&t, backend, reactor_test_echo);
+
+  int a = reactor_test_client(&t);
+  int b = reactor_test_client(&t);
+  REQUIRE(reactor_test_wait(t.opens, 2));
+
+  char buf[16];
+  REQUIRE(send(a, "hello", 5, 0) == 5);
+  REQUIRE(send(b, "world", 5, 0) == 5);
+  REQUIRE(reactor_test_recv(a, buf, 5) == 5);
+  REQUIRE(memcmp(buf, "hello", 5) == 0);
+  REQUIRE(reactor_test_recv(b, buf, 5) == 5);
+  REQUIRE(memcmp(buf, "world", 5) == 0);
+
+  // The end of file reaches on_data, closing it calls on_close
+  close(a);
+  REQUIRE(reactor_test_wait(t.closes, 1));
+  REQUIRE(send(b, "again", 5, 0) == 5);
+  REQUIRE(reactor_test_recv(b, buf, 5) == 5);
+  REQUIRE(memcmp(buf, "again", 5) == 0);
+
+  // The ones still open are closed along with the reactor
+  reactor_test_stop(&t);
+  REQUIRE(t.closes == 2);
+  REQUIRE(reactor_test_recv(b, buf, sizeof(buf)) == 0);
+  close(b);
+}
+
+TEST_CASE("reactor keeps what the socket refuses until it's writable")
+{
+  struct reactor_test t;
+  // Way past what the socket buffers take
+  t.out.resize(16 * 1024 * 1024);
+  for (size_t k = 0; k < t.out.size(); k++)
+    t.out[k] = static_cast<char>(k % 251);
+  const int backend = GENERATE(REACTOR_BACKEND_EPOLL, REACTOR_BACKEND_URING);
+  reactor_test_start(&t, backend, reactor_test_echo);
+
+  int fd = reactor_test_client(&t);
+  REQUIRE(reactor_test_wait(t.opens, 1));
+  REQUIRE(t.pending > 0);
+  REQUIRE(t.pending <= t.out.size());
+
+  // Flushed as the client reads, on_drain closes it once all went out
+  std::vector<char> in;
+  char buf[65536];
+  ssize_t nbytes;
+  while ((nbytes = reactor_test_recv(fd, buf, sizeof(buf))) > 0)
+    in.insert(in.end(), buf, buf + nbytes);
+  REQUIRE(nbytes == 0);
+  REQUIRE(in.size() == t.out.size());
+  REQUIRE(in == t.out);
+  REQUIRE(reactor_test_wait(t.closes, 1));
+  REQUIRE(t.drains == 1);
+  close(fd);
+
+  reactor_test_stop(&t);
+}
+
+// Answers what was held back and reads again
+static void reactor_test_resume(struct reactor_test* t)
+{
+  for (struct reactor_conn* conn : t->conns) {
+    if (!conn->paused)
+      continue;
+    int len = static_cast<int>(t->rg->size);
+    if ((len > 0) && (reactor_send(conn, ring_read_ptr(t->rg), &len) != 0))
+      t->wrong++;
+    ring_reset(t->rg);
+    if (reactor_resume(conn) != 0)
+      t->wrong++;
+  }
+}
+
+TEST_CASE("reactor pauses past recv_max until resumed")
+{
+  struct reactor_test t;
+  t.recv_max = 8;
+  t.on_idle = reactor_test_resume;
+  const int backend = GENERATE(REACTOR_BACKEND_EPOLL, REACTOR_BACKEND_URING);
+  reactor_test_start(&t, backend, reactor_test_echo);
+
+  int fd = reactor_test_client(&t);
+  REQUIRE(reactor_test_wait(t.opens, 1));
+  const char msg[] = "0123456789abcdefghijklmnopqrstuv";
+  REQUIRE(send(fd, msg, 32, 0) == 32);
+  char buf[32];
+  REQUIRE(reactor_test_recv(fd, buf, sizeof(buf)) == 32);
+  REQUIRE(memcmp(buf, msg, 32) == 0);
+  REQUIRE(t.pauses > 0);
+  // io_uring may go past it by what the kernel had already received
+  if (backend == REACTOR_BACKEND_EPOLL) {
+    REQUIRE(t.pauses == 4);
+    REQUIRE(t.peak == 8);
+  }
+  close(fd);
+  REQUIRE(reactor_test_wait(t.closes, 1));
+
+  reactor_test_stop(&t);
+}
+
+// Keeps the loop away from the sockets while the test holds it
+static void reactor_test_hold(struct reactor_test* t)
+{
+  if (!t->hold)
+    return;
+  t->holding = true;
+  while (t->hold)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  t->holding = false;
+}
+
+// Closes every other connection, they have events later in this batch
+static int reactor_test_close_others(struct reactor_conn* conn)
+{
+  struct reactor_test* t =
+      static_cast<struct reactor_test*>(conn->reactor->udata);
+  std::vector<struct reactor_conn*> others = t->conns;
+  for (struct reactor_conn* other : others) {
+    if (other != conn)
+      reactor_close(other);
+  }
+  return reactor_test_echo(conn);
+}
+
+TEST_CASE("reactor skips connections closed earlier in the batch")
+{
+  struct reactor_test t;
+  t.on_idle = reactor_test_hold;
+  const int backend = GENERATE(REACTOR_BACKEND_EPOLL, REACTOR_BACKEND_URING);
+  reactor_test_start(&t, backend, reactor_test_close_others);
+
+  std::vector<int> clients;
+  for (int k = 0; k < 4; k++)
+    clients.push_back(reactor_test_client(&t));
+  REQUIRE(reactor_test_wait(t.opens, 4));
+  t.hold = true;
+  while (!t.holding)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+  // All of them readable by the time the loop waits again
+  for (int fd : clients)
+    REQUIRE(send(fd, "ping", 4, 0) == 4);
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  t.hold = false;
+
+  // Only the first one is answered, the rest never reach on_data
+  int answered = 0;
+  for (int fd : clients) {
+    char buf[4];
+    ssize_t nbytes = reactor_test_recv(fd, buf, sizeof(buf));
+    if (nbytes == 4) {
+      REQUIRE(memcmp(buf, "ping", 4) == 0);
+      answered++;
+    } else {
+      REQUIRE(reactor_test_closed(nbytes));
+    }
+    close(fd);
+  }
+  REQUIRE(answered == 1);
+  REQUIRE(reactor_test_wait(t.closes, 4));
+  // Its data, then its end of file
+  REQUIRE(t.datas == 2);
+
+  reactor_test_stop(&t);
+}
+
+TEST_CASE("reactor sheds connections while out of file descriptors")
+{
+  struct reactor_test t;
+  const int backend = GENERATE(REACTOR_BACKEND_EPOLL, REACTOR_BACKEND_URING);
+  reactor_test_start(&t, backend, reactor_test_echo);
+
+  // The clients' descriptors come first, the server only has a few left
+  std::vector<int> clients(64);
+  int top = 0;
+  for (int& fd : clients) {
+    fd = reactor_test_socket();
+    top = std::max(top, fd);
+  }
+  struct rlimit old_limit, limit;
+  REQUIRE(getrlimit(RLIMIT_NOFILE, &old_limit) == 0);
+  limit = old_limit;
+  limit.rlim_cur = static_cast<rlim_t>(top) + 5;
+  REQUIRE(setrlimit(RLIMIT_NOFILE, &limit) == 0);
+
+  // Whatever the server can't take is closed, rather than left hanging in
+  // the backlog
+  for (int fd : clients)
+    reactor_test_connect(fd, t.port);
+  int served = 0, shed = 0;
+  for (int fd : clients) {
+    char buf[4];
+    send(fd, "ping", 4, MSG_NOSIGNAL);
+    ssize_t nbytes = reactor_test_recv(fd, buf, sizeof(buf));
+    if (nbytes == 4)
+      served++;
+    else if (reactor_test_closed(nbytes))
+      shed++;
+  }
+  CHECK(served > 0);
+  CHECK(shed > 0);
+  CHECK(served + shed == static_cast<int>(clients.size()));
+
+  // Still serving once descriptors are free again
+  for (int fd : clients)
+    close(fd);
+  int fd = reactor_test_client(&t);
+  char buf[4];
+  REQUIRE(send(fd, "pong", 4, MSG_NOSIGNAL) == 4);
+  REQUIRE(reactor_test_recv(fd, buf, sizeof(buf)) == 4);
+  REQUIRE(memcmp(buf, "pong", 4) == 0);
+  close(fd);
+
+  REQUIRE(setrlimit(RLIMIT_NOFILE, &old_limit) == 0);
+  reactor_test_stop(&t);
+}
@@ -0,0 +1,120 @@
+#define CATCH_CONFIG_MAIN
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include <catch2/catch.hpp>
+#include "utils/ring.h"
+
+TEST_CASE("Ring Initialization")
+{
+  struct ring* rg = nullptr;
+  REQUIRE(ring_init(&rg, 100) == 0);
+  REQUIRE(rg != nullptr);
+  // Rounded up to the page size
+  REQUIRE(rg->capacity >= 4096);
+  REQUIRE(rg->size == 0);
+  REQUIRE(ring_space(rg) == rg->capacity);
+
+  ring_free(&rg);
+  REQUIRE(rg == nullptr);
+}
+
+TEST_CASE("Ring keeps the partial tail after consuming")
+{
+  struct ring* rg = nullptr;
+  REQUIRE(ring_init(&rg, 4096) == 0);
+
+  const char* msgs = "first\nsecond\npart";
+  REQUIRE(ring_push(rg, msgs, strlen(msgs)) == 0);
+  ring_consume(rg, strlen("first\nsecond\n"));
+  REQUIRE(rg->size == 4);
+  REQUIRE(memcmp(ring_read_ptr(rg), "part", 4) == 0);
+
+  // The rest of the message shows up right after it
+  memcpy(ring_write_ptr(rg), "ial\n", 4);
+  ring_commit(rg, 4);
+  REQUIRE(rg->size == 8);
+  REQUIRE(memcmp(ring_read_ptr(rg), "partial\n", 8) == 0);
+
+  ring_consume(rg, rg->size);
+  REQUIRE(rg->size == 0);
+  ring_free(&rg);
+}
+
+TEST_CASE("Ring regions are contiguous across the wrap")
+{
+  struct ring* rg = nullptr;
+  REQUIRE(ring_init(&rg, 4096) == 0);
+  size_t cap = rg->capacity;
+
+  // Move the head close to the end of the buffer
+  char* filler = static_cast<char*>(malloc(cap));
+  memset(filler, 'x', cap);
+  REQUIRE(ring_push(rg, filler, cap - 10) == 0);
+  ring_consume(rg, cap - 12);
+  REQUIRE(rg->size == 2);
+
+  char pattern[64];
+  for (size_t k = 0; k < sizeof(pattern); k++)
+    pattern[k] = static_cast<char>('a' + k % 26);
+  REQUIRE(ring_push(rg, pattern, sizeof(pattern)) == 0);
+  REQUIRE(rg->capacity == cap);
+
+  struct iovec iov;
+  ring_read_iov(rg, &iov);
+  REQUIRE(iov.iov_len == 2 + sizeof(pattern));
+  const char* got = static_cast<const char*>(iov.iov_base);
+  REQUIRE(memcmp(got + 2, pattern, sizeof(pattern)) == 0);
+
+  ring_write_iov(rg, &iov);
+  REQUIRE(iov.iov_len == cap - 2 - sizeof(pattern));
+  // The whole writable region is usable at once
+  memset(iov.iov_base, 'y', iov.iov_len);
+  ring_commit(rg, iov.iov_len);
+  REQUIRE(ring_space(rg) == 0);
+  REQUIRE(memcmp(ring_read_ptr(rg) + 2, pattern, sizeof(pattern)) == 0);
+
+  free(filler);
+  ring_free(&rg);
+}
+
+TEST_CASE("Ring grows and keeps its data")
+{
+  struct ring* rg = nullptr;
+  REQUIRE(ring_init(&rg, 4096) == 0);
+  size_t cap = rg->capacity;
+
+  char* data = static_cast<char*>(malloc(3 * cap));
+  for (size_t k = 0; k < 3 * cap; k++)
+    data[k] = static_cast<char>(k % 251);
+
+  REQUIRE(ring_push(rg, data, cap / 2) == 0);
+  ring_consume(rg, cap / 4);
+  REQUIRE(ring_push(rg, data + cap / 2, 2 * cap) == 0);
+  REQUIRE(rg->capacity > cap);
+  REQUIRE(rg->size == cap / 4 + 2 * cap);
+  REQUIRE(memcmp(ring_read_ptr(rg), data + cap / 4, rg->size) == 0);
+
+  free(data);
+  ring_free(&rg);
+}
+
+TEST_CASE("Ring released on this thread is reused")
+{
+  struct ring* rg = nullptr;
+  REQUIRE(ring_init(&rg, 4096) == 0);
+  REQUIRE(ring_push(rg, "stale", 5) == 0);
+  struct ring* first = rg;
+  char* data = rg->data;
+  ring_free(&rg);
+
+  REQUIRE(ring_init(&rg, 100) == 0);
+  REQUIRE(rg == first);
+  REQUIRE(rg->data == data);
+  REQUIRE(rg->size == 0);
+  REQUIRE(rg->head == 0);
+  ring_free(&rg);
+}
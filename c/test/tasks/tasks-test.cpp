@@ -0,0 +1,79 @@
+#include <stdint.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include <catch2/catch.hpp>
+#include "utils/tasks.h"
+
+struct square {
+  struct task task;  // First, a task points at its square
+  uint64_t in;
+  uint64_t out;
+};
+
+static void square_run(struct task* task)
+{
+  struct square* s = reinterpret_cast<struct square*>(task);
+  s->out = s->in * s->in;
+}
+
+TEST_CASE("Tasks run on the pool and come back to their inbox")
+{
+  struct tasks* pool = nullptr;
+  REQUIRE(tasks_init(&pool, 4) == 0);
+  REQUIRE(pool->nthreads == 4);
+
+  struct tasks_inbox inbox;
+  REQUIRE(tasks_inbox_init(&inbox) == 0);
+
+  std::vector<struct square> squares(1000);
+  for (size_t k = 0; k < squares.size(); k++) {
+    squares[k].task.run = square_run;
+    squares[k].task.inbox = &inbox;
+    squares[k].in = k;
+    tasks_submit(pool, &squares[k].task);
+  }
+  tasks_inbox_drain(&inbox);
+
+  // The eventfd tells the owner about them
+  uint64_t count = 0;
+  REQUIRE(read(inbox.notify_fd, &count, sizeof(count)) == sizeof(count));
+  REQUIRE(count == squares.size());
+
+  size_t back = 0;
+  for (struct task* t = tasks_inbox_take(&inbox); t != nullptr; t = t->next) {
+    struct square* s = reinterpret_cast<struct square*>(t);
+    REQUIRE(s->out == s->in * s->in);
+    back++;
+  }
+  REQUIRE(back == squares.size());
+  REQUIRE(tasks_inbox_take(&inbox) == nullptr);
+
+  tasks_inbox_destroy(&inbox);
+  tasks_free(&pool);
+  REQUIRE(pool == nullptr);
+}
+
+TEST_CASE("Tasks still queued run before the pool stops")
+{
+  struct tasks* pool = nullptr;
+  REQUIRE(tasks_init(&pool, 1) == 0);
+  struct tasks_inbox inbox;
+  REQUIRE(tasks_inbox_init(&inbox) == 0);
+
+  std::vector<struct square> squares(100);
+  for (size_t k = 0; k < squares.size(); k++) {
+    squares[k].task.run = square_run;
+    squares[k].task.inbox = &inbox;
+    squares[k].in = k + 1;
+    tasks_submit(pool, &squares[k].task);
+  }
+  tasks_free(&pool);
+
+  for (struct square& s : squares)
+    REQUIRE(s.out == s.in * s.in);
+  while (tasks_inbox_take(&inbox) != nullptr)
+    ;
+  tasks_inbox_destroy(&inbox);
+}